@@ -0,0 +1,334 @@
+#include "archive.hpp"
+#include "latex.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <limits>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+	const char magic[8] = {'L', 'T', 'X', 'A', 'R', 'C', '1', '\n'};
+
+	/*! The start of the file. */
+	struct Header
+	{
+		char magic[8];
+
+		std::uint64_t count;
+
+		std::uint64_t fanout;
+
+		std::uint64_t index;
+
+		std::uint64_t size;
+
+		char reserved[24];
+	};
+
+	static_assert(sizeof(Header) == Archive::header_size, "Header size changed");
+
+	static_assert(sizeof(Archive::Entry) == 32, "Entry size changed");
+
+	/*! Orders entries by fingerprint, then format. */
+	bool before(const Archive::Entry& entry,
+				const Archive::Key& key,
+				Archive::Format format) noexcept
+	{
+		if (entry.high != key.high) return entry.high < key.high;
+
+		if (entry.low != key.low) return entry.low < key.low;
+
+		return entry.format < format;
+	}
+
+	/*! Closes a file descriptor. */
+	struct Descriptor
+	{
+		~Descriptor() { if (file >= 0) ::close(file); }
+
+		int file;
+	};
+}
+
+Archive::Archive(const std::string& path)
+: _mapping(nullptr)
+, _mapping_size(0)
+, _count(0)
+, _fanout(nullptr)
+, _index(nullptr)
+, _payloads_end(header_size)
+{
+	Descriptor descriptor{::open(path.c_str(), O_RDONLY)};
+
+	if (descriptor.file < 0)
+	{
+		throw Latex::FileException("Could not open archive " + path);
+	}
+
+	struct stat status;
+
+	if (::fstat(descriptor.file, &status) < 0 ||
+		static_cast<std::size_t>(status.st_size) < header_size)
+	{
+		throw Latex::FileException(path + " is not an archive");
+	}
+
+	_mapping_size = static_cast<std::size_t>(status.st_size);
+
+	// Stays valid after the descriptor is closed
+	_mapping = ::mmap(nullptr,
+					  _mapping_size,
+					  PROT_READ,
+					  MAP_SHARED,
+					  descriptor.file,
+					  0);
+
+	if (_mapping == MAP_FAILED)
+	{
+		_mapping = nullptr;
+
+		throw Latex::FileException("Could not map archive " + path);
+	}
+
+	auto header = static_cast<const Header*>(_mapping);
+
+	const auto fanout_size = (buckets + 1) * sizeof(std::uint64_t);
+
+	// Checked so that lookups can trust the layout
+	bool valid = std::memcmp(header->magic, magic, sizeof magic) == 0 &&
+				 header->size == _mapping_size &&
+				 header->fanout >= header_size &&
+				 header->fanout <= _mapping_size &&
+				 header->fanout % sizeof(std::uint64_t) == 0 &&
+				 header->index == header->fanout + fanout_size &&
+				 header->count <= (_mapping_size - header_size) / sizeof(Entry) &&
+				 header->index + header->count * sizeof(Entry) == _mapping_size;
+
+	if (valid)
+	{
+		auto bytes = static_cast<const char*>(_mapping);
+
+		_fanout = reinterpret_cast<const std::uint64_t*>(bytes + header->fanout);
+
+		_index = reinterpret_cast<const Entry*>(bytes + header->index);
+
+		_count = static_cast<std::size_t>(header->count);
+
+		_payloads_end = header->fanout;
+
+		valid = _fanout[0] == 0 && _fanout[buckets] == _count;
+	}
+
+	if (! valid)
+	{
+		::munmap(_mapping, _mapping_size);
+
+		_mapping = nullptr;
+
+		throw Latex::FileException(path + " is not an archive");
+	}
+}
+
+Archive::~Archive()
+{
+	if (_mapping) ::munmap(_mapping, _mapping_size);
+}
+
+Archive::View Archive::find(const Key& key, Format format) const noexcept
+{
+	auto index = bucket(key);
+
+	// Bounded, as a corrupt table must not lead out of the index
+	auto first = _index + std::min<std::uint64_t>(_fanout[index], _count);
+
+	auto last = _index + std::min<std::uint64_t>(_fanout[index + 1], _count);
+
+	if (first >= last) return View();
+
+	auto entry = std::lower_bound(first, last, key, [format] (const Entry& entry,
+															  const Key& key) {
+		return before(entry, key, format);
+	});
+
+	if (entry == last ||
+		entry->high != key.high ||
+		entry->low != key.low ||
+		entry->format != format)
+	{
+		return View();
+	}
+
+	if (entry->offset < header_size ||
+		entry->offset > _payloads_end ||
+		entry->size > _payloads_end - entry->offset)
+	{
+		return View();
+	}
+
+	auto data = static_cast<const char*>(_mapping) + entry->offset;
+
+	return View(data, entry->size);
+}
+
+Archive::View Archive::find(const std::string& equation, Format format) const noexcept
+{
+	return find(Canonical::digest(equation), format);
+}
+
+std::size_t Archive::size() const noexcept
+{
+	return _count;
+}
+
+std::size_t Archive::bucket(const Key& key) noexcept
+{
+	return static_cast<std::size_t>(key.high >> 48);
+}
+
+ArchiveWriter::ArchiveWriter(const std::string& path)
+: _path(path)
+, _file(path, std::ios::binary | std::ios::trunc)
+, _offset(Archive::header_size)
+, _finished(false)
+{
+	if (! _file) throw Latex::FileException("Could not open archive " + path);
+
+	// Filled in by finish(); until then the file is no archive
+	Header header{};
+
+	_file.write(reinterpret_cast<const char*>(&header), sizeof header);
+}
+
+ArchiveWriter::~ArchiveWriter()
+{
+	try
+	{
+		finish();
+	}
+
+	// Nothing to be done about it here
+	catch (const Latex::FileException&) { }
+}
+
+bool ArchiveWriter::add(const Key& key, Format format, const std::string& payload)
+{
+	if (payload.size() > std::numeric_limits<std::uint32_t>::max())
+	{
+		throw Latex::FileException("Payload too large for archive " + _path);
+	}
+
+	auto bit = static_cast<std::uint8_t>(1 << static_cast<int>(format));
+
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	if (_finished) throw Latex::FileException("Archive " + _path + " is finished");
+
+	auto& formats = _formats[key];
+
+	if (formats & bit) return false;
+
+	if (! _file.write(payload.data(), static_cast<std::streamsize>(payload.size())))
+	{
+		throw Latex::FileException("Could not write archive " + _path);
+	}
+
+	Archive::Entry entry{};
+
+	entry.high = key.high;
+	entry.low = key.low;
+	entry.offset = _offset;
+	entry.size = static_cast<std::uint32_t>(payload.size());
+	entry.format = format;
+
+	_index.push_back(entry);
+
+	formats |= bit;
+
+	_offset += payload.size();
+
+	return true;
+}
+
+bool ArchiveWriter::add(const std::string& equation,
+						Format format,
+						const std::string& payload)
+{
+	return add(Canonical::digest(equation), format, payload);
+}
+
+bool ArchiveWriter::contains(const Key& key, Format format) const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	auto formats = _formats.find(key);
+
+	if (formats == _formats.end()) return false;
+
+	return formats->second & (1 << static_cast<int>(format));
+}
+
+void ArchiveWriter::finish()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	if (_finished) return;
+
+	_finished = true;
+
+	std::sort(_index.begin(), _index.end(), [] (const Archive::Entry& first,
+												 const Archive::Entry& second) {
+		return before(first, {second.high, second.low}, second.format);
+	});
+
+	std::vector<std::uint64_t> fanout(Archive::buckets + 1, 0);
+
+	for (const auto& entry : _index)
+	{
+		++fanout[Archive::bucket({entry.high, entry.low}) + 1];
+	}
+
+	for (std::size_t bucket = 1; bucket <= Archive::buckets; ++bucket)
+	{
+		fanout[bucket] += fanout[bucket - 1];
+	}
+
+	// Aligns the tables, so that they can be read in place
+	auto padding = (8 - _offset % 8) % 8;
+
+	_file.write("\0\0\0\0\0\0\0", static_cast<std::streamsize>(padding));
+
+	Header header{};
+
+	std::memcpy(header.magic, magic, sizeof magic);
+
+	header.count = _index.size();
+	header.fanout = _offset + padding;
+	header.index = header.fanout + fanout.size() * sizeof(std::uint64_t);
+	header.size = header.index + _index.size() * sizeof(Archive::Entry);
+
+	_file.write(reinterpret_cast<const char*>(fanout.data()),
+				static_cast<std::streamsize>(fanout.size() * sizeof(std::uint64_t)));
+
+	_file.write(reinterpret_cast<const char*>(_index.data()),
+				static_cast<std::streamsize>(_index.size() * sizeof(Archive::Entry)));
+
+	// The header goes last, so that a cut-short file is no archive
+	_file.seekp(0);
+
+	_file.write(reinterpret_cast<const char*>(&header), sizeof header);
+
+	_file.close();
+
+	if (! _file) throw Latex::FileException("Could not write archive " + _path);
+}
+
+std::size_t ArchiveWriter::size() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	return _index.size();
+}
@@ -0,0 +1,302 @@
+/********************************************************//*!
+*
+*	@file archive.hpp
+*
+*	@author Peter Goldsborough.
+*
+************************************************************/
+
+#ifndef ARCHIVE_HPP
+#define ARCHIVE_HPP
+
+#include "canonical.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/***************************************************************************//*!
+*
+*	@brief A read-only archive of pre-rendered equations, memory-mapped.
+*
+*	@details An archive is a single immutable file, written by an
+*			 ArchiveWriter (see tools/export), holding the renders of a
+*			 corpus of equations, each under the digest of its equation
+*			 as spelled (see Canonical::digest()) and its format. The
+*			 file is:
+*
+*			 - a 64-byte header: the magic bytes "LTXARC1\n", then the
+*			   number of entries, the offset of the fanout table, the
+*			   offset of the index and the size of the file, as 64-bit
+*			   integers;
+*			 - the payloads, back to back;
+*			 - the fanout table: for each value b of the top 16 bits of
+*			   a fingerprint, the number of entries below b, as 2^16 + 1
+*			   64-bit integers;
+*			 - the index: one Entry per payload, sorted by fingerprint
+*			   and format.
+*
+*			 Integers are in the byte order of the machine that wrote
+*			 the archive. Lookups narrow the index down to a fanout
+*			 bucket, a few entries for even millions of equations, and
+*			 search it binarily. find() returns a view of the payload
+*			 in the mapping itself, without copying it, so it can be
+*			 served straight from the page cache. Since the file never
+*			 changes, views stay valid as long as the archive is open.
+*
+*			 All member functions are thread-safe.
+*
+*******************************************************************************/
+
+class Archive
+{
+public:
+
+	using Key = Canonical::Fingerprint;
+
+	/*! What a payload was rendered to. */
+	enum class Format : std::uint8_t { HTML, PNG, JPG, SVG };
+
+	/*! Where a payload is, as stored in the index. */
+	struct Entry
+	{
+		std::uint64_t high;
+
+		std::uint64_t low;
+
+		/*! From the start of the file. */
+		std::uint64_t offset;
+
+		std::uint32_t size;
+
+		Format format;
+
+		std::uint8_t padding[3];
+	};
+
+	/*! A view of an archived payload. */
+	class View
+	{
+	public:
+
+		View() = default;
+
+		View(const char* data, std::size_t size) noexcept
+		: _data(data)
+		, _size(size)
+		{ }
+
+		/*! Whether the payload was found. */
+		explicit operator bool() const noexcept { return _data != nullptr; }
+
+		/*! The payload's bytes, in the mapping. */
+		const char* data() const noexcept { return _data; }
+
+		std::size_t size() const noexcept { return _size; }
+
+	private:
+
+		const char* _data = nullptr;
+
+		std::size_t _size = 0;
+	};
+
+	/***********************************************************************//*!
+	*
+	*	@brief Opens and maps an archive.
+	*
+	*	@throws Latex::FileException If the file could not be opened or
+	*			mapped, or is not an archive.
+	*
+	***************************************************************************/
+
+	explicit Archive(const std::string& path);
+
+	Archive(const Archive& other) = delete;
+
+	Archive& operator=(const Archive& other) = delete;
+
+	/***********************************************************************//*!
+	*
+	*	@brief Unmaps the archive, invalidating all views.
+	*
+	***************************************************************************/
+
+	virtual ~Archive();
+
+	/***********************************************************************//*!
+	*
+	*	@brief Looks a payload up.
+	*
+	*	@return A view of the payload, which is false if there is none.
+	*
+	***************************************************************************/
+
+	virtual View find(const Key& key, Format format) const noexcept;
+
+	/***********************************************************************//*!
+	*
+	*	@brief Looks the payload of an equation up, by its digest.
+	*
+	*	@return A view of the payload, which is false if there is none.
+	*
+	***************************************************************************/
+
+	virtual View find(const std::string& equation, Format format) const noexcept;
+
+	/***********************************************************************//*!
+	*
+	*	@brief Returns the number of payloads.
+	*
+	***************************************************************************/
+
+	std::size_t size() const noexcept;
+
+	/*! The number of fanout buckets, one per value of
+		the top 16 bits of a fingerprint. */
+	static const std::size_t buckets = 1 << 16;
+
+	/*! The size of the header, where the payloads start. */
+	static const std::size_t header_size = 64;
+
+	/*! Returns the fanout bucket of a key. */
+	static std::size_t bucket(const Key& key) noexcept;
+
+protected:
+
+	/*! The mapping of the whole file. */
+	void* _mapping;
+
+	std::size_t _mapping_size;
+
+	std::size_t _count;
+
+	const std::uint64_t* _fanout;
+
+	const Entry* _index;
+
+	/*! Where the payloads end. */
+	std::uint64_t _payloads_end;
+};
+
+/***************************************************************************//*!
+*
+*	@brief Writes an Archive.
+*
+*	@details Payloads are written to the file as they are added; only
+*			 their index entries are kept in memory until finish() sorts
+*			 and writes them. The archive is complete (and can be opened)
+*			 only after finish(). A writer may be shared by engines on
+*			 different threads.
+*
+*******************************************************************************/
+
+class ArchiveWriter
+{
+public:
+
+	using Key = Archive::Key;
+
+	using Format = Archive::Format;
+
+	/***********************************************************************//*!
+	*
+	*	@brief Creates (or truncates) an archive file.
+	*
+	*	@throws Latex::FileException If the file could not be opened.
+	*
+	***************************************************************************/
+
+	explicit ArchiveWriter(const std::string& path);
+
+	ArchiveWriter(const ArchiveWriter& other) = delete;
+
+	ArchiveWriter& operator=(const ArchiveWriter& other) = delete;
+
+	/***********************************************************************//*!
+	*
+	*	@brief Finishes the archive, unless done already.
+	*
+	***************************************************************************/
+
+	virtual ~ArchiveWriter();
+
+	/***********************************************************************//*!
+	*
+	*	@brief Adds a payload. Thread-safe.
+	*
+	*	@return False if the archive already has a payload for the key
+	*			in this format, which is kept.
+	*
+	*	@throws Latex::FileException If the payload could not be written,
+	*			or the archive is already finished.
+	*
+	***************************************************************************/
+
+	virtual bool add(const Key& key, Format format, const std::string& payload);
+
+	/***********************************************************************//*!
+	*
+	*	@brief Adds the payload of an equation, under its digest.
+	*		   Thread-safe.
+	*
+	*	@see add()
+	*
+	***************************************************************************/
+
+	virtual bool add(const std::string& equation,
+					 Format format,
+					 const std::string& payload);
+
+	/***********************************************************************//*!
+	*
+	*	@brief Returns whether the archive has a payload for a key
+	*		   in a format. Thread-safe.
+	*
+	***************************************************************************/
+
+	virtual bool contains(const Key& key, Format format) const;
+
+	/***********************************************************************//*!
+	*
+	*	@brief Writes the index and the header, completing the archive.
+	*
+	*	@throws Latex::FileException If the archive could not be written.
+	*
+	***************************************************************************/
+
+	virtual void finish();
+
+	/***********************************************************************//*!
+	*
+	*	@brief Returns the number of payloads added so far.
+	*
+	***************************************************************************/
+
+	std::size_t size() const;
+
+protected:
+
+	std::string _path;
+
+	std::ofstream _file;
+
+	/*! Where the next payload goes. */
+	std::uint64_t _offset;
+
+	std::vector<Archive::Entry> _index;
+
+	/*! The formats each key has, one bit per format. */
+	std::unordered_map<Key, std::uint8_t> _formats;
+
+	bool _finished;
+
+	/*! Guards all of the above. */
+	mutable std::mutex _mutex;
+};
+
+#endif /* ARCHIVE_HPP */
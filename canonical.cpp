@@ -0,0 +1,425 @@
+#include "canonical.hpp"
+
+#include <array>
+#include <cstring>
+
+namespace
+{
+	enum Class : std::uint8_t { Ordinary, Space, Backslash, Script };
+
+	/*! The class of every byte, such that runs of ordinary bytes
+	*   can be found (and copied) without branching per character. */
+	const std::array<std::uint8_t, 256> classes = [] {
+		std::array<std::uint8_t, 256> table{};
+
+		for (auto c : {' ', '\t', '\n', '\r', '\f', '\v'})
+		{
+			table[static_cast<unsigned char>(c)] = Space;
+		}
+
+		table['\\'] = Backslash;
+		table['^'] = Script;
+		table['_'] = Script;
+
+		return table;
+	}();
+
+	bool is_letter(char c)
+	{
+		return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+	}
+
+	bool is_alphanumeric(char c)
+	{
+		return is_letter(c) || (c >= '0' && c <= '9');
+	}
+
+	bool is_space(char c)
+	{
+		return classes[static_cast<unsigned char>(c)] == Space;
+	}
+
+	bool equals(const char* begin, const char* end, const char* word)
+	{
+		auto size = static_cast<std::size_t>(end - begin);
+
+		return std::strlen(word) == size && std::memcmp(begin, word, size) == 0;
+	}
+
+	/*! Commands whose braced arguments are not (only) math, and so
+	*   are copied verbatim, with the number of such arguments. */
+	int verbatim_arguments(const char* begin, const char* end)
+	{
+		static const struct { const char* name; int arguments; } commands[] = {
+			{"\\text", 1}, {"\\mbox", 1}, {"\\textrm", 1}, {"\\textit", 1},
+			{"\\textbf", 1}, {"\\textsf", 1}, {"\\texttt", 1}, {"\\textup", 1},
+			{"\\textmd", 1}, {"\\textnormal", 1}, {"\\emph", 1}, {"\\color", 1},
+			{"\\textcolor", 2}, {"\\colorbox", 2}, {"\\fcolorbox", 3},
+			{"\\begin", 2}, {"\\end", 1}, {"\\rule", 2}, {"\\href", 2},
+			{"\\url", 1}, {"\\hspace", 1}, {"\\kern", 1}, {"\\mkern", 1},
+			{"\\mskip", 1}, {"\\hskip", 1}, {"\\label", 1}, {"\\tag", 1}
+		};
+
+		for (const auto& command : commands)
+		{
+			if (equals(begin, end, command.name)) return command.arguments;
+		}
+
+		return 0;
+	}
+
+	/*! Greek letters, which render the same as a script with or without
+	*   braces (as do single letters and digits). */
+	bool is_greek(const char* begin, const char* end)
+	{
+		static const char* const letters[] = {
+			"\\alpha", "\\beta", "\\gamma", "\\delta", "\\epsilon", "\\zeta",
+			"\\eta", "\\theta", "\\iota", "\\kappa", "\\lambda", "\\mu", "\\nu",
+			"\\xi", "\\pi", "\\rho", "\\sigma", "\\tau", "\\upsilon", "\\phi",
+			"\\chi", "\\psi", "\\omega", "\\varepsilon", "\\vartheta",
+			"\\varpi", "\\varrho", "\\varsigma", "\\varphi", "\\Gamma",
+			"\\Delta", "\\Theta", "\\Lambda", "\\Xi", "\\Pi", "\\Sigma",
+			"\\Upsilon", "\\Phi", "\\Psi", "\\Omega"
+		};
+
+		for (auto letter : letters)
+		{
+			if (equals(begin, end, letter)) return true;
+		}
+
+		return false;
+	}
+
+	const char* skip_spaces(const char* i, const char* end)
+	{
+		while (i != end && is_space(*i)) ++i;
+
+		return i;
+	}
+
+	const char* control_word_end(const char* i, const char* end)
+	{
+		while (i != end && is_letter(*i)) ++i;
+
+		return i;
+	}
+
+	/*! Returns the end of the brace group starting at begin,
+	*   or end if the group is never closed. */
+	const char* group_end(const char* begin, const char* end)
+	{
+		int depth = 0;
+
+		for (auto i = begin; i != end; ++i)
+		{
+			if (*i == '\\')
+			{
+				// Escaped braces don't count
+				if (++i == end) break;
+			}
+
+			else if (*i == '{') ++depth;
+
+			else if (*i == '}' && --depth == 0) return i + 1;
+		}
+
+		return end;
+	}
+
+	/*! Appends canonical tokens to a string. */
+	struct Builder
+	{
+		void append(const char* data, std::size_t size)
+		{
+			output.append(data, size);
+		}
+
+		std::string& output;
+	};
+
+	/*! Hashes canonical tokens as they come, without buffering them. */
+	class Hasher
+	{
+	public:
+
+		void append(const char* data, std::size_t size) noexcept
+		{
+			_length += size;
+
+			for (std::size_t i = 0; i < size; ++i)
+			{
+				_word |= std::uint64_t(static_cast<unsigned char>(data[i])) << (8 * _fill);
+
+				if (++_fill == 8) _mix();
+			}
+		}
+
+		Canonical::Fingerprint finish() noexcept
+		{
+			if (_fill) _mix();
+
+			_first ^= _length;
+			_second ^= _length;
+
+			_first += _second;
+			_second += _first;
+
+			_first = _finalize(_first);
+			_second = _finalize(_second);
+
+			_first += _second;
+			_second += _first;
+
+			Canonical::Fingerprint fingerprint;
+
+			fingerprint.high = _first;
+			fingerprint.low = _second;
+
+			return fingerprint;
+		}
+
+	private:
+
+		static std::uint64_t _rotate(std::uint64_t value, int bits) noexcept
+		{
+			return (value << bits) | (value >> (64 - bits));
+		}
+
+		/*! MurmurHash3's 64-bit finalizer. */
+		static std::uint64_t _finalize(std::uint64_t value) noexcept
+		{
+			value ^= value >> 33;
+			value *= 0xff51afd7ed558ccdULL;
+			value ^= value >> 33;
+			value *= 0xc4ceb9fe1a85ec53ULL;
+			value ^= value >> 33;
+
+			return value;
+		}
+
+		/*! Mixes a full word into both lanes, like MurmurHash3_x64_128. */
+		void _mix() noexcept
+		{
+			auto word = _word * 0x87c37b91114253d5ULL;
+
+			word = _rotate(word, 31) * 0x4cf5ad432745937fULL;
+
+			_first ^= word;
+			_first = _rotate(_first, 27) + _second;
+			_first = _first * 5 + 0x52dce729;
+
+			_second ^= _rotate(word, 33);
+			_second = _rotate(_second, 31) + _first;
+			_second = _second * 5 + 0x38495ab5;
+
+			_word = 0;
+			_fill = 0;
+		}
+
+		std::uint64_t _first = 0x9e3779b97f4a7c15ULL;
+
+		std::uint64_t _second = 0x6a09e667f3bcc908ULL;
+
+		std::uint64_t _word = 0;
+
+		unsigned _fill = 0;
+
+		std::uint64_t _length = 0;
+	};
+
+	template<typename Sink>
+	void canonicalize(const char* i, const char* end, Sink& sink)
+	{
+		// Whether the last token was a control word, which a
+		// following letter would otherwise become part of
+		bool after_word = false;
+
+		auto word = [&] (const char* begin, const char* finish) {
+			sink.append(begin, static_cast<std::size_t>(finish - begin));
+
+			after_word = true;
+		};
+
+		auto ordinary = [&] (const char* begin, const char* finish) {
+			if (after_word && is_letter(*begin)) sink.append(" ", 1);
+
+			sink.append(begin, static_cast<std::size_t>(finish - begin));
+
+			after_word = false;
+		};
+
+		while (i != end)
+		{
+			switch (classes[static_cast<unsigned char>(*i)])
+			{
+				case Space:
+				{
+					++i;
+
+					break;
+				}
+
+				case Ordinary:
+				{
+					auto run = i;
+
+					while (run != end && classes[static_cast<unsigned char>(*run)] == Ordinary)
+					{
+						++run;
+					}
+
+					ordinary(i, run);
+
+					i = run;
+
+					break;
+				}
+
+				case Backslash:
+				{
+					auto finish = control_word_end(i + 1, end);
+
+					// A control symbol like \, or \{ (or a trailing backslash)
+					if (finish == i + 1)
+					{
+						finish = (i + 1 == end) ? end : i + 2;
+
+						sink.append(i, static_cast<std::size_t>(finish - i));
+
+						after_word = false;
+
+						i = finish;
+
+						break;
+					}
+
+					word(i, finish);
+
+					auto arguments = verbatim_arguments(i, finish);
+
+					i = finish;
+
+					for (int argument = 0; argument < arguments; ++argument)
+					{
+						auto next = skip_spaces(i, end);
+
+						if (next == end || *next != '{')
+						{
+							// Unbraced arguments are rare, so play it safe
+							if (argument == 0 && next != end)
+							{
+								sink.append(i, static_cast<std::size_t>(end - i));
+
+								return;
+							}
+
+							break;
+						}
+
+						auto close = group_end(next, end);
+
+						sink.append(next, static_cast<std::size_t>(close - next));
+
+						after_word = false;
+
+						i = close;
+					}
+
+					break;
+				}
+
+				case Script:
+				{
+					sink.append(i, 1);
+
+					after_word = false;
+
+					i = skip_spaces(i + 1, end);
+
+					if (i == end || *i != '{') break;
+
+					// Strip the braces of single-token scripts: x^{2} -> x^2
+					auto token = skip_spaces(i + 1, end);
+
+					if (token == end) break;
+
+					auto finish = token;
+
+					if (is_alphanumeric(*token)) finish = token + 1;
+
+					else if (*token == '\\')
+					{
+						finish = control_word_end(token + 1, end);
+
+						if (! is_greek(token, finish)) break;
+					}
+
+					else break;
+
+					auto close = skip_spaces(finish, end);
+
+					if (close == end || *close != '}') break;
+
+					if (*token == '\\') word(token, finish);
+
+					else ordinary(token, finish);
+
+					i = close + 1;
+
+					break;
+				}
+			}
+		}
+	}
+}
+
+std::string Canonical::Fingerprint::hex() const
+{
+	static const char digits[] = "0123456789abcdef";
+
+	std::string hex(32, '0');
+
+	for (int i = 0; i < 16; ++i)
+	{
+		hex[15 - i] = digits[(high >> (4 * i)) & 0xF];
+		hex[31 - i] = digits[(low >> (4 * i)) & 0xF];
+	}
+
+	return hex;
+}
+
+std::string Canonical::form(const std::string& latex)
+{
+	std::string output;
+
+	output.reserve(latex.size());
+
+	Builder builder{output};
+
+	canonicalize(latex.data(), latex.data() + latex.size(), builder);
+
+	return output;
+}
+
+Canonical::Fingerprint Canonical::fingerprint(const std::string& latex) noexcept
+{
+	Hasher hasher;
+
+	canonicalize(latex.data(), latex.data() + latex.size(), hasher);
+
+	return hasher.finish();
+}
+
+std::uint64_t Canonical::fingerprint64(const std::string& latex) noexcept
+{
+	return fingerprint(latex).low;
+}
+
+Canonical::Fingerprint Canonical::digest(const std::string& latex) noexcept
+{
+	Hasher hasher;
+
+	hasher.append(latex.data(), latex.size());
+
+	return hasher.finish();
+}
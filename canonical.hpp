@@ -0,0 +1,122 @@
+/********************************************************//*!
+*
+*	@file canonical.hpp
+*
+*	@author Peter Goldsborough.
+*
+************************************************************/
+
+#ifndef CANONICAL_HPP
+#define CANONICAL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+/***************************************************************************//*!
+*
+*	@brief Canonical forms and fingerprints of equations.
+*
+*	@details Many spellings of an equation render the same: x^2, x ^ 2,
+*			 x^{2} and " x^2 " among them. Canonicalization removes the
+*			 differences that don't matter for rendering. It drops
+*			 whitespace in math mode, except where a space ends a control
+*			 word. It also drops braces around a script that is a single
+*			 letter, digit or Greek letter. Arguments of text-mode and
+*			 similar commands (\\text, \\color, \\begin, ...) are copied
+*			 verbatim, whitespace included.
+*
+*			 Equations with the same canonical form should look the same
+*			 (tools/check_canonical compares them through KaTeX), but
+*			 their markup differs: the TeX annotation echoes the input,
+*			 braced scripts get wrapper spans, and error positions are
+*			 in the input. Fingerprints therefore group spellings, say for
+*			 statistics, while keys of rendered output use digest(), the
+*			 same hash of the equation as spelled.
+*
+*			 The tokenizer is a single pass over the bytes. fingerprint()
+*			 does not allocate.
+*
+*******************************************************************************/
+
+class Canonical
+{
+public:
+
+	/*! A 128-bit fingerprint of an equation's canonical form. */
+	struct Fingerprint
+	{
+		std::uint64_t high = 0;
+
+		std::uint64_t low = 0;
+
+		bool operator==(const Fingerprint& other) const noexcept
+		{
+			return high == other.high && low == other.low;
+		}
+
+		bool operator!=(const Fingerprint& other) const noexcept
+		{
+			return ! (*this == other);
+		}
+
+		bool operator<(const Fingerprint& other) const noexcept
+		{
+			return high < other.high || (high == other.high && low < other.low);
+		}
+
+		/*! The fingerprint as 32 hexadecimal digits. */
+		std::string hex() const;
+	};
+
+	/***********************************************************************//*!
+	*
+	*	@brief Returns the canonical form of an equation.
+	*
+	***************************************************************************/
+
+	static std::string form(const std::string& latex);
+
+	/***********************************************************************//*!
+	*
+	*	@brief Returns the 128-bit fingerprint of an equation's canonical
+	*		   form, without materializing it.
+	*
+	***************************************************************************/
+
+	static Fingerprint fingerprint(const std::string& latex) noexcept;
+
+	/***********************************************************************//*!
+	*
+	*	@brief Returns a 64-bit fingerprint of an equation's canonical form.
+	*
+	***************************************************************************/
+
+	static std::uint64_t fingerprint64(const std::string& latex) noexcept;
+
+	/***********************************************************************//*!
+	*
+	*	@brief Returns the 128-bit fingerprint of an equation exactly as
+	*		   spelled, for keys of its rendered output.
+	*
+	*	@details The digest of a canonical form is its fingerprint.
+	*
+	***************************************************************************/
+
+	static Fingerprint digest(const std::string& latex) noexcept;
+};
+
+namespace std
+{
+	template<>
+	struct hash<Canonical::Fingerprint>
+	{
+		std::size_t operator()(const Canonical::Fingerprint& fingerprint) const noexcept
+		{
+			return static_cast<std::size_t>(fingerprint.low);
+		}
+	};
+}
+
+#endif /* CANONICAL_HPP */
@@ -0,0 +1,737 @@
+#include "compact_html.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+	/*! The most frequent KaTeX classes, which get the shortest aliases.
+	    All others follow in the order of the stylesheet. */
+	const char* const frequent[] = {
+		"mord", "reset-size5", "size5", "fontsize-ensurer", "textstyle",
+		"reset-textstyle", "mathit", "strut", "vlist", "baseline-fix",
+		"scriptstyle", "katex-mathml", "katex-html", "base", "mop", "sizing",
+		"nulldelimiter", "mrel", "mbin", "mfrac", "style-wrap", "frac-line",
+		"delimsizing", "mopen", "mclose", "mpunct", "minner", "mspace"
+	};
+
+	/*! Inline styles KaTeX emits all over, in minified form. */
+	const char* const common_styles[] = {"font-size:0", "font-size:1em", "top:0"};
+
+	/*! Classes that are hooks for users' CSS, and stay as they are. */
+	const char* const hooks[] = {"latex", "katex", "katex-display"};
+
+	bool is_name_start(char c)
+	{
+		return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+	}
+
+	bool is_name(char c)
+	{
+		return is_name_start(c) || (c >= '0' && c <= '9') || c == '-';
+	}
+
+	bool is_digit(char c)
+	{
+		return c >= '0' && c <= '9';
+	}
+
+	bool is_space(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f';
+	}
+
+	/*! The n-th alias: a to Z, then aa to ZZ. */
+	std::string alias(std::size_t n)
+	{
+		static const char letters[] =
+			"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+		if (n < 52) return std::string(1, letters[n]);
+
+		n -= 52;
+
+		return {letters[(n / 52) % 52], letters[n % 52]};
+	}
+
+	enum class Token { Text, Class, Type, Url };
+
+	/*! Splits CSS into the parts a rewrite cares about: class and type
+	    selectors, and URLs in declarations. Everything else is Text. */
+	template<typename Callback>
+	void scan_css(const std::string& css, Callback callback)
+	{
+		// For every open block, whether it holds declarations (or rules)
+		std::vector<bool> blocks;
+
+		auto i = css.data();
+		auto end = i + css.size();
+
+		auto text = [&] (const char* finish) {
+			callback(Token::Text, i, finish);
+
+			i = finish;
+		};
+
+		while (i != end)
+		{
+			auto declarations = ! blocks.empty() && blocks.back();
+
+			if (*i == '/' && i + 1 != end && i[1] == '*')
+			{
+				auto close = std::strstr(i + 2, "*/");
+
+				text(close ? close + 2 : end);
+			}
+
+			else if (*i == '"' || *i == '\'')
+			{
+				auto quote = *i;
+
+				auto j = i + 1;
+
+				while (j != end && *j != quote) j += (*j == '\\' && j + 1 != end) ? 2 : 1;
+
+				text(j == end ? end : j + 1);
+			}
+
+			else if (*i == '}')
+			{
+				if (! blocks.empty()) blocks.pop_back();
+
+				text(i + 1);
+			}
+
+			else if (declarations)
+			{
+				if (end - i > 4 && std::strncmp(i, "url(", 4) == 0)
+				{
+					text(i + 4);
+
+					auto close = static_cast<const char*>(std::memchr(i, ')', end - i));
+
+					if (! close) close = end;
+
+					callback(Token::Url, i, close);
+
+					i = close;
+				}
+
+				else text(i + 1);
+			}
+
+			else if (*i == '@')
+			{
+				auto j = i + 1;
+
+				while (j != end && *j != '{' && *j != ';') ++j;
+
+				// @media and the like hold rules, @font-face declarations
+				bool rules = std::strncmp(i, "@media", 6) == 0 ||
+							 std::strncmp(i, "@supports", 9) == 0 ||
+							 std::strncmp(i, "@document", 9) == 0;
+
+				if (j != end)
+				{
+					if (*j == '{') blocks.push_back(! rules);
+
+					++j;
+				}
+
+				text(j);
+			}
+
+			else if (*i == '{')
+			{
+				blocks.push_back(true);
+
+				text(i + 1);
+			}
+
+			else if (*i == '.' && i + 1 != end && is_name_start(i[1]))
+			{
+				text(i + 1);
+
+				auto j = i;
+
+				while (j != end && is_name(*j)) ++j;
+
+				callback(Token::Class, i, j);
+
+				i = j;
+			}
+
+			else if (*i == '#' || *i == ':')
+			{
+				auto j = i + 1;
+
+				while (j != end && (is_name(*j) || *j == ':')) ++j;
+
+				text(j);
+			}
+
+			else if (*i == '[')
+			{
+				auto close = static_cast<const char*>(std::memchr(i, ']', end - i));
+
+				text(close ? close + 1 : end);
+			}
+
+			else if (is_name_start(*i))
+			{
+				auto j = i;
+
+				while (j != end && is_name(*j)) ++j;
+
+				callback(Token::Type, i, j);
+
+				i = j;
+			}
+
+			else text(i + 1);
+		}
+	}
+
+	/*! Returns the class names a stylesheet selects, in order. */
+	std::vector<std::string> selected_classes(const std::string& css)
+	{
+		std::vector<std::string> classes;
+
+		std::unordered_set<std::string> seen;
+
+		scan_css(css, [&] (Token token, const char* begin, const char* end) {
+			if (token != Token::Class) return;
+
+			std::string name(begin, end);
+
+			if (seen.insert(name).second) classes.push_back(name);
+		});
+
+		return classes;
+	}
+
+	/*! Appends the shortest decimal within rounding noise of a number,
+	    e.g. 0.8641079999999999 as .864108 and -0.5 as -.5. */
+	void number(const char* begin, const char* end, std::string& output)
+	{
+		auto value = std::strtod(std::string(begin, end).c_str(), nullptr);
+
+		char buffer[40];
+
+		for (int digits = 0; digits <= 12; ++digits)
+		{
+			std::snprintf(buffer, sizeof buffer, "%.*f", digits, value);
+
+			if (std::fabs(std::strtod(buffer, nullptr) - value) >= 1e-10) continue;
+
+			const char* digits_begin = buffer;
+
+			if (*digits_begin == '-')
+			{
+				// Also takes care of -0
+				if (std::strtod(buffer, nullptr) != 0) output += '-';
+
+				++digits_begin;
+			}
+
+			if (digits_begin[0] == '0' && digits_begin[1] == '.') ++digits_begin;
+
+			output += digits_begin;
+
+			return;
+		}
+
+		output.append(begin, end);
+	}
+
+	/*! Appends a declaration value with numbers shortened, zero lengths
+	    unitless and runs of whitespace collapsed. */
+	void value(const char* i, const char* end, std::string& output)
+	{
+		static const char* const lengths[] = {"em", "ex", "px", "pt", "mm", "cm", "in"};
+
+		while (i != end)
+		{
+			if (is_space(*i))
+			{
+				while (i != end && is_space(*i)) ++i;
+
+				if (i != end) output += ' ';
+			}
+
+			else if (is_name(*i) && ! is_digit(*i) && *i != '-')
+			{
+				// Names (like size5) aren't numbers
+				auto j = i;
+
+				while (j != end && is_name(*j)) ++j;
+
+				output.append(i, j);
+
+				i = j;
+			}
+
+			else if (*i == '#')
+			{
+				auto j = i + 1;
+
+				while (j != end && is_name(*j)) ++j;
+
+				output.append(i, j);
+
+				i = j;
+			}
+
+			else if (is_digit(*i) || *i == '.' || *i == '-')
+			{
+				auto j = (*i == '-') ? i + 1 : i;
+
+				auto digits = j;
+
+				while (j != end && (is_digit(*j) || *j == '.')) ++j;
+
+				if (j == digits)
+				{
+					output += *i++;
+
+					continue;
+				}
+
+				auto unit = j;
+
+				while (unit != end && is_name_start(*unit)) ++unit;
+
+				auto length = output.size();
+
+				number(i, j, output);
+
+				bool zero = output.compare(length, std::string::npos, "0") == 0;
+
+				bool drop = false;
+
+				for (auto name : lengths)
+				{
+					if (zero && unit - j == 2 && std::strncmp(j, name, 2) == 0) drop = true;
+				}
+
+				if (! drop) output.append(j, unit);
+
+				i = unit;
+			}
+
+			else output += *i++;
+		}
+	}
+
+	/*! Minifies an inline style, e.g. "top:-0.5em;height:0em;"
+	    to "top:-.5em;height:0". */
+	std::string minify(const std::string& style)
+	{
+		std::string output;
+
+		output.reserve(style.size());
+
+		auto i = style.data();
+		auto end = i + style.size();
+
+		while (i != end)
+		{
+			// Declarations end at semicolons outside parentheses
+			auto j = i;
+
+			for (int depth = 0; j != end && (depth || *j != ';'); ++j)
+			{
+				if (*j == '(') ++depth;
+
+				else if (*j == ')' && depth) --depth;
+			}
+
+			auto next = (j == end) ? end : j + 1;
+
+			while (i != j && is_space(*i)) ++i;
+
+			while (j != i && is_space(j[-1])) --j;
+
+			auto colon = static_cast<const char*>(std::memchr(i, ':', j - i));
+
+			if (colon)
+			{
+				if (! output.empty()) output += ';';
+
+				auto property = colon;
+
+				while (property != i && is_space(property[-1])) --property;
+
+				output.append(i, property);
+
+				output += ':';
+
+				auto start = colon + 1;
+
+				while (start != j && is_space(*start)) ++start;
+
+				value(start, j, output);
+			}
+
+			i = next;
+		}
+
+		return output;
+	}
+
+	/*! Appends an attribute, unquoted if HTML allows. */
+	void attribute(std::string& output, const std::string& name, const std::string& value)
+	{
+		output += ' ';
+		output += name;
+		output += '=';
+
+		bool quote = value.empty() || value.back() == '/';
+
+		for (auto c : value)
+		{
+			if (is_space(c) || c == '"' || c == '\'' || c == '=' ||
+				c == '<' || c == '>' || c == '`')
+			{
+				quote = true;
+
+				break;
+			}
+		}
+
+		if (! quote) output += value;
+
+		else
+		{
+			auto mark = value.find('"') == std::string::npos ? '"' : '\'';
+
+			output += mark;
+			output += value;
+			output += mark;
+		}
+	}
+}
+
+CompactHtml::CompactHtml(const std::string& stylesheet,
+						 const std::string& additional_css)
+: _stylesheet(stylesheet)
+, _additional_css(additional_css)
+{
+	for (auto hook : hooks) _kept.insert(hook);
+
+	auto katex = selected_classes(stylesheet);
+
+	std::unordered_set<std::string> styled(katex.begin(), katex.end());
+
+	for (const auto& name : selected_classes(additional_css))
+	{
+		if (! styled.count(name)) _kept.insert(name);
+	}
+
+	std::size_t next = 0;
+
+	auto new_alias = [&] {
+		// Never shadow a class that is kept as it is
+		auto name = alias(next++);
+
+		while (_kept.count(name)) name = alias(next++);
+
+		return name;
+	};
+
+	for (auto name : frequent)
+	{
+		if (styled.count(name)) _aliases.emplace(name, new_alias());
+	}
+
+	for (auto style : common_styles) _styles.emplace(style, new_alias());
+
+	for (const auto& name : katex)
+	{
+		if (! _kept.count(name) && ! _aliases.count(name))
+		{
+			_aliases.emplace(name, new_alias());
+		}
+	}
+}
+
+std::string CompactHtml::compact(const std::string& html) const
+{
+	std::string output;
+
+	output.reserve(html.size() / 2);
+
+	std::string name;
+	std::string value;
+	std::string classes;
+	std::string style;
+
+	auto i = html.data();
+	auto end = i + html.size();
+
+	while (i != end)
+	{
+		if (*i != '<')
+		{
+			// Text, except the line breaks between the wrapper's tags
+			auto j = static_cast<const char*>(std::memchr(i, '<', end - i));
+
+			if (! j) j = end;
+
+			for (; i != j; ++i)
+			{
+				if (*i != '\n') output += *i;
+			}
+
+			continue;
+		}
+
+		if (i + 1 != end && (i[1] == '!' || i[1] == '?'))
+		{
+			auto j = static_cast<const char*>(std::memchr(i, '>', end - i));
+
+			j = j ? j + 1 : end;
+
+			output.append(i, j);
+
+			i = j;
+
+			continue;
+		}
+
+		bool closing = i + 1 != end && i[1] == '/';
+
+		auto j = i + (closing ? 2 : 1);
+
+		auto tag = j;
+
+		while (j != end && is_name(*j)) ++j;
+
+		bool span = j - tag == 4 && std::strncmp(tag, "span", 4) == 0;
+
+		bool styled = span || (j - tag == 3 && std::strncmp(tag, "div", 3) == 0);
+
+		output += closing ? "</" : "<";
+
+		if (span) output += 'i';
+
+		else output.append(tag, j);
+
+		i = j;
+
+		classes.clear();
+		style.clear();
+
+		bool self_closing = false;
+
+		// Attributes
+		while (i != end && *i != '>')
+		{
+			if (is_space(*i)) { ++i; continue; }
+
+			if (*i == '/') { self_closing = true; ++i; continue; }
+
+			auto start = i;
+
+			while (i != end && ! is_space(*i) && *i != '=' && *i != '>' && *i != '/') ++i;
+
+			name.assign(start, i);
+
+			while (i != end && is_space(*i)) ++i;
+
+			value.clear();
+
+			bool has_value = i != end && *i == '=';
+
+			if (has_value)
+			{
+				++i;
+
+				while (i != end && is_space(*i)) ++i;
+
+				if (i != end && (*i == '"' || *i == '\''))
+				{
+					auto close = static_cast<const char*>(std::memchr(i + 1, *i, end - i - 1));
+
+					if (! close) close = end;
+
+					value.assign(i + 1, close);
+
+					i = (close == end) ? end : close + 1;
+				}
+
+				else
+				{
+					start = i;
+
+					while (i != end && ! is_space(*i) && *i != '>') ++i;
+
+					value.assign(start, i);
+				}
+			}
+
+			if (styled && name == "class") _classes(value, classes);
+
+			else if (styled && name == "style")
+			{
+				style = minify(value);
+
+				auto common = _styles.find(style);
+
+				if (common != _styles.end())
+				{
+					if (! classes.empty()) classes += ' ';
+
+					classes += common->second;
+
+					style.clear();
+				}
+			}
+
+			else if (has_value) attribute(output, name, value);
+
+			else
+			{
+				output += ' ';
+				output += name;
+			}
+		}
+
+		if (! classes.empty()) attribute(output, "class", classes);
+
+		if (! style.empty()) attribute(output, "style", style);
+
+		if (self_closing) output += " /";
+
+		if (i != end)
+		{
+			output += '>';
+
+			++i;
+		}
+	}
+
+	return output;
+}
+
+std::string CompactHtml::stylesheet(const std::string& fonts) const
+{
+	std::string output;
+
+	output.reserve(_stylesheet.size() + _additional_css.size() + 256);
+
+	_rewrite(_stylesheet, fonts, output);
+
+	// Spans became <i>, whose italics must not show
+	output += "i.katex-display,.katex i{font-style:inherit}";
+
+	// Inline styles win over rules, which !important restores
+	for (auto style : common_styles)
+	{
+		output += ".katex ." + _styles.at(style) + "{" + style + "!important}";
+	}
+
+	if (! _additional_css.empty())
+	{
+		output += '\n';
+
+		_rewrite(_additional_css, "", output);
+	}
+
+	return output;
+}
+
+void CompactHtml::_classes(const std::string& value, std::string& output) const
+{
+	std::string name;
+
+	auto i = value.data();
+	auto end = i + value.size();
+
+	while (i != end)
+	{
+		if (is_space(*i)) { ++i; continue; }
+
+		auto start = i;
+
+		while (i != end && ! is_space(*i)) ++i;
+
+		name.assign(start, i);
+
+		auto alias = _aliases.find(name);
+
+		// Classes no stylesheet selects don't change the looks
+		if (alias == _aliases.end() && ! _kept.count(name)) continue;
+
+		if (! output.empty()) output += ' ';
+
+		output += (alias == _aliases.end()) ? name : alias->second;
+	}
+}
+
+void CompactHtml::_rewrite(const std::string& css,
+						   const std::string& fonts,
+						   std::string& output) const
+{
+	scan_css(css, [&] (Token token, const char* begin, const char* end) {
+		std::string text(begin, end);
+
+		switch (token)
+		{
+			case Token::Class:
+			{
+				auto alias = _aliases.find(text);
+
+				output += (alias == _aliases.end()) ? text : alias->second;
+
+				break;
+			}
+
+			case Token::Type:
+			{
+				output += (text == "span") ? "i" : text;
+
+				break;
+			}
+
+			case Token::Url:
+			{
+				auto path = text;
+
+				char quote = 0;
+
+				if (! path.empty() && (path[0] == '"' || path[0] == '\''))
+				{
+					quote = path[0];
+
+					path = path.substr(1, path.size() - 2);
+				}
+
+				auto colon = path.find(':');
+
+				bool relative = ! path.empty() && path[0] != '/' && path[0] != '#' &&
+								(colon == std::string::npos || colon > path.find('/'));
+
+				if (relative && ! fonts.empty()) path = fonts + "/" + path;
+
+				if (quote) output += quote;
+
+				output += path;
+
+				if (quote) output += quote;
+
+				break;
+			}
+
+			case Token::Text:
+			{
+				output += text;
+
+				break;
+			}
+		}
+	});
+}
@@ -0,0 +1,113 @@
+/********************************************************//*!
+*
+*	@file compact_html.hpp
+*
+*	@author Peter Goldsborough.
+*
+************************************************************/
+
+#ifndef COMPACT_HTML_HPP
+#define COMPACT_HTML_HPP
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+/***************************************************************************//*!
+*
+*	@brief Rewrites KaTeX markup into a smaller form, with a stylesheet
+*		   under which it looks exactly the same.
+*
+*	@details KaTeX's markup is mostly class lists and inline styles. The
+*			 compact form changes it in one pass over the markup:
+*
+*			 - KaTeX's class names become one- or two-letter aliases.
+*			   Classes that no stylesheet selects are dropped.
+*			 - Spans become <i> elements, whose italics the stylesheet
+*			   resets.
+*			 - Inline styles lose redundant digits, leading zeros and
+*			   zero units. Styles KaTeX emits everywhere, like the
+*			   font-size:0em of every vertical list row, become classes.
+*			 - Attribute values are unquoted where HTML allows it.
+*
+*			 Wrapper elements are kept, even those without classes or
+*			 styles. The KaTeX stylesheet positions and spaces by
+*			 structure, with child and sibling selectors like
+*			 .vlist>span>span, .mfrac>span>span and .textstyle>.mord+.mop,
+*			 so removing a level of nesting changes the layout.
+*
+*			 The alias table is derived from the KaTeX stylesheet and any
+*			 additional CSS. Compact markup must therefore be served with
+*			 the stylesheet() of the same CompactHtml. That stylesheet is
+*			 the KaTeX stylesheet and the additional CSS with the same
+*			 renames applied.
+*
+*			 Instances are immutable and may be shared between threads.
+*
+*******************************************************************************/
+
+class CompactHtml
+{
+public:
+
+	/***********************************************************************//*!
+	*
+	*	@brief Builds the alias tables.
+	*
+	*	@param stylesheet The text of the KaTeX stylesheet.
+	*
+	*	@param additional_css Any CSS served along with it. Classes it
+	*		   selects are never dropped.
+	*
+	***************************************************************************/
+
+	CompactHtml(const std::string& stylesheet,
+				const std::string& additional_css = std::string());
+
+	virtual ~CompactHtml() = default;
+
+	/***********************************************************************//*!
+	*
+	*	@brief Returns the compact form of (wrapped) KaTeX markup.
+	*
+	***************************************************************************/
+
+	virtual std::string compact(const std::string& html) const;
+
+	/***********************************************************************//*!
+	*
+	*	@brief Returns the stylesheet for compact markup.
+	*
+	*	@param fonts The directory relative font URLs are rebased onto,
+	*		   usually that of the original stylesheet. Left alone if empty.
+	*
+	***************************************************************************/
+
+	virtual std::string stylesheet(const std::string& fonts) const;
+
+protected:
+
+	/*! Appends the compact form of a class attribute's value. */
+	virtual void _classes(const std::string& value, std::string& output) const;
+
+	/*! Rewrites CSS with the aliases, rebasing relative URLs onto fonts. */
+	virtual void _rewrite(const std::string& css,
+						  const std::string& fonts,
+						  std::string& output) const;
+
+	/*! KaTeX's class names and their aliases. */
+	std::unordered_map<std::string, std::string> _aliases;
+
+	/*! Class names kept as they are (such as katex and latex). */
+	std::unordered_set<std::string> _kept;
+
+	/*! Minified inline styles and the classes that replace them. */
+	std::unordered_map<std::string, std::string> _styles;
+
+	/*! The stylesheets, as given. */
+	std::string _stylesheet;
+
+	std::string _additional_css;
+};
+
+#endif /* COMPACT_HTML_HPP */
@@ -0,0 +1,597 @@
+#include "fast_path.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+	/*! A symbol of the subset, as in KaTeX's symbols.js and fontMetrics.js. */
+	struct Symbol
+	{
+		const char* name;
+
+		/*! The UTF-8 character KaTeX outputs. */
+		const char* text;
+
+		/*! Whether a mathord (Math-Italic) rather than a textord (Main-Regular). */
+		bool italic_font;
+
+		double height;
+
+		double depth;
+
+		double italic;
+	};
+
+	const Symbol symbols[] = {
+		{"a", "a", true, 0.43056, 0, 0},
+		{"b", "b", true, 0.69444, 0, 0},
+		{"c", "c", true, 0.43056, 0, 0},
+		{"d", "d", true, 0.69444, 0, 0},
+		{"e", "e", true, 0.43056, 0, 0},
+		{"f", "f", true, 0.69444, 0.19444, 0.10764},
+		{"g", "g", true, 0.43056, 0.19444, 0.03588},
+		{"h", "h", true, 0.69444, 0, 0},
+		{"i", "i", true, 0.65952, 0, 0},
+		{"j", "j", true, 0.65952, 0.19444, 0.05724},
+		{"k", "k", true, 0.69444, 0, 0.03148},
+		{"l", "l", true, 0.69444, 0, 0.01968},
+		{"m", "m", true, 0.43056, 0, 0},
+		{"n", "n", true, 0.43056, 0, 0},
+		{"o", "o", true, 0.43056, 0, 0},
+		{"p", "p", true, 0.43056, 0.19444, 0},
+		{"q", "q", true, 0.43056, 0.19444, 0.03588},
+		{"r", "r", true, 0.43056, 0, 0.02778},
+		{"s", "s", true, 0.43056, 0, 0},
+		{"t", "t", true, 0.61508, 0, 0},
+		{"u", "u", true, 0.43056, 0, 0},
+		{"v", "v", true, 0.43056, 0, 0.03588},
+		{"w", "w", true, 0.43056, 0, 0.02691},
+		{"x", "x", true, 0.43056, 0, 0},
+		{"y", "y", true, 0.43056, 0.19444, 0.03588},
+		{"z", "z", true, 0.43056, 0, 0.04398},
+		{"A", "A", true, 0.68333, 0, 0},
+		{"B", "B", true, 0.68333, 0, 0.05017},
+		{"C", "C", true, 0.68333, 0, 0.07153},
+		{"D", "D", true, 0.68333, 0, 0.02778},
+		{"E", "E", true, 0.68333, 0, 0.05764},
+		{"F", "F", true, 0.68333, 0, 0.13889},
+		{"G", "G", true, 0.68333, 0, 0},
+		{"H", "H", true, 0.68333, 0, 0.08125},
+		{"I", "I", true, 0.68333, 0, 0.07847},
+		{"J", "J", true, 0.68333, 0, 0.09618},
+		{"K", "K", true, 0.68333, 0, 0.07153},
+		{"L", "L", true, 0.68333, 0, 0},
+		{"M", "M", true, 0.68333, 0, 0.10903},
+		{"N", "N", true, 0.68333, 0, 0.10903},
+		{"O", "O", true, 0.68333, 0, 0.02778},
+		{"P", "P", true, 0.68333, 0, 0.13889},
+		{"Q", "Q", true, 0.68333, 0.19444, 0},
+		{"R", "R", true, 0.68333, 0, 0.00773},
+		{"S", "S", true, 0.68333, 0, 0.05764},
+		{"T", "T", true, 0.68333, 0, 0.13889},
+		{"U", "U", true, 0.68333, 0, 0.10903},
+		{"V", "V", true, 0.68333, 0, 0.22222},
+		{"W", "W", true, 0.68333, 0, 0.13889},
+		{"X", "X", true, 0.68333, 0, 0.07847},
+		{"Y", "Y", true, 0.68333, 0, 0.22222},
+		{"Z", "Z", true, 0.68333, 0, 0.07153},
+		{"0", "0", false, 0.64444, 0, 0},
+		{"1", "1", false, 0.64444, 0, 0},
+		{"2", "2", false, 0.64444, 0, 0},
+		{"3", "3", false, 0.64444, 0, 0},
+		{"4", "4", false, 0.64444, 0, 0},
+		{"5", "5", false, 0.64444, 0, 0},
+		{"6", "6", false, 0.64444, 0, 0},
+		{"7", "7", false, 0.64444, 0, 0},
+		{"8", "8", false, 0.64444, 0, 0},
+		{"9", "9", false, 0.64444, 0, 0},
+		{"\\Gamma", "Γ", false, 0.68333, 0, 0},
+		{"\\Delta", "Δ", false, 0.68333, 0, 0},
+		{"\\Theta", "Θ", false, 0.68333, 0, 0},
+		{"\\Lambda", "Λ", false, 0.68333, 0, 0},
+		{"\\Xi", "Ξ", false, 0.68333, 0, 0},
+		{"\\Pi", "Π", false, 0.68333, 0, 0},
+		{"\\Sigma", "Σ", false, 0.68333, 0, 0},
+		{"\\Upsilon", "Υ", false, 0.68333, 0, 0},
+		{"\\Phi", "Φ", false, 0.68333, 0, 0},
+		{"\\Psi", "Ψ", false, 0.68333, 0, 0},
+		{"\\Omega", "Ω", false, 0.68333, 0, 0},
+		{"\\alpha", "α", true, 0.43056, 0, 0.0037},
+		{"\\beta", "β", true, 0.69444, 0.19444, 0.05278},
+		{"\\gamma", "γ", true, 0.43056, 0.19444, 0.05556},
+		{"\\delta", "δ", true, 0.69444, 0, 0.03785},
+		{"\\epsilon", "ϵ", true, 0.43056, 0, 0},
+		{"\\zeta", "ζ", true, 0.69444, 0.19444, 0.07378},
+		{"\\eta", "η", true, 0.43056, 0.19444, 0.03588},
+		{"\\theta", "θ", true, 0.69444, 0, 0.02778},
+		{"\\iota", "ι", true, 0.43056, 0, 0},
+		{"\\kappa", "κ", true, 0.43056, 0, 0},
+		{"\\lambda", "λ", true, 0.69444, 0, 0},
+		{"\\mu", "μ", true, 0.43056, 0.19444, 0},
+		{"\\nu", "ν", true, 0.43056, 0, 0.06366},
+		{"\\xi", "ξ", true, 0.69444, 0.19444, 0.04601},
+		{"\\pi", "π", true, 0.43056, 0, 0.03588},
+		{"\\rho", "ρ", true, 0.43056, 0.19444, 0},
+		{"\\sigma", "σ", true, 0.43056, 0, 0.03588},
+		{"\\tau", "τ", true, 0.43056, 0, 0.1132},
+		{"\\upsilon", "υ", true, 0.43056, 0, 0.03588},
+		{"\\phi", "ϕ", true, 0.69444, 0.19444, 0},
+		{"\\chi", "χ", true, 0.43056, 0.19444, 0},
+		{"\\psi", "ψ", true, 0.69444, 0.19444, 0.03588},
+		{"\\omega", "ω", true, 0.43056, 0, 0.03588},
+		{"\\varepsilon", "ε", true, 0.43056, 0, 0},
+		{"\\vartheta", "ϑ", true, 0.69444, 0, 0},
+		{"\\varpi", "ϖ", true, 0.43056, 0, 0.02778},
+		{"\\varrho", "ϱ", true, 0.43056, 0.19444, 0},
+		{"\\varsigma", "ς", true, 0.43056, 0.09722, 0.07986},
+		{"\\varphi", "φ", true, 0.43056, 0.19444, 0},
+	};
+
+	/*! The font metrics of KaTeX's fontMetrics.js that the subset needs. */
+	const double x_height = 0.431;
+	const double sup1 = 0.413;
+	const double sub1 = 0.15;
+	const double sub2 = 0.247;
+	const double rule_thickness = 0.04;
+	const double script_multiplier = 0.7;
+
+	/*! The space KaTeX puts after scripts (0.5pt). */
+	const double script_space = 0.5 / 10 / 1;
+
+	const char* const size_ensurer =
+		"<span class=\"fontsize-ensurer reset-size5 size5\">"
+		"<span style=\"font-size:0em;\">\xE2\x80\x8B</span></span>";
+
+	const Symbol* find(const std::string& name)
+	{
+		for (const auto& symbol : symbols)
+		{
+			if (name == symbol.name) return &symbol;
+		}
+
+		return nullptr;
+	}
+
+	/*! Formats a number like JavaScript's Number.prototype.toString(). */
+	std::string number(double value)
+	{
+		if (value == 0) return "0";
+
+		char buffer[32];
+
+		// The shortest representation that reads back as the same value
+		for (int precision = 0; precision < 17; ++precision)
+		{
+			std::snprintf(buffer, sizeof buffer, "%.*e", precision, value);
+
+			if (std::strtod(buffer, nullptr) == value) break;
+		}
+
+		std::string result = (value < 0) ? "-" : "";
+
+		const char* mantissa = buffer + (value < 0);
+
+		const char* exponent = std::strchr(mantissa, 'e');
+
+		std::string digits;
+
+		for (auto i = mantissa; i != exponent; ++i)
+		{
+			if (*i != '.') digits += *i;
+		}
+
+		// The position of the decimal point relative to the digits
+		int point = std::atoi(exponent + 1) + 1;
+
+		int count = static_cast<int>(digits.size());
+
+		if (count <= point && point <= 21)
+		{
+			result += digits + std::string(point - count, '0');
+		}
+
+		else if (0 < point && point <= 21)
+		{
+			result += digits.substr(0, point) + "." + digits.substr(point);
+		}
+
+		else if (-6 < point && point <= 0)
+		{
+			result += "0." + std::string(-point, '0') + digits;
+		}
+
+		else
+		{
+			result += digits.substr(0, 1);
+
+			if (count > 1) result += "." + digits.substr(1);
+
+			result += (point > 0) ? "e+" : "e-";
+
+			result += std::to_string(std::abs(point - 1));
+		}
+
+		return result;
+	}
+
+	/*! A span of markup and its vertical extent, like KaTeX's DOM nodes. */
+	struct Span
+	{
+		std::string html;
+
+		double height;
+
+		double depth;
+	};
+
+	Span symbol_span(const Symbol& symbol, double multiplier = 1)
+	{
+		Span span;
+
+		span.html = "<span class=\"mord ";
+		span.html += symbol.italic_font ? "mathit" : "mathrm";
+		span.html += "\"";
+
+		if (symbol.italic > 0)
+		{
+			span.html += " style=\"margin-right:" + number(symbol.italic) + "em;\"";
+		}
+
+		span.html += ">";
+		span.html += symbol.text;
+		span.html += "</span>";
+
+		span.height = symbol.height;
+		span.depth = symbol.depth;
+
+		if (multiplier != 1)
+		{
+			span.height *= multiplier;
+			span.depth *= multiplier;
+		}
+
+		return span;
+	}
+
+	std::string mathml(const Symbol& symbol)
+	{
+		std::string text = symbol.text;
+
+		if (symbol.italic_font) return "<mi>" + text + "</mi>";
+
+		if (text[0] >= '0' && text[0] <= '9') return "<mn>" + text + "</mn>";
+
+		return "<mi mathvariant=\"normal\">" + text + "</mi>";
+	}
+
+	/*! One row of a vertical list: its element and its inline style. */
+	struct Row
+	{
+		Span span;
+
+		std::string style;
+	};
+
+	/*! Builds a .vlist the way KaTeX's makeVList does, given each
+	*   row's element and its top as computed by the caller. */
+	Span vlist(const std::vector<Row>& rows,
+			   const std::vector<double>& tops,
+			   double height,
+			   double depth)
+	{
+		Span list;
+
+		list.html = "<span class=\"vlist\">";
+
+		double row_height = 0;
+		double row_depth = 0;
+
+		for (std::size_t i = 0; i < rows.size(); ++i)
+		{
+			const auto& row = rows[i];
+
+			list.html += "<span style=\"top:" + number(tops[i]) + "em;";
+			list.html += row.style + "\">";
+			list.html += size_ensurer;
+			list.html += row.span.html;
+			list.html += "</span>";
+
+			row_height = std::max(row_height, std::max(0.0, row.span.height) - tops[i]);
+			row_depth = std::max(row_depth, std::max(0.0, row.span.depth) + tops[i]);
+		}
+
+		list.html += "<span class=\"baseline-fix\">";
+		list.html += size_ensurer;
+		list.html += "\xE2\x80\x8B</span></span>";
+
+		list.height = std::max(height, row_height);
+		list.depth = std::max(-depth, row_depth);
+
+		return list;
+	}
+
+	Span script(const Symbol& symbol, bool cramped)
+	{
+		auto inner = symbol_span(symbol, script_multiplier);
+
+		Span span;
+
+		span.html = "<span class=\"reset-textstyle scriptstyle ";
+		span.html += cramped ? "cramped" : "uncramped";
+		span.html += "\">" + inner.html + "</span>";
+
+		span.height = std::max(0.0, inner.height);
+		span.depth = std::max(0.0, inner.depth);
+
+		return span;
+	}
+
+	struct Atom
+	{
+		const Symbol* base = nullptr;
+
+		const Symbol* sub = nullptr;
+
+		const Symbol* sup = nullptr;
+	};
+
+	/*! Lays out an atom like KaTeX's supsub group builder does for an ord
+	*   base in display style (in the same order of operations, such that
+	*   rounding errors come out the same). */
+	Span build(const Atom& atom)
+	{
+		auto base = symbol_span(*atom.base);
+
+		if (! atom.sub && ! atom.sup) return base;
+
+		const auto margin_right = "margin-right:" + number(script_space) + "em;";
+
+		Span scripts;
+
+		if (atom.sub && ! atom.sup)
+		{
+			auto sub = script(*atom.sub, true);
+
+			auto inner_height = atom.sub->height * script_multiplier;
+
+			auto shift = std::max(0.0, std::max(sub1, inner_height - 0.8 * x_height));
+
+			auto bottom = -sub.depth - shift;
+
+			auto top = -sub.depth - bottom;
+
+			auto style = margin_right;
+
+			style += "margin-left:" + number(-atom.base->italic) + "em;";
+
+			scripts = vlist({{sub, style}}, {top}, bottom + (sub.height + sub.depth), bottom);
+		}
+
+		else if (atom.sup && ! atom.sub)
+		{
+			auto sup = script(*atom.sup, false);
+
+			auto inner_depth = atom.sup->depth * script_multiplier;
+
+			auto shift = std::max(0.0, std::max(sup1, inner_depth + 0.25 * x_height));
+
+			auto bottom = -sup.depth - (-shift);
+
+			auto top = -sup.depth - bottom;
+
+			scripts = vlist({{sup, margin_right}}, {top}, bottom + (sup.height + sup.depth), bottom);
+		}
+
+		else
+		{
+			auto sub = script(*atom.sub, true);
+
+			auto sup = script(*atom.sup, false);
+
+			auto sub_height = atom.sub->height * script_multiplier;
+
+			auto sup_depth = atom.sup->depth * script_multiplier;
+
+			auto up = std::max(0.0, std::max(sup1, sup_depth + 0.25 * x_height));
+
+			auto down = std::max(0.0, sub2);
+
+			if (up - sup_depth - (sub_height - down) < 4 * rule_thickness)
+			{
+				down = 4 * rule_thickness - (up - sup_depth) + sub_height;
+
+				auto correction = 0.8 * x_height - (up - sup_depth);
+
+				if (correction > 0)
+				{
+					up += correction;
+
+					down -= correction;
+				}
+			}
+
+			auto bottom = -down - sub.depth;
+
+			auto position = bottom;
+
+			auto sup_bottom = -(-up) - position - sup.depth;
+
+			auto kern = sup_bottom - (sub.height + sub.depth);
+
+			// Where the rows end up, as the rows and the kern between them stack
+			auto sub_top = -sub.depth - position;
+
+			position += sub.height + sub.depth;
+
+			position += kern;
+
+			auto sup_top = -sup.depth - position;
+
+			position += sup.height + sup.depth;
+
+			auto sub_style = "margin-left:" + number(-atom.base->italic) + "em;";
+
+			sub_style += margin_right;
+
+			scripts = vlist({{sub, sub_style}, {sup, margin_right}},
+							{sub_top, sup_top},
+							position,
+							bottom);
+		}
+
+		Span span;
+
+		span.html = "<span class=\"mord\">" + base.html + scripts.html + "</span>";
+
+		span.height = std::max(0.0, std::max(base.height, scripts.height));
+		span.depth = std::max(0.0, std::max(base.depth, scripts.depth));
+
+		return span;
+	}
+
+	bool is_letter(char character)
+	{
+		return (character >= 'a' && character <= 'z') ||
+			   (character >= 'A' && character <= 'Z');
+	}
+
+	bool is_digit(char character)
+	{
+		return character >= '0' && character <= '9';
+	}
+
+	void skip_spaces(const std::string& latex, std::size_t& position)
+	{
+		while (position < latex.size() && latex[position] == ' ') ++position;
+	}
+
+	/*! Reads a letter, digit or Greek letter command, if one is next. */
+	const Symbol* symbol(const std::string& latex, std::size_t& position)
+	{
+		skip_spaces(latex, position);
+
+		if (position == latex.size()) return nullptr;
+
+		auto character = latex[position];
+
+		if (is_letter(character) || is_digit(character))
+		{
+			return find(std::string(1, latex[position++]));
+		}
+
+		if (character != '\\') return nullptr;
+
+		auto end = position + 1;
+
+		while (end < latex.size() && is_letter(latex[end])) ++end;
+
+		// A control symbol like \, or \{ is not in the subset
+		if (end == position + 1) return nullptr;
+
+		auto found = find(latex.substr(position, end - position));
+
+		if (found) position = end;
+
+		return found;
+	}
+
+	bool parse(const std::string& latex, std::vector<Atom>& atoms)
+	{
+		std::size_t position = 0;
+
+		while (true)
+		{
+			skip_spaces(latex, position);
+
+			if (position == latex.size()) return ! atoms.empty();
+
+			Atom atom;
+
+			atom.base = symbol(latex, position);
+
+			if (! atom.base) return false;
+
+			while (true)
+			{
+				skip_spaces(latex, position);
+
+				if (position == latex.size()) break;
+
+				auto character = latex[position];
+
+				if (character != '_' && character != '^') break;
+
+				auto& target = (character == '_') ? atom.sub : atom.sup;
+
+				// Double scripts are errors, which KaTeX has to report
+				if (target) return false;
+
+				target = symbol(latex, ++position);
+
+				if (! target) return false;
+			}
+
+			atoms.push_back(atom);
+		}
+	}
+}
+
+bool FastPath::render(const std::string& latex, std::string& html)
+{
+	std::vector<Atom> atoms;
+
+	if (! parse(latex, atoms)) return false;
+
+	std::string markup;
+
+	std::string math;
+
+	double height = 0;
+
+	double depth = 0;
+
+	for (const auto& atom : atoms)
+	{
+		auto span = build(atom);
+
+		markup += span.html;
+
+		height = std::max(height, span.height);
+
+		depth = std::max(depth, span.depth);
+
+		auto base = mathml(*atom.base);
+
+		if (atom.sub && atom.sup)
+		{
+			math += "<msubsup>" + base + mathml(*atom.sub) + mathml(*atom.sup) + "</msubsup>";
+		}
+
+		else if (atom.sub) math += "<msub>" + base + mathml(*atom.sub) + "</msub>";
+
+		else if (atom.sup) math += "<msup>" + base + mathml(*atom.sup) + "</msup>";
+
+		else math += base;
+	}
+
+	// The subset has no characters that need escaping in the annotation
+	html = "<span class=\"katex-display\"><span class=\"katex\">";
+	html += "<span class=\"katex-mathml\"><math><semantics><mrow>";
+	html += math;
+	html += "</mrow><annotation encoding=\"application/x-tex\">";
+	html += latex;
+	html += "</annotation></semantics></math></span>";
+	html += "<span class=\"katex-html\" aria-hidden=\"true\">";
+	html += "<span class=\"strut\" style=\"height:" + number(height) + "em;\"></span>";
+	html += "<span class=\"strut bottom\" style=\"height:" + number(height + depth);
+	html += "em;vertical-align:" + number(-depth) + "em;\"></span>";
+	html += "<span class=\"base displaystyle textstyle uncramped\">";
+	html += markup;
+	html += "</span></span></span></span>";
+
+	return true;
+}
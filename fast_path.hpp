@@ -0,0 +1,53 @@
+/********************************************************//*!
+*
+*	@file fast_path.hpp
+*
+*	@author Peter Goldsborough.
+*
+************************************************************/
+
+#ifndef FAST_PATH_HPP
+#define FAST_PATH_HPP
+
+#include <string>
+
+/***************************************************************************//*!
+*
+*	@brief A native renderer for trivial equations.
+*
+*	@details Most equations in the wild are single identifiers, numbers,
+*			 Greek letters or symbols with simple sub- and superscripts.
+*			 For these, this class produces exactly the markup the bundled
+*			 KaTeX would produce in display mode, without entering V8.
+*
+*			 The accepted subset is a sequence of atoms, separated by
+*			 optional spaces. An atom is a Latin letter, a digit or a
+*			 Greek letter command (e.g. \\alpha or \\Omega), optionally
+*			 followed by a subscript and/or a superscript in either order,
+*			 each of which must itself be a single unbraced letter, digit
+*			 or Greek letter. Everything else is left to KaTeX.
+*
+*******************************************************************************/
+
+class FastPath
+{
+public:
+
+	/***********************************************************************//*!
+	*
+	*	@brief Renders an equation natively, if it is in the subset.
+	*
+	*	@param latex The LaTeX snippet to render.
+	*
+	*	@param html Set to the markup of katex.renderToString() in display
+	*				mode if the snippet is in the subset, else left alone.
+	*
+	*	@return True if the snippet was rendered, false if it has to go
+	*			through KaTeX.
+	*
+	***************************************************************************/
+
+	static bool render(const std::string& latex, std::string& html);
+};
+
+#endif /* FAST_PATH_HPP */
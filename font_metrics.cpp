@@ -0,0 +1,614 @@
+#include "font_metrics.hpp"
+#include "latex.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+namespace
+{
+	std::uint16_t u16(const std::string& data, std::size_t offset)
+	{
+		if (offset + 2 > data.size()) throw Latex::FileException("Truncated font");
+
+		return static_cast<std::uint16_t>(
+			(static_cast<unsigned char>(data[offset]) << 8) |
+			 static_cast<unsigned char>(data[offset + 1])
+		);
+	}
+
+	std::uint32_t u32(const std::string& data, std::size_t offset)
+	{
+		return (std::uint32_t(u16(data, offset)) << 16) | u16(data, offset + 2);
+	}
+
+	/*! The TeX spacing rules of the KaTeX stylesheet, in em. */
+	double spacing(const std::string& previous,
+				   const std::string& current,
+				   bool textstyle)
+	{
+		static const double thin = 0.16667;
+		static const double medium = 0.22222;
+		static const double thick = 0.27778;
+
+		// These apply regardless of the style
+		if (current == "mop" &&
+			(previous == "mclose" || previous == "minner" ||
+			 previous == "mop" || previous == "mord"))
+		{
+			return thin;
+		}
+
+		if (previous == "mop" && current == "mord") return thin;
+
+		if (! textstyle || previous.empty() || current.empty()) return 0;
+
+		static const std::map<std::pair<std::string, std::string>, double> table = {
+			{{"mord", "mbin"}, medium}, {{"mord", "mrel"}, thick},
+			{{"mord", "minner"}, thin},
+			{{"mop", "mrel"}, thick}, {{"mop", "minner"}, thin},
+			{{"mbin", "minner"}, medium}, {{"mbin", "mop"}, medium},
+			{{"mbin", "mopen"}, medium}, {{"mbin", "mord"}, medium},
+			{{"mrel", "minner"}, thick}, {{"mrel", "mop"}, thick},
+			{{"mrel", "mopen"}, thick}, {{"mrel", "mord"}, thick},
+			{{"mclose", "mbin"}, medium}, {{"mclose", "mrel"}, thick},
+			{{"mclose", "minner"}, thin},
+			{{"mpunct", "mclose"}, thin}, {{"mpunct", "minner"}, thin},
+			{{"mpunct", "mop"}, thin}, {{"mpunct", "mopen"}, thin},
+			{{"mpunct", "mord"}, thin}, {{"mpunct", "mpunct"}, thin},
+			{{"mpunct", "mrel"}, thin},
+			{{"minner", "mord"}, thin}, {{"minner", "mbin"}, medium},
+			{{"minner", "mrel"}, thick}, {{"minner", "minner"}, thin},
+			{{"minner", "mopen"}, thin}, {{"minner", "mpunct"}, thin}
+		};
+
+		auto entry = table.find({previous, current});
+
+		return entry == table.end() ? 0 : entry->second;
+	}
+
+	/*! The font-size of a style, relative to the text style. */
+	double style_size(const std::string& style)
+	{
+		if (style == "scriptstyle") return 0.7;
+
+		if (style == "scriptscriptstyle") return 0.5;
+
+		return 1;
+	}
+
+	/*! The font-size of size1 to size10, relative to size5. */
+	double size_size(int size)
+	{
+		static const double sizes[] = {
+			0.5, 0.7, 0.8, 0.9, 1, 1.2, 1.44, 1.73, 2.07, 2.49
+		};
+
+		return (size >= 1 && size <= 10) ? sizes[size - 1] : 1;
+	}
+
+	/*! Parses the number of a CSS length in em (e.g. "-0.05em"). */
+	double length(const std::string& value)
+	{
+		return std::strtod(value.c_str(), nullptr);
+	}
+
+	struct Frame
+	{
+		/*! The font used for text, e.g. Main-Regular. */
+		std::string font = "Main-Regular";
+
+		/*! The font of children of .delim-size1/4. */
+		std::string child_font;
+
+		/*! The font-size, relative to the .katex element. */
+		double size = 1;
+
+		/*! A .vlist, whose children are stacked vertically. */
+		bool vertical = false;
+
+		/*! Inside the MathML tree, which is not displayed. */
+		bool hidden = false;
+
+		/*! Whether children have no width (e.g. .accent-body). */
+		bool zero_children = false;
+
+		/*! Whether the element has the textstyle class. */
+		bool textstyle = false;
+
+		/*! The atom type (mord, mbin, ...) of this element. */
+		std::string atom;
+
+		/*! The atom type of the last child element. */
+		std::string previous;
+
+		/*! The width of the content so far. */
+		double width = 0;
+
+		/*! An explicit width, overriding the content if not negative. */
+		double fixed = -1;
+
+		/*! The sum of the left and right margins. */
+		double margins = 0;
+	};
+
+	std::vector<std::string> split(const std::string& classes)
+	{
+		std::istringstream stream(classes);
+
+		return {std::istream_iterator<std::string>(stream),
+				std::istream_iterator<std::string>()};
+	}
+
+	bool has(const std::vector<std::string>& classes, const std::string& name)
+	{
+		return std::find(classes.begin(), classes.end(), name) != classes.end();
+	}
+
+	/*! Reads the class and style attributes of a start tag. */
+	void attributes(const std::string& tag, std::string& classes, std::string& style)
+	{
+		for (std::size_t i = 0; (i = tag.find('=', i)) != std::string::npos; )
+		{
+			auto name_end = i;
+
+			auto name_begin = tag.rfind(' ', name_end) + 1;
+
+			auto quote = tag[i + 1];
+
+			auto end = tag.find(quote, i + 2);
+
+			if (end == std::string::npos) return;
+
+			auto name = tag.substr(name_begin, name_end - name_begin);
+
+			auto value = tag.substr(i + 2, end - i - 2);
+
+			if (name == "class") classes = value;
+
+			else if (name == "style") style = value;
+
+			i = end + 1;
+		}
+	}
+
+	void apply_style(const std::string& style, Frame& frame)
+	{
+		std::istringstream stream(style);
+
+		std::string declaration;
+
+		while (std::getline(stream, declaration, ';'))
+		{
+			auto colon = declaration.find(':');
+
+			if (colon == std::string::npos) continue;
+
+			auto property = declaration.substr(0, colon);
+
+			auto value = declaration.substr(colon + 1);
+
+			if (property == "margin-left" || property == "margin-right")
+			{
+				frame.margins += length(value) * frame.size;
+			}
+
+			else if (property == "width")
+			{
+				frame.fixed = length(value) * frame.size;
+			}
+		}
+	}
+
+	void apply_classes(const std::vector<std::string>& classes, Frame& frame)
+	{
+		static const std::map<std::string, std::string> fonts = {
+			{"mathit", "Math-Italic"},
+			{"mathbf", "Main-Bold"},
+			{"amsrm", "AMS-Regular"},
+			{"mathbb", "AMS-Regular"},
+			{"mathcal", "Caligraphic-Regular"},
+			{"mathfrak", "Fraktur-Regular"},
+			{"mathtt", "Typewriter-Regular"},
+			{"mathscr", "Script-Regular"},
+			{"mathsf", "SansSerif-Regular"},
+			{"mainit", "Main-Italic"}
+		};
+
+		static const std::map<std::string, double> spaces = {
+			{"thinspace", 0.16667},
+			{"mediumspace", 0.22222},
+			{"thickspace", 0.27778},
+			{"enspace", 0.5},
+			{"quad", 1},
+			{"qquad", 2}
+		};
+
+		static const char* atoms[] = {
+			"mord", "mbin", "mrel", "mop", "mopen", "mclose", "mpunct", "minner"
+		};
+
+		std::string reset_style;
+		std::string style;
+
+		int reset_size = 0;
+		int size = 0;
+
+		for (const auto& name : classes)
+		{
+			auto font = fonts.find(name);
+
+			if (font != fonts.end()) frame.font = font->second;
+
+			for (auto atom : atoms)
+			{
+				if (name == atom) frame.atom = name;
+			}
+
+			if (name.compare(0, 6, "reset-") == 0)
+			{
+				if (name.compare(6, 4, "size") == 0)
+				{
+					reset_size = std::atoi(name.c_str() + 10);
+				}
+
+				else reset_style = name.substr(6);
+			}
+
+			else if (name.compare(0, 4, "size") == 0)
+			{
+				size = std::atoi(name.c_str() + 4);
+			}
+
+			else if (name == "textstyle" || name == "displaystyle" ||
+					 name == "scriptstyle" || name == "scriptscriptstyle")
+			{
+				// The CSS only distinguishes text, script and scriptscript
+				if (style.empty() || style_size(name) != 1) style = name;
+
+				if (name == "textstyle") frame.textstyle = true;
+			}
+
+			else if (name == "katex-mathml") frame.hidden = true;
+
+			else if (name == "vlist") frame.vertical = true;
+
+			else if (name == "accent-body") frame.zero_children = true;
+
+			else if (name == "delim-size1") frame.child_font = "Size1-Regular";
+
+			else if (name == "delim-size4") frame.child_font = "Size4-Regular";
+
+			else if (name == "small-op") frame.font = "Size1-Regular";
+
+			else if (name == "large-op") frame.font = "Size2-Regular";
+
+			else if (name == "nulldelimiter") frame.fixed = 0.12;
+
+			else if (name == "llap" || name == "rlap" ||
+					 name == "frac-line" || name == "sqrt-line" ||
+					 name == "overline-line")
+			{
+				frame.fixed = 0;
+			}
+
+			else if (name == "negativethinspace") frame.margins -= 0.16667;
+
+			else if (name == "root") frame.margins += 0.27777778 - 0.55555556;
+
+			else
+			{
+				auto space = spaces.find(name);
+
+				if (space != spaces.end()) frame.fixed = space->second;
+			}
+		}
+
+		if (! reset_style.empty() && ! style.empty())
+		{
+			frame.size *= style_size(style) / style_size(reset_style);
+		}
+
+		if (reset_size && size)
+		{
+			frame.size *= size_size(size) / size_size(reset_size);
+		}
+
+		else if (size && has(classes, "delimsizing") && size <= 4)
+		{
+			frame.font = "Size" + std::to_string(size) + "-Regular";
+		}
+
+		// Explicit widths and margins are in the element's own ems
+		if (frame.fixed > 0) frame.fixed *= frame.size;
+
+		frame.margins *= frame.size;
+	}
+
+	/*! Decodes the next UTF-8 code point or HTML entity. */
+	std::uint32_t next(const std::string& text, std::size_t& i)
+	{
+		auto byte = static_cast<unsigned char>(text[i]);
+
+		if (byte == '&')
+		{
+			auto end = text.find(';', i);
+
+			if (end != std::string::npos && end - i <= 8)
+			{
+				auto entity = text.substr(i + 1, end - i - 1);
+
+				i = end + 1;
+
+				if (entity == "amp") return '&';
+				if (entity == "lt") return '<';
+				if (entity == "gt") return '>';
+				if (entity == "quot") return '"';
+				if (entity == "nbsp") return 0xA0;
+
+				if (! entity.empty() && entity[0] == '#')
+				{
+					bool hex = entity.size() > 1 && (entity[1] == 'x' || entity[1] == 'X');
+
+					return static_cast<std::uint32_t>(
+						std::strtoul(entity.c_str() + (hex ? 2 : 1), nullptr, hex ? 16 : 10)
+					);
+				}
+
+				return '?';
+			}
+		}
+
+		int length = 1;
+
+		std::uint32_t codepoint = byte;
+
+		if (byte >= 0xF0) { length = 4; codepoint = byte & 0x07; }
+
+		else if (byte >= 0xE0) { length = 3; codepoint = byte & 0x0F; }
+
+		else if (byte >= 0xC0) { length = 2; codepoint = byte & 0x1F; }
+
+		for (int j = 1; j < length && i + j < text.size(); ++j)
+		{
+			codepoint = (codepoint << 6) | (text[i + j] & 0x3F);
+		}
+
+		i += length;
+
+		return codepoint;
+	}
+
+	void add(Frame& parent, double width)
+	{
+		if (parent.zero_children) return;
+
+		if (parent.vertical) parent.width = std::max(parent.width, width);
+
+		else parent.width += width;
+	}
+}
+
+FontMetrics::FontMetrics(const std::string& path)
+{
+	std::ifstream file(path, std::ios::binary);
+
+	if (! file) throw Latex::FileException("Could not open font " + path);
+
+	std::string data((std::istreambuf_iterator<char>(file)),
+					  std::istreambuf_iterator<char>());
+
+	std::map<std::string, std::size_t> tables;
+
+	auto count = u16(data, 4);
+
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		auto entry = 12 + 16 * i;
+
+		tables[data.substr(entry, 4)] = u32(data, entry + 8);
+	}
+
+	for (auto table : {"head", "hhea", "hmtx", "cmap"})
+	{
+		if (! tables.count(table))
+		{
+			throw Latex::FileException("Missing font table in " + path);
+		}
+	}
+
+	double units = u16(data, tables["head"] + 18);
+
+	std::size_t metrics = u16(data, tables["hhea"] + 34);
+
+	auto hmtx = tables["hmtx"];
+
+	auto advance = [&] (std::size_t glyph) {
+		// Glyphs past the last metric share its advance width
+		glyph = std::min(glyph, metrics - 1);
+
+		return u16(data, hmtx + 4 * glyph) / units;
+	};
+
+	auto cmap = tables["cmap"];
+
+	std::size_t subtable = 0;
+
+	for (std::size_t i = 0, n = u16(data, cmap + 2); i < n; ++i)
+	{
+		auto record = cmap + 4 + 8 * i;
+
+		// Windows, Unicode BMP
+		if (u16(data, record) == 3 && u16(data, record + 2) == 1)
+		{
+			subtable = cmap + u32(data, record + 4);
+		}
+	}
+
+	if (! subtable || u16(data, subtable) != 4)
+	{
+		throw Latex::FileException("Unsupported character map in " + path);
+	}
+
+	std::size_t segments = u16(data, subtable + 6) / 2;
+
+	auto ends = subtable + 14;
+	auto starts = ends + 2 * segments + 2;
+	auto deltas = starts + 2 * segments;
+	auto offsets = deltas + 2 * segments;
+
+	for (std::size_t s = 0; s < segments; ++s)
+	{
+		std::uint32_t start = u16(data, starts + 2 * s);
+		std::uint32_t end = u16(data, ends + 2 * s);
+
+		auto delta = u16(data, deltas + 2 * s);
+		auto offset = u16(data, offsets + 2 * s);
+
+		for (auto c = start; c <= end && c != 0xFFFF; ++c)
+		{
+			std::uint16_t glyph;
+
+			if (offset == 0) glyph = static_cast<std::uint16_t>(c + delta);
+
+			else
+			{
+				glyph = u16(data, offsets + 2 * s + offset + 2 * (c - start));
+
+				if (glyph) glyph = static_cast<std::uint16_t>(glyph + delta);
+			}
+
+			if (glyph) _advances[c] = advance(glyph);
+		}
+	}
+}
+
+const FontMetrics& FontMetrics::get(const std::string& directory,
+									const std::string& font)
+{
+	static std::mutex mutex;
+
+	static std::map<std::string, std::unique_ptr<FontMetrics>> fonts;
+
+	auto path = directory + "/KaTeX_" + font + ".ttf";
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	auto& metrics = fonts[path];
+
+	if (! metrics) metrics.reset(new FontMetrics(path));
+
+	return *metrics;
+}
+
+double FontMetrics::advance(std::uint32_t codepoint) const
+{
+	auto entry = _advances.find(codepoint);
+
+	return entry == _advances.end() ? -1 : entry->second;
+}
+
+double FontMetrics::width(const std::string& html, const std::string& directory)
+{
+	const auto& fallback = get(directory, "Main-Regular");
+
+	std::vector<Frame> stack(1);
+
+	for (std::size_t i = 0; i < html.size(); )
+	{
+		if (html[i] != '<')
+		{
+			auto& frame = stack.back();
+
+			auto end = std::min(html.find('<', i), html.size());
+
+			if (frame.hidden)
+			{
+				i = end;
+
+				continue;
+			}
+
+			const auto& font = get(directory, frame.font);
+
+			double width = 0;
+
+			while (i < end)
+			{
+				auto codepoint = next(html, i);
+
+				auto advance = font.advance(codepoint);
+
+				if (advance < 0) advance = std::max(0.0, fallback.advance(codepoint));
+
+				width += advance;
+			}
+
+			add(frame, width * frame.size);
+
+			continue;
+		}
+
+		auto end = html.find('>', i);
+
+		if (end == std::string::npos) break;
+
+		if (html[i + 1] == '/')
+		{
+			if (stack.size() > 1)
+			{
+				auto child = stack.back();
+
+				stack.pop_back();
+
+				if (! child.hidden)
+				{
+					auto width = (child.fixed >= 0) ? child.fixed : child.width;
+
+					add(stack.back(), width + child.margins);
+				}
+			}
+		}
+
+		else
+		{
+			auto& parent = stack.back();
+
+			Frame child;
+
+			child.font = parent.child_font.empty() ? parent.font : parent.child_font;
+			child.size = parent.size;
+			child.hidden = parent.hidden;
+
+			std::string classes;
+			std::string style;
+
+			attributes(html.substr(i, end - i), classes, style);
+
+			apply_classes(split(classes), child);
+
+			apply_style(style, child);
+
+			if (! parent.vertical)
+			{
+				child.margins += spacing(parent.previous,
+										 child.atom,
+										 parent.textstyle) * child.size;
+
+				parent.previous = child.atom;
+			}
+
+			stack.push_back(child);
+		}
+
+		i = end + 1;
+	}
+
+	return stack.front().width;
+}
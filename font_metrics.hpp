@@ -0,0 +1,101 @@
+/********************************************************//*!
+*
+*	@file font_metrics.hpp
+*
+*	@author Peter Goldsborough.
+*
+************************************************************/
+
+#ifndef FONT_METRICS_HPP
+#define FONT_METRICS_HPP
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+/***************************************************************************//*!
+*
+*	@brief Native horizontal metrics of the bundled KaTeX fonts.
+*
+*	@details The KaTeX version bundled with latexpp computes heights and
+*			 depths, but leaves widths to the browser. This class reads
+*			 the advance widths from the TrueType fonts in katex/fonts
+*			 and lays out KaTeX markup horizontally the way the KaTeX
+*			 stylesheet does, such that widths are known without
+*			 rasterizing anything.
+*
+*******************************************************************************/
+
+class FontMetrics
+{
+public:
+
+	/***********************************************************************//*!
+	*
+	*	@brief Loads the horizontal metrics of a TrueType font.
+	*
+	*	@param path The path of the .ttf file.
+	*
+	*	@throws Latex::FileException If the font could not be read.
+	*
+	***************************************************************************/
+
+	explicit FontMetrics(const std::string& path);
+
+	/***********************************************************************//*!
+	*
+	*	@brief Returns the metrics of a bundled KaTeX font.
+	*
+	*	@details Fonts are loaded once per process and then cached. This
+	*			 function is thread-safe.
+	*
+	*	@param directory The KaTeX fonts directory.
+	*
+	*	@param font The font's name, e.g. "Main-Regular" or "Math-Italic".
+	*
+	*	@throws Latex::FileException If the font could not be read.
+	*
+	***************************************************************************/
+
+	static const FontMetrics& get(const std::string& directory,
+								  const std::string& font);
+
+	/***********************************************************************//*!
+	*
+	*	@brief Computes the width of KaTeX markup.
+	*
+	*	@details The hidden MathML tree is skipped. Inter-atom spacing,
+	*			 style and size changes, vertical lists, spaces and inline
+	*			 margins are taken into account like the KaTeX stylesheet
+	*			 does; kerning and ligatures are not.
+	*
+	*	@param html The markup produced by KaTeX.
+	*
+	*	@param directory The KaTeX fonts directory.
+	*
+	*	@return The width, in ems of the .katex element.
+	*
+	***************************************************************************/
+
+	static double width(const std::string& html, const std::string& directory);
+
+	/***********************************************************************//*!
+	*
+	*	@brief Returns the advance width of a code point.
+	*
+	*	@param codepoint The Unicode code point.
+	*
+	*	@return The advance width in em, or a negative value
+	*			if the font has no glyph for the code point.
+	*
+	***************************************************************************/
+
+	double advance(std::uint32_t codepoint) const;
+
+private:
+
+	/*! The advance widths in em, by code point. */
+	std::unordered_map<std::uint32_t, double> _advances;
+};
+
+#endif /* FONT_METRICS_HPP */
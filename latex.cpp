@@ -1,12 +1,365 @@
 #include "latex.hpp"
+#include "compact_html.hpp"
+#include "fast_path.hpp"
+#include "font_metrics.hpp"
+#include "macros.hpp"
+#include "shared_cache.hpp"
+#include "sprite_sheet.hpp"
+#include "trace.hpp"
 
+#include <algorithm>
 #include <boost/filesystem.hpp>
+#include <cmath>
 #include <cstdlib>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <libplatform/libplatform.h>
+#include <mutex>
 #include <wkhtmltox/image.h>
 
+namespace
+{
+	/*! The one thread that calls into wkhtmltoimage. wkhtmltoimage is
+	    built on Qt, which must only be used from the thread that
+	    initialized it, and it is neither re-entrant nor reference-
+	    counted. So all instances (possibly living on different threads)
+	    hand their conversions to this thread, which initializes it for
+	    the first registered instance and deinitializes it after the
+	    last. The thread itself lives until the end of the program. */
+	class Converter
+	{
+	public:
+		
+		static Converter& instance()
+		{
+			// Constructed within the first instance's constructor, so
+			// destroyed after every instance of static storage
+			static Converter converter;
+			
+			return converter;
+		}
+		
+		~Converter()
+		{
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				
+				_stopping = true;
+			}
+			
+			_condition.notify_one();
+			
+			_thread.join();
+		}
+		
+		/*! Runs a task on the thread, rethrowing its exception. */
+		void run(std::function<void()> function)
+		{
+			std::packaged_task<void()> task(std::move(function));
+			
+			auto done = task.get_future();
+			
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				
+				_tasks.push_back(std::move(task));
+			}
+			
+			_condition.notify_one();
+			
+			done.get();
+		}
+		
+		void acquire()
+		{
+			run([this] { if (_users++ == 0) wkhtmltoimage_init(false); });
+		}
+		
+		void release()
+		{
+			run([this] { if (--_users == 0) wkhtmltoimage_deinit(); });
+		}
+		
+	private:
+		
+		Converter()
+		: _thread([this] { _loop(); })
+		{ }
+		
+		void _loop()
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			
+			while (true)
+			{
+				_condition.wait(lock, [this] {
+					return _stopping || ! _tasks.empty();
+				});
+				
+				if (_tasks.empty()) return;
+				
+				auto task = std::move(_tasks.front());
+				
+				_tasks.pop_front();
+				
+				lock.unlock();
+				
+				task();
+				
+				lock.lock();
+			}
+		}
+		
+		std::mutex _mutex;
+		
+		std::condition_variable _condition;
+		
+		std::deque<std::packaged_task<void()>> _tasks;
+		
+		bool _stopping = false;
+		
+		/*! The registered instances, only accessed on the thread. */
+		std::size_t _users = 0;
+		
+		/*! Declared last, as it starts running in the constructor. */
+		std::thread _thread;
+	};
+	
+	std::once_flag katex_path_flag;
+	
+	const std::string wrap_open = "<div class='latex'>\n";
+	
+	const std::string wrap_close = "</div>\n";
+	
+	std::string wrap(const std::string& html)
+	{
+		std::string wrapped;
+		
+		wrapped.reserve(wrap_open.size() + html.size() + wrap_close.size());
+		
+		wrapped += wrap_open;
+		wrapped += html;
+		wrapped += wrap_close;
+		
+		return wrapped;
+	}
+	
+	/*! wrap() for the result of a render, written straight from
+	    the V8 string instead of through a copy of it. */
+	void wrap(const v8::Local<v8::String>& html, std::string& wrapped)
+	{
+		auto length = static_cast<std::size_t>(html->Utf8Length());
+		
+		wrapped.reserve(wrap_open.size() + length + wrap_close.size());
+		
+		wrapped = wrap_open;
+		
+		wrapped.resize(wrap_open.size() + length);
+		
+		html->WriteUtf8(&wrapped[wrap_open.size()],
+						static_cast<int>(length),
+						nullptr,
+						v8::String::NO_NULL_TERMINATION);
+		
+		wrapped += wrap_close;
+	}
+	
+	/*! The least width of a sprite sheet, in pixels. */
+	const std::size_t sprite_sheet_width = 2048;
+	
+	/*! The white margin between sprites, in pixels. */
+	const std::size_t sprite_padding = 2;
+	
+	/*! The white margin within a sprite's box, in pixels, so
+	    that ink at the edge of the box means it was clipped. */
+	const std::size_t sprite_inset = 4;
+	
+	/*! How often a sprite sheet is rasterized at most, each
+	    time with more room for the sprites that were clipped. */
+	const std::size_t sprite_sheet_rounds = 3;
+	
+	/*! The path of the bundled KaTeX stylesheet, from the working
+	    directory of the examples and tools. */
+	const char* const bundled_stylesheet = "../../katex/katex.min.css";
+	
+	/*! The bundled KaTeX stylesheet, read once. */
+	const std::string& katex_stylesheet()
+	{
+		static const std::string stylesheet = [] {
+			std::ifstream file(Latex::_katex_path + "/katex.min.css");
+			
+			if (! file)
+			{
+				throw Latex::FileException("Could not read the KaTeX stylesheet!");
+			}
+			
+			return std::string(std::istreambuf_iterator<char>(file),
+							   std::istreambuf_iterator<char>());
+		}();
+		
+		return stylesheet;
+	}
+	
+	/*! Reads a stylesheet, the bundled one from wherever it is. */
+	std::string read_stylesheet(const std::string& path)
+	{
+		if (path == bundled_stylesheet) return katex_stylesheet();
+		
+		std::ifstream file(path);
+		
+		if (! file) throw Latex::FileException("Could not read the stylesheet " + path);
+		
+		return std::string(std::istreambuf_iterator<char>(file),
+						   std::istreambuf_iterator<char>());
+	}
+	
+	/*! Times a call and records it in a trace when it ends, unless
+	    there is no trace or the call is nested in a recorded one. */
+	class Recorder
+	{
+	public:
+		
+		Recorder(const std::shared_ptr<TraceWriter>& trace,
+				 bool& recording,
+				 TraceRecord::Method method,
+				 const std::string& equation,
+				 const Latex& latex)
+		: _trace((trace && ! recording) ? trace.get() : nullptr)
+		, _recording(recording)
+		{
+			if (! _trace) return;
+			
+			_recording = true;
+			
+			_record.timestamp = _trace->now();
+			_record.method = method;
+			_record.status = TraceRecord::Status::Error;
+			_record.equation = equation;
+			_record.css = latex.additional_css();
+			_record.stylesheet = latex.stylesheet();
+			_record.output_mode = static_cast<std::uint8_t>(latex.output_mode());
+			
+			if (latex.macros()) _record.macros = latex.macros()->fingerprint();
+		}
+		
+		~Recorder()
+		{
+			if (! _trace) return;
+			
+			_recording = false;
+			
+			if (_discarded) return;
+			
+			_record.latency = static_cast<std::uint32_t>(_trace->now() - _record.timestamp);
+			
+			_trace->record(_record);
+		}
+		
+		void succeeded()
+		{
+			_record.status = TraceRecord::Status::OK;
+		}
+		
+		void finished(const Latex::Result& result)
+		{
+			if (result) _record.status = TraceRecord::Status::OK;
+			
+			else if (result.error.kind == Latex::ErrorKind::Parse)
+			{
+				_record.status = TraceRecord::Status::ParseError;
+			}
+		}
+		
+		/*! Records nothing after all. */
+		void discard()
+		{
+			_discarded = true;
+		}
+		
+	private:
+		
+		TraceWriter* _trace;
+		
+		bool& _recording;
+		
+		bool _discarded = false;
+		
+		TraceRecord _record;
+	};
+	
+	/*! Keys a render in a SharedCache by all the output depends on:
+	    the equation as spelled (not expanded, as positions of errors
+	    refer to the spelling) and the macros it is expanded with. */
+	SharedCache::Key cache_key(const Latex& latex,
+							   const std::string& equation,
+							   char kind)
+	{
+		std::string options(1, kind);
+		
+		options += static_cast<char>(latex.output_mode());
+		options += latex.stylesheet() + '\0';
+		options += latex.additional_css() + '\0';
+		
+		if (latex.macros()) options += std::to_string(latex.macros()->fingerprint());
+		
+		return SharedCache::key(equation, options);
+	}
+	
+	TraceRecord::Method method(Latex::ImageFormat format)
+	{
+		switch (format)
+		{
+			case Latex::ImageFormat::PNG: return TraceRecord::Method::PNG;
+				
+			case Latex::ImageFormat::JPG: return TraceRecord::Method::JPG;
+				
+			case Latex::ImageFormat::SVG: return TraceRecord::Method::SVG;
+		}
+		
+		return TraceRecord::Method::PNG;
+	}
+	
+	/*! Equations exercising most of KaTeX, to warm up V8's JIT. One
+	    of them is invalid, so that the error path gets warm, too. */
+	const char* const warm_up_corpus[] = {
+		"x^2 + y^2 = z^2",
+		"e^{i\\pi} + 1 = 0",
+		"\\frac{-b \\pm \\sqrt{b^2 - 4ac}}{2a}",
+		"\\sqrt[3]{x + 1}",
+		"\\sum_{i=1}^{n} i = \\frac{n(n + 1)}{2}",
+		"\\int_0^\\infty e^{-x^2} dx = \\frac{\\sqrt{\\pi}}{2}",
+		"\\lim_{x \\to 0} \\frac{\\sin x}{x} = 1",
+		"\\prod_{p} \\frac{1}{1 - p^{-s}}",
+		"\\left( \\frac{a}{b} \\right)^n",
+		"\\left[ x \\right] \\leq \\left\\lbrace y \\right\\rbrace",
+		"f(x) = \\begin{cases} 1 & x > 0 \\\\ 0 & x \\leq 0 \\end{cases}",
+		"\\begin{matrix} a & b \\\\ c & d \\end{matrix}",
+		"\\mathbf{A} \\mathbf{x} = \\mathbf{b}",
+		"\\overline{z} \\cdot \\vec{v} + \\hat{n}",
+		"\\alpha \\beta \\gamma \\Delta \\Omega",
+		"a \\in A \\subseteq B \\cup C \\cap D",
+		"\\forall \\epsilon > 0 \\, \\exists \\delta > 0",
+		"\\nabla \\times \\mathbf{E} = -\\frac{\\partial \\mathbf{B}}{\\partial t}",
+		"\\binom{n}{k}",
+		"\\text{if } x \\neq 0",
+		"x_{i,j}^{(k)}",
+		"\\sin^2 \\theta + \\cos^2 \\theta = 1",
+		"\\log_2 n \\ll \\sqrt{n}",
+		"a \\quad b \\qquad c",
+		"\\Big( \\big( x \\big) \\Big)",
+		"\\langle u, v \\rangle",
+		"\\lfloor x \\rfloor + \\lceil y \\rceil",
+		"\\mathbb{R}^n",
+		"\\mathcal{O}(n \\log n)",
+		"\\color{red}{x} \\mapsto x^2",
+		"\\frac{a"
+	};
+}
+
 std::string Latex::_find_katex_path()
 {
 	for (std::string dir = "./", end = "./../../"; dir != end; dir += "../")
@@ -30,40 +383,81 @@ std::string Latex::_katex_path;
 
 Latex::V8 Latex::_v8;
 
-Latex::Latex(WarningBehavior behavior)
-: Latex("../../katex/katex.min.css", behavior)
+Latex::Latex(WarningBehavior behavior,
+			 Loading loading,
+			 std::shared_ptr<v8::ArrayBuffer::Allocator> allocator)
+: Latex(bundled_stylesheet, behavior, loading, std::move(allocator))
 { }
 
-Latex::Latex(const std::string& stylesheet, WarningBehavior behavior)
+Latex::Latex(const std::string& stylesheet,
+			 WarningBehavior behavior,
+			 Loading loading,
+			 std::shared_ptr<v8::ArrayBuffer::Allocator> allocator)
 : _stylesheet(stylesheet)
 , _warning_behaviour(behavior)
-, _isolate(_new_isolate())
+, _fast_path(true)
+, _output_mode(OutputMode::Full)
+, _recording(false)
+, _registered(false)
+, _isolate(nullptr)
 {
-	if (_katex_path.empty())
-	{
-		_katex_path = _find_katex_path();
-	}
-	
-	v8::HandleScope handle_scope(_isolate);
+	_allocator = allocator ? std::move(allocator) : std::make_shared<Allocator>();
 	
-	v8::Isolate::Scope isolate_scope(_isolate);
+	std::call_once(katex_path_flag, [] {
+		if (_katex_path.empty()) _katex_path = _find_katex_path();
+	});
 	
-	auto context = v8::Context::New(_isolate);
+	if (loading == Loading::Blocking)
+	{
+		_start();
+		
+		_register();
+		
+		return;
+	}
 	
-	v8::Context::Scope context_scope(context);
+	// Only the engine loads in the background, as wkhtmltoimage is
+	// initialized on the converter thread (see Converter)
+	_register();
 	
-	_load_katex(context);
+	std::promise<void> promise;
 	
-	_persistent_context = v8::UniquePersistent<v8::Context>(_isolate, context);
+	_ready = promise.get_future().share();
 	
-	wkhtmltoimage_init(false);
+	_loader = std::thread([this, loading, promise = std::move(promise)] () mutable {
+		try
+		{
+			_start();
+			
+			if (loading == Loading::WarmUp) _warm_up(8);
+			
+			promise.set_value();
+		}
+		
+		catch (...)
+		{
+			promise.set_exception(std::current_exception());
+		}
+	});
 }
 
 Latex::Latex(const Latex& other)
 : Latex(other._stylesheet,
-		other._warning_behaviour)
+		other._warning_behaviour,
+		Loading::Blocking,
+		other._allocator)
 {
 	_additional_css = other._additional_css;
+	
+	_fast_path = other._fast_path;
+	
+	_output_mode = other._output_mode;
+	
+	_trace = other._trace;
+	
+	_cache = other._cache;
+	
+	_macros = other._macros;
 }
 
 Latex::Latex(Latex&& other) noexcept
@@ -84,163 +478,854 @@ void Latex::swap(Latex &other) noexcept
 	// Enable ADL
 	using std::swap;
 	
+	// The loaders write to their instances until they're done
+	if (_ready.valid()) _ready.wait();
+	
+	if (other._ready.valid()) other._ready.wait();
+	
 	swap(_allocator, other._allocator);
 	
 	swap(_isolate, other._isolate);
 	
 	swap(_persistent_context, other._persistent_context);
 	
-	swap(_stylesheet, other._stylesheet);
+	swap(_stylesheet, other._stylesheet);
+	
+	swap(_additional_css, other._additional_css);
+	
+	swap(_warning_behaviour, other._warning_behaviour);
+	
+	swap(_fast_path, other._fast_path);
+	
+	swap(_output_mode, other._output_mode);
+	
+	swap(_compact, other._compact);
+	
+	swap(_trace, other._trace);
+	
+	swap(_cache, other._cache);
+	
+	swap(_macros, other._macros);
+	
+	swap(_registered, other._registered);
+	
+	swap(_loader, other._loader);
+	
+	swap(_ready, other._ready);
+}
+
+void swap(Latex& first, Latex& second) noexcept
+{
+	first.swap(second);
+}
+
+Latex::~Latex()
+{
+	// Also if it failed, the loader may not outlive the instance
+	if (_loader.joinable()) _loader.join();
+	
+	if (_registered) Converter::instance().release();
+}
+
+std::string Latex::to_html(const std::string& latex) const
+{
+	auto result = try_to_html(latex);
+	
+	if (! result) throw ParseException(result.error.message);
+	
+	return result.html;
+}
+
+std::vector<std::string>
+Latex::to_html(const std::vector<std::string>& equations) const
+{
+	std::vector<std::string> snippets;
+	
+	snippets.reserve(equations.size());
+	
+	for (auto& result : try_to_html(equations))
+	{
+		if (! result) throw ParseException(result.error.message);
+		
+		snippets.push_back(std::move(result.html));
+	}
+	
+	return snippets;
+}
+
+Latex::Result Latex::try_to_html(const std::string& latex) const
+{
+	if (! _cache)
+	{
+		auto result = _try_to_html(latex);
+		
+		_output(result, _output_mode);
+		
+		return result;
+	}
+	
+	auto key = cache_key(*this, latex, 'H');
+	
+	Result result;
+	
+	if (_cache->get(key, result.html)) return result;
+	
+	result = _try_to_html(latex);
+	
+	_output(result, _output_mode);
+	
+	if (result) _cache->insert(key, result.html);
+	
+	return result;
+}
+
+std::vector<Latex::Result>
+Latex::try_to_html(const std::vector<std::string>& equations) const
+{
+	if (! _cache)
+	{
+		auto results = _try_to_html(equations);
+		
+		for (auto& result : results) _output(result, _output_mode);
+		
+		return results;
+	}
+	
+	std::vector<Result> results(equations.size());
+	
+	std::vector<SharedCache::Key> keys;
+	
+	std::vector<std::string> missing;
+	
+	std::vector<std::size_t> positions;
+	
+	keys.reserve(equations.size());
+	
+	for (std::size_t i = 0; i < equations.size(); ++i)
+	{
+		keys.push_back(cache_key(*this, equations[i], 'H'));
+		
+		if (! _cache->get(keys[i], results[i].html))
+		{
+			missing.push_back(equations[i]);
+			
+			positions.push_back(i);
+		}
+	}
+	
+	if (missing.empty()) return results;
+	
+	auto rendered = _try_to_html(missing);
+	
+	for (std::size_t i = 0; i < rendered.size(); ++i)
+	{
+		_output(rendered[i], _output_mode);
+		
+		if (rendered[i]) _cache->insert(keys[positions[i]], rendered[i].html);
+		
+		results[positions[i]] = std::move(rendered[i]);
+	}
+	
+	return results;
+}
+
+const std::string& Latex::_expand(const std::string& latex,
+								 std::string& buffer,
+								 Error& error) const
+{
+	if (! _macros) return latex;
+	
+	try
+	{
+		return _macros->expand(latex, buffer) ? buffer : latex;
+	}
+	
+	catch (const ParseException& exception)
+	{
+		error.kind = ErrorKind::Parse;
+		
+		error.message = exception.what();
+		
+		return latex;
+	}
+}
+
+Latex::Result Latex::_try_to_html(const std::string& latex) const
+{
+	Result result;
+	
+	std::string buffer;
+	
+	const auto& equation = _expand(latex, buffer, result.error);
+	
+	if (! result) return result;
+	
+	Recorder recorder(_trace,
+					  _recording,
+					  TraceRecord::Method::HTML,
+					  equation,
+					  *this);
+	
+	if (_render_natively(equation, result))
+	{
+		recorder.finished(result);
+		
+		return result;
+	}
+	
+	_wait();
+	
+	// Required for the isolate to be used from other threads
+	// than the background loader that created it
+	v8::Locker locker(_isolate);
+	
+	v8::Isolate::Scope isolate_scope(_isolate);
+	
+	// Stack-allocated handle-scope (takes care of handles such
+	// that object are garbage-collected after the scope ends)
+	v8::HandleScope handle_scope(_isolate);
+	
+	// Get a local context handle from the persistent handle.
+	auto context = v8::Local<v8::Context>::New(_isolate,
+											   _persistent_context);
+	
+	v8::Context::Scope context_scope(context);
+	
+	result = _render(equation, context);
+	
+	recorder.finished(result);
+	
+	// Positions are in the expanded equation
+	if (&equation != &latex) result.error.position = -1;
+	
+	return result;
+}
+
+std::vector<Latex::Result>
+Latex::_try_to_html(const std::vector<std::string>& equations) const
+{
+	std::vector<Result> results(equations.size());
+	
+	std::vector<std::size_t> remaining;
+	
+	// The expanded equations of those that had macros
+	std::vector<std::string> buffers(_macros ? equations.size() : 0);
+	
+	std::vector<const std::string*> expanded(equations.size());
+	
+	for (std::size_t i = 0; i < equations.size(); ++i)
+	{
+		expanded[i] = &equations[i];
+		
+		if (_macros)
+		{
+			expanded[i] = &_expand(equations[i], buffers[i], results[i].error);
+			
+			if (! results[i]) continue;
+		}
+		
+		Recorder recorder(_trace,
+						  _recording,
+						  TraceRecord::Method::HTML,
+						  *expanded[i],
+						  *this);
+		
+		if (_render_natively(*expanded[i], results[i]))
+		{
+			recorder.finished(results[i]);
+		}
+		
+		else
+		{
+			// Recorded when actually rendered below
+			recorder.discard();
+			
+			remaining.push_back(i);
+		}
+	}
+	
+	// Don't enter the isolate at all if every equation was trivial
+	if (remaining.empty()) return results;
+	
+	_wait();
+	
+	v8::Locker locker(_isolate);
+	
+	v8::Isolate::Scope isolate_scope(_isolate);
+	
+	v8::HandleScope handle_scope(_isolate);
+	
+	auto context = v8::Local<v8::Context>::New(_isolate,
+											   _persistent_context);
+	
+	v8::Context::Scope context_scope(context);
+	
+	for (auto i : remaining)
+	{
+		// So that handles don't pile up over the whole batch
+		v8::HandleScope item_scope(_isolate);
+		
+		Recorder recorder(_trace,
+						  _recording,
+						  TraceRecord::Method::HTML,
+						  *expanded[i],
+						  *this);
+		
+		results[i] = _render(*expanded[i], context);
+		
+		recorder.finished(results[i]);
+		
+		if (expanded[i] != &equations[i]) results[i].error.position = -1;
+	}
+	
+	return results;
+}
+
+std::string Latex::to_complete_html(const std::string &latex) const
+{
+	return _document(latex, _output_mode);
+}
+
+Latex::Metrics Latex::measure(const std::string& latex, double font_size) const
+{
+	// Measured on the full markup, whatever the output mode
+	auto result = _try_to_html(latex);
+	
+	if (! result) throw ParseException(result.error.message);
+	
+	return _measure(result.html, font_size);
+}
+
+std::vector<Latex::Metrics>
+Latex::measure(const std::vector<std::string>& equations, double font_size) const
+{
+	std::vector<Metrics> metrics;
+	
+	metrics.reserve(equations.size());
+	
+	for (const auto& result : _try_to_html(equations))
+	{
+		if (! result) throw ParseException(result.error.message);
+		
+		metrics.push_back(_measure(result.html, font_size));
+	}
+	
+	return metrics;
+}
+
+void Latex::to_image(const std::string &latex,
+				  const std::string &filepath,
+				  ImageFormat format) const
+{
+	_image(latex, filepath, format);
+}
+
+std::string Latex::to_image_data(const std::string& latex,
+								 ImageFormat format) const
+{
+	return _image(latex, "", format);
+}
+
+Latex::Error Latex::try_to_image_data(const std::string& latex,
+									  ImageFormat format,
+									  std::string& data) const
+{
+	Error error;
+	
+	data = _image(latex, "", format, &error);
+	
+	return error;
+}
+
+std::vector<std::string>
+Latex::to_image_data(const std::vector<std::string>& equations,
+					 ImageFormat format) const
+{
+	std::vector<std::string> images;
+	
+	images.reserve(equations.size());
+	
+	// Whole pages, cached and traced like single images
+	for (const auto& latex : equations)
+	{
+		images.push_back(_image(latex, "", format));
+	}
+	
+	return images;
+}
+
+std::vector<std::string>
+Latex::to_image_data(const Result& result,
+					 const std::vector<ImageFormat>& formats) const
+{
+	if (! result) throw ParseException(result.error.message);
+	
+	// Every format from the one document
+	auto document = _document(result, OutputMode::Full);
+	
+	std::vector<std::string> images;
+	
+	images.reserve(formats.size());
+	
+	_wait();
+	
+	for (auto format : formats)
+	{
+		images.push_back(_rasterize(document, "", format));
+	}
+	
+	return images;
+}
+
+SpriteSheet Latex::to_sprite_sheet(const std::vector<std::string>& equations) const
+{
+	// Always the full markup, as for single images
+	return to_sprite_sheet(_try_to_html(equations));
+}
+
+SpriteSheet Latex::to_sprite_sheet(const std::vector<Result>& results) const
+{
+	// The default font size of the page
+	const double font_size = 16;
+	
+	const double em = font_size * 1.21;
+	
+	// The estimated content size of each sprite's box
+	std::vector<SpriteSheet::Sprite> estimates(results.size());
+	
+	for (std::size_t i = 0; i < results.size(); ++i)
+	{
+		if (! results[i]) throw ParseException(results[i].error.message);
+		
+		auto metrics = _measure(results[i].html, font_size);
+		
+		// With room for the line box and for error in the measured width
+		auto content_width = metrics.px.width * 1.1 + em / 2;
+		
+		auto content_height = std::max(metrics.px.height + metrics.px.depth, 1.2 * em) + em / 2;
+		
+		estimates[i].width = static_cast<std::size_t>(std::ceil(content_width));
+		estimates[i].height = static_cast<std::size_t>(std::ceil(content_height));
+	}
+	
+	// How much the room of each sprite is grown
+	std::vector<std::size_t> scales(results.size(), 1);
+	
+	// Estimates can fall short, so sprites whose ink reaches the edge
+	// of their box (and was clipped there) get twice the room, until
+	// none is clipped or the rounds are up
+	for (std::size_t round = 1; ; ++round)
+	{
+		std::vector<SpriteSheet::Sprite> cells(results.size());
+		
+		auto width = sprite_sheet_width;
+		
+		for (std::size_t i = 0; i < cells.size(); ++i)
+		{
+			auto margin = 2 * (sprite_padding + scales[i] * sprite_inset);
+			
+			cells[i].width = scales[i] * estimates[i].width + margin;
+			cells[i].height = scales[i] * estimates[i].height + margin;
+			
+			width = std::max(width, cells[i].width);
+		}
+		
+		// At least a pixel, as wkhtmltoimage fails on empty pages
+		auto height = std::max<std::size_t>(SpriteSheet::pack(cells, width), 1);
+		
+		std::string html = "<!DOCTYPE html>\n<html>\n";
+		
+		html += "<head>\n<meta charset='utf-8'/>\n";
+		html += "<link rel='stylesheet' type='text/css' ";
+		html += "href='" + _stylesheet + "'>\n";
+		html += "<style>\n";
+		html += _additional_css;
+		html += "\nbody{margin:0;position:relative;";
+		html += "width:" + std::to_string(width) + "px;";
+		html += "height:" + std::to_string(height) + "px}\n";
+		html += ".latex-sprite{position:absolute;overflow:hidden;white-space:nowrap}\n";
+		html += ".latex-sprite .katex-display{margin:0;text-align:left}\n";
+		html += "</style>\n";
+		html += "</head>\n<body>\n";
+		
+		for (std::size_t i = 0; i < results.size(); ++i)
+		{
+			const auto& cell = cells[i];
+			
+			auto inset = scales[i] * sprite_inset;
+			
+			// The box fills the cell but for the padding
+			html += "<div class='latex-sprite' style='";
+			html += "left:" + std::to_string(cell.x + sprite_padding) + "px;";
+			html += "top:" + std::to_string(cell.y + sprite_padding) + "px;";
+			html += "padding:" + std::to_string(inset) + "px;";
+			html += "width:" + std::to_string(cell.width - 2 * (sprite_padding + inset)) + "px;";
+			html += "height:" + std::to_string(cell.height - 2 * (sprite_padding + inset)) + "px'>\n";
+			html += results[i].html;
+			html += "</div>\n";
+		}
+		
+		html += "</body>\n</html>";
+		
+		// Raw pixels, to find and cut out the sprites
+		Settings settings = {
+			{"fmt", "ppm"},
+			{"screenWidth", std::to_string(width)}
+		};
+		
+		_wait();
+		
+		auto ppm = _rasterize(html, "", ImageFormat::PNG, settings);
+		
+		SpriteSheet sheet(ppm, cells, sprite_padding);
+		
+		bool clipped = false;
+		
+		for (std::size_t i = 0; i < sheet.size(); ++i)
+		{
+			if (sheet.clipped(i))
+			{
+				scales[i] *= 2;
+				
+				clipped = true;
+			}
+		}
+		
+		if (! clipped || round == sprite_sheet_rounds) return sheet;
+	}
+}
+
+void Latex::to_png(const std::string &latex,
+				const std::string &filepath) const
+{
+	to_image(latex, filepath, ImageFormat::PNG);
+}
+
+void Latex::to_jpg(const std::string &latex,
+				const std::string &filepath) const
+{
+	to_image(latex, filepath, ImageFormat::JPG);
+}
+
+void Latex::to_svg(const std::string &latex,
+				const std::string &filepath) const
+{
+	to_image(latex, filepath, ImageFormat::SVG);
+}
+
+void Latex::add_css(const std::string& css)
+{
+	_additional_css += css;
+	
+	_compact.reset();
+}
+
+const std::string& Latex::additional_css() const
+{
+	return _additional_css;
+}
+
+void Latex::clear_additional_css()
+{
+	_additional_css.clear();
+	
+	_compact.reset();
+}
+
+const std::string& Latex::stylesheet() const
+{
+	return _stylesheet;
+}
+
+void Latex::stylesheet(const std::string& stylesheet)
+{
+	_stylesheet = stylesheet;
+	
+	_compact.reset();
+}
+
+const Latex::WarningBehavior& Latex::warning_behavior() const
+{
+	return _warning_behaviour;
+}
+
+void Latex::warning_behavior(WarningBehavior behavior)
+{
+	_warning_behaviour = behavior;
+}
+
+bool Latex::fast_path() const
+{
+	return _fast_path;
+}
+
+void Latex::fast_path(bool enabled)
+{
+	_fast_path = enabled;
+}
+
+Latex::OutputMode Latex::output_mode() const
+{
+	return _output_mode;
+}
+
+void Latex::output_mode(OutputMode mode)
+{
+	_output_mode = mode;
+}
+
+std::string Latex::compact_stylesheet() const
+{
+	auto directory = boost::filesystem::path(_stylesheet).parent_path();
+	
+	return _compactor().stylesheet(directory.string());
+}
+
+void Latex::cache(std::shared_ptr<SharedCache> cache)
+{
+	_cache = std::move(cache);
+}
+
+const std::shared_ptr<SharedCache>& Latex::cache() const
+{
+	return _cache;
+}
+
+void Latex::define(const std::string& preamble)
+{
+	// Copied, as other instances may share the macros
+	auto macros = _macros ? std::make_shared<Macros>(*_macros)
+						  : std::make_shared<Macros>();
+	
+	macros->define(preamble);
+	
+	_macros = std::move(macros);
+}
+
+void Latex::macros(std::shared_ptr<const Macros> macros)
+{
+	_macros = std::move(macros);
+}
+
+const std::shared_ptr<const Macros>& Latex::macros() const
+{
+	return _macros;
+}
+
+void Latex::capture(std::shared_ptr<TraceWriter> trace)
+{
+	_trace = std::move(trace);
+}
+
+const std::shared_ptr<TraceWriter>& Latex::capture() const
+{
+	return _trace;
+}
+
+void Latex::warm_up(std::size_t rounds) const
+{
+	_wait();
+	
+	_warm_up(rounds);
+}
+
+bool Latex::ready() const
+{
+	if (! _ready.valid()) return true;
+	
+	return _ready.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+void Latex::_start()
+{
+	_isolate = _new_isolate();
+	
+	v8::Locker locker(_isolate);
+	
+	v8::HandleScope handle_scope(_isolate);
+	
+	v8::Isolate::Scope isolate_scope(_isolate);
+	
+	auto context = v8::Context::New(_isolate);
+	
+	v8::Context::Scope context_scope(context);
 	
-	swap(_additional_css, other._additional_css);
+	_load_katex(context);
 	
-	swap(_warning_behaviour, other._warning_behaviour);
+	_persistent_context = v8::UniquePersistent<v8::Context>(_isolate, context);
 }
 
-void swap(Latex& first, Latex& second) noexcept
+void Latex::_register()
 {
-	first.swap(second);
+	Converter::instance().acquire();
+	
+	_registered = true;
 }
 
-Latex::~Latex()
+void Latex::_wait() const
 {
-	wkhtmltoimage_deinit();
+	// Rethrows the exception of a failed start on every call
+	if (_ready.valid()) _ready.get();
 }
 
-std::string Latex::to_html(const std::string& latex) const
+void Latex::_warm_up(std::size_t rounds) const
 {
-	static const std::string arguments = "{'displayMode': true}";
+	v8::Locker locker(_isolate);
 	
 	v8::Isolate::Scope isolate_scope(_isolate);
 	
-	// Stack-allocated handle-scope (takes care of handles such
-	// that object are garbage-collected after the scope ends)
 	v8::HandleScope handle_scope(_isolate);
 	
-	// Get a local context handle from the persistent handle.
 	auto context = v8::Local<v8::Context>::New(_isolate,
 											   _persistent_context);
 	
 	v8::Context::Scope context_scope(context);
 	
-	std::string source = "katex.renderToString('";
+	for (std::size_t round = 0; round < rounds; ++round)
+	{
+		for (auto latex : warm_up_corpus)
+		{
+			v8::HandleScope item_scope(_isolate);
+			
+			_render(latex, context);
+		}
+	}
+}
+
+void Latex::_output(Result& result, OutputMode mode) const
+{
+	if (! result) return;
 	
-	source += _escape(latex) + "', ";
-	source += arguments + ");";
+	if (mode == OutputMode::Compact)
+	{
+		result.html = _compactor().compact(result.html);
+	}
 	
-	auto value = _run(source, context);
+	else if (mode == OutputMode::MathML)
+	{
+		auto begin = result.html.find("<math>");
+		
+		auto end = result.html.rfind("</math>");
+		
+		if (begin == std::string::npos || end == std::string::npos) return;
+		
+		// Rendered in display mode. KaTeX leaves out the namespace,
+		// which MathML needs outside of HTML, as in XHTML or EPUB.
+		std::string math = "<math xmlns=\"http://www.w3.org/1998/Math/MathML\" display=\"block\">";
+		
+		begin += std::strlen("<math>");
+		
+		math.append(result.html, begin, end + std::strlen("</math>") - begin);
+		
+		result.html = wrap(math);
+	}
+}
+
+std::string Latex::_document(const std::string& latex, OutputMode mode) const
+{
+	auto result = _try_to_html(latex);
 	
-	std::string html = *static_cast<v8::String::Utf8Value>(value);
+	if (! result) throw ParseException(result.error.message);
 	
-	return "<div class='latex'>\n" + html + "</div>\n";
+	return _document(std::move(result), mode);
 }
 
-std::string Latex::to_complete_html(const std::string &latex) const
+std::string Latex::_document(Result result, OutputMode mode) const
 {
-	auto snippet = to_html(latex);
+	_output(result, mode);
+	
+	std::string html;
 	
-	std::string html = "<!DOCTYPE html>\n<html>\n";
+	// The snippet and the CSS, plus some for the markup around them
+	html.reserve(result.html.size() + _additional_css.size() + 256);
+	
+	html += "<!DOCTYPE html>\n<html>\n";
 	
 	html += "<head>\n<meta charset='utf-8'/>\n";
-	html += "<link rel='stylesheet' type='text/css' ";
- 	html += "href='" + _stylesheet + "'>\n";
 	
-	if (! _additional_css.empty())
+	if (mode == OutputMode::Compact)
 	{
+		// Includes the additional CSS
 		html += "<style>\n";
-		html += _additional_css;
+		html += compact_stylesheet();
 		html += "</style>\n";
 	}
 	
+	else
+	{
+		if (mode == OutputMode::Full)
+		{
+			html += "<link rel='stylesheet' type='text/css' ";
+			html += "href='" + _stylesheet + "'>\n";
+		}
+		
+		if (! _additional_css.empty())
+		{
+			html += "<style>\n";
+			html += _additional_css;
+			html += "</style>\n";
+		}
+	}
+	
 	html += "</head>\n<body>\n";
-	html += snippet;
+	html += result.html;
 	html += "</body>\n</html>";
 	
 	return html;
 }
 
-void Latex::to_image(const std::string &latex,
-				  const std::string &filepath,
-				  ImageFormat format) const
+const CompactHtml& Latex::_compactor() const
 {
-	std::ofstream temp("temp.html");
-	
-	if (! temp) throw FileException("Could not open temporary file!");
+	if (! _compact)
+	{
+		_compact = std::make_shared<CompactHtml>(read_stylesheet(_stylesheet),
+												 _additional_css);
+	}
 	
-	temp << to_complete_html(latex);
+	return *_compact;
+}
+
+std::string Latex::_image(const std::string& latex,
+						  const std::string& filepath,
+						  ImageFormat format,
+						  Error* error) const
+{
+	// Raster images mostly wouldn't fit an entry
+	if (! _cache || format != ImageFormat::SVG)
+	{
+		return _convert(latex, filepath, format, error);
+	}
 	
-	temp.close();
+	auto key = cache_key(*this, latex, 'S');
 	
-	auto converter = _new_converter(filepath, format);
+	std::string data;
 	
-	if (! wkhtmltoimage_convert(converter))
+	if (! _cache->get(key, data))
 	{
-		throw ConversionException("Could not convert to png!");
+		data = _convert(latex, "", format, error);
+		
+		if (error && error->kind != ErrorKind::None) return std::string();
+		
+		_cache->insert(key, data);
 	}
 	
-	wkhtmltoimage_destroy_converter(converter);
+	if (filepath.empty()) return data;
 	
-	boost::filesystem::remove("temp.html");
-}
-
-void Latex::to_png(const std::string &latex,
-				const std::string &filepath) const
-{
-	to_image(latex, filepath, ImageFormat::PNG);
-}
-
-void Latex::to_jpg(const std::string &latex,
-				const std::string &filepath) const
-{
-	to_image(latex, filepath, ImageFormat::JPG);
-}
-
-void Latex::to_svg(const std::string &latex,
-				const std::string &filepath) const
-{
-	to_image(latex, filepath, ImageFormat::SVG);
-}
-
-void Latex::add_css(const std::string& css)
-{
-	_additional_css += css;
-}
-
-const std::string& Latex::additional_css() const
-{
-	return _additional_css;
-}
-
-void Latex::clear_additional_css()
-{
-	_additional_css.clear();
-}
-
-const std::string& Latex::stylesheet() const
-{
-	return _stylesheet;
-}
-
-void Latex::stylesheet(const std::string& stylesheet)
-{
-	_stylesheet = stylesheet;
-}
-
-const Latex::WarningBehavior& Latex::warning_behavior() const
-{
-	return _warning_behaviour;
-}
-
-void Latex::warning_behavior(WarningBehavior behavior)
-{
-	_warning_behaviour = behavior;
+	std::ofstream file(filepath, std::ios::binary);
+	
+	if (! file.write(data.data(), static_cast<std::streamsize>(data.size())))
+	{
+		throw FileException("Could not write " + filepath);
+	}
+	
+	return std::string();
 }
 
 v8::Isolate* Latex::_new_isolate() const
 {
 	v8::Isolate::CreateParams parameters;
 	
-	parameters.array_buffer_allocator = &_allocator;
+	parameters.array_buffer_allocator = _allocator.get();
 	
 	// Isolated JavaScript Virtual Environment
 	return v8::Isolate::New(parameters);
@@ -266,48 +1351,224 @@ v8::Local<v8::Value> Latex::_run(const std::string& source,
 {
 	v8::EscapableHandleScope handle_scope(_isolate);
 	
+	v8::Local<v8::Value> result;
+	
+	Error error;
+	
+	if (! _try_run(source, context, result, error))
+	{
+		throw ParseException(error.message);
+	}
+	
+	// Allows us to return local-scope objects to the outside scope
+	return handle_scope.Escape(result);
+}
+
+bool Latex::_try_run(const std::string& source,
+					 const v8::Local<v8::Context>& context,
+					 v8::Local<v8::Value>& result,
+					 Error& error) const
+{
+	v8::EscapableHandleScope handle_scope(_isolate);
+	
 	auto unchecked = v8::String::NewFromUtf8(_isolate,
 											 source.c_str(),
-											 v8::NewStringType::kNormal);
+											 v8::NewStringType::kNormal,
+											 static_cast<int>(source.size()));
 	
 	auto checked = unchecked.ToLocalChecked();
-
-	// Compile the source code.
-	auto script = v8::Script::Compile(context, checked).ToLocalChecked();
 	
 	// V8 engine's try-catch mechanism
 	v8::TryCatch try_catch(_isolate);
 	
-	auto result = script->Run(context);
+	v8::Local<v8::Script> script;
 	
-	if (result.IsEmpty())
+	// Compile the source code.
+	if (! v8::Script::Compile(context, checked).ToLocal(&script))
 	{
-		// Grab last exception
-		auto exception = try_catch.Exception();
+		error = _error(try_catch.Exception(), context);
 		
-		std::string what = *static_cast<v8::String::Utf8Value>(exception);
+		return false;
+	}
+	
+	v8::Local<v8::Value> value;
+	
+	if (! script->Run(context).ToLocal(&value))
+	{
+		error = _error(try_catch.Exception(), context);
 		
-		// Remove the 'ParseError' (redundant)
-		throw ParseException(what.substr(12));
+		return false;
 	}
 	
-	// Allows us to return local-scope objects to the outside scope
-	return handle_scope.Escape(result.ToLocalChecked());
+	result = handle_scope.Escape(value);
+	
+	return true;
 }
 
-std::string Latex::_escape(std::string source) const
+Latex::Error Latex::_error(const v8::Local<v8::Value>& exception,
+						   const v8::Local<v8::Context>& context) const
 {
-	for (auto i = source.begin(); i != source.end(); ++i)
+	Error error;
+	
+	error.kind = ErrorKind::Engine;
+	
+	v8::Local<v8::Object> object;
+	
+	if (! exception->IsObject() || ! exception->ToObject(context).ToLocal(&object))
+	{
+		error.message = *v8::String::Utf8Value(exception);
+		
+		return error;
+	}
+	
+	auto property = [&] (const char* name)
 	{
-		if (*i == '\\')
+		auto key = v8::String::NewFromUtf8(_isolate,
+										   name,
+										   v8::NewStringType::kInternalized);
+		
+		v8::Local<v8::Value> value;
+		
+		if (! object->Get(context, key.ToLocalChecked()).ToLocal(&value))
 		{
-			i = source.insert(i, '\\');
-			
-			++i;
+			return v8::Local<v8::Value>();
 		}
+		
+		return value;
+	};
+	
+	auto name = property("name");
+	
+	if (! name.IsEmpty() && name->IsString())
+	{
+		std::string type = *v8::String::Utf8Value(name);
+		
+		if (type == "ParseError") error.kind = ErrorKind::Parse;
+	}
+	
+	auto message = property("message");
+	
+	if (! message.IsEmpty() && message->IsString())
+	{
+		error.message = *v8::String::Utf8Value(message);
+	}
+	
+	else error.message = *v8::String::Utf8Value(exception);
+	
+	auto position = property("position");
+	
+	if (! position.IsEmpty() && position->IsNumber())
+	{
+		error.position = position->Int32Value(context).FromMaybe(-1);
+	}
+	
+	return error;
+}
+
+Latex::Result Latex::_render(const std::string& latex,
+							 const v8::Local<v8::Context>& context) const
+{
+	static const std::string call = "katex.renderToString('";
+	
+	static const std::string arguments = "', {'displayMode': true});";
+	
+	// Per thread rather than per instance, so that renders don't share
+	// it; once grown to fit the longest equation, it stops allocating
+	static thread_local std::string source;
+	
+	source.assign(call);
+	
+	_escape(latex, source);
+	
+	source += arguments;
+	
+	Result result;
+	
+	v8::Local<v8::Value> value;
+	
+	if (_try_run(source, context, value, result.error))
+	{
+		wrap(value.As<v8::String>(), result.html);
+	}
+	
+	return result;
+}
+
+bool Latex::_render_natively(const std::string& latex, Result& result) const
+{
+	std::string html;
+	
+	if (! _fast_path || ! FastPath::render(latex, html)) return false;
+	
+	result.html = wrap(html);
+	
+	return true;
+}
+
+Latex::Metrics Latex::_measure(const std::string& html, double font_size) const
+{
+	// KaTeX emits <span class="strut" style="height:Hem;"></span> and
+	// <span class="strut bottom" style="height:..;vertical-align:-Dem;">
+	auto number = [&] (const std::string& key, std::size_t from) {
+		auto position = html.find(key, from);
+		
+		if (position == std::string::npos) return 0.0;
+		
+		return std::strtod(html.c_str() + position + key.size(), nullptr);
+	};
+	
+	Metrics metrics;
+	
+	auto strut = html.find("class=\"strut\"");
+	
+	auto bottom = html.find("class=\"strut bottom\"");
+	
+	if (strut != std::string::npos)
+	{
+		metrics.em.height = number("height:", strut);
+	}
+	
+	if (bottom != std::string::npos)
+	{
+		metrics.em.depth = -number("vertical-align:", bottom);
 	}
 	
-	return source;
+	metrics.em.baseline = metrics.em.height;
+	
+	metrics.em.width = FontMetrics::width(html, _katex_path + "/fonts");
+	
+	// The .katex class of the stylesheet sets font: 1.21em
+	auto px = font_size * 1.21;
+	
+	metrics.px.width = metrics.em.width * px;
+	metrics.px.height = metrics.em.height * px;
+	metrics.px.depth = metrics.em.depth * px;
+	metrics.px.baseline = metrics.em.baseline * px;
+	
+	return metrics;
+}
+
+void Latex::_escape(const std::string& source, std::string& output) const
+{
+	auto needed = output.size() + source.size() + source.size() / 8;
+	
+	// Before C++20, reserve() may also shrink
+	if (output.capacity() < needed) output.reserve(needed);
+	
+	for (auto character : source)
+	{
+		if (character == '\\' || character == '\'')
+		{
+			output += '\\';
+			
+			output += character;
+		}
+		
+		// Whitespace to KaTeX, but would end the JS string
+		else if (character == '\n' || character == '\r') output += ' ';
+		
+		else output += character;
+	}
 }
 
 void _throw(wkhtmltoimage_converter*, const char* message)
@@ -321,12 +1582,120 @@ void _log(wkhtmltoimage_converter*, const char* message)
 	std::clog << message << std::endl;
 }
 
+std::string Latex::_convert(const std::string& latex,
+							const std::string& filepath,
+							ImageFormat format,
+							Error* error) const
+{
+	Result result;
+	
+	std::string buffer;
+	
+	// Traced as expanded, like HTML calls, so replays need no macros
+	const auto& equation = _expand(latex, buffer, result.error);
+	
+	Recorder recorder(_trace,
+					  _recording,
+					  method(format),
+					  equation,
+					  *this);
+	
+	// The fast path could render the HTML before wkhtmltoimage is ready
+	_wait();
+	
+	// Images always come from the full markup. Expanding the expanded
+	// equation again finds no macros, so it is only a scan.
+	if (result) result = _try_to_html(equation);
+	
+	// Positions are in the expanded equation
+	if (&equation != &latex) result.error.position = -1;
+	
+	if (! result)
+	{
+		recorder.finished(result);
+		
+		if (! error) throw ParseException(result.error.message);
+		
+		*error = std::move(result.error);
+		
+		return std::string();
+	}
+	
+	auto data = _rasterize(_document(std::move(result), OutputMode::Full),
+						   filepath,
+						   format);
+	
+	recorder.succeeded();
+	
+	return data;
+}
+
+std::string Latex::_rasterize(const std::string& document,
+							  const std::string& filepath,
+							  ImageFormat format,
+							  const Settings& settings) const
+{
+	// Unique, so that concurrent conversions don't clobber each other. It
+	// lives in the working directory for the stylesheet path to resolve.
+	auto temp = boost::filesystem::unique_path("latexpp-%%%%-%%%%-%%%%.html");
+	
+	std::ofstream stream(temp.string());
+	
+	if (! stream) throw FileException("Could not open temporary file!");
+	
+	stream << document;
+	
+	stream.close();
+	
+	bool success = false;
+	
+	std::string data;
+	
+	// On the thread that initialized wkhtmltoimage, one at a time
+	Converter::instance().run([&] {
+		auto converter = _new_converter(temp.string(), filepath, format, settings);
+		
+		success = wkhtmltoimage_convert(converter) != 0;
+		
+		// Without an output file, wkhtmltoimage keeps the image in memory
+		if (success && filepath.empty())
+		{
+			const unsigned char* bytes;
+			
+			auto length = wkhtmltoimage_get_output(converter, &bytes);
+			
+			data.assign(reinterpret_cast<const char*>(bytes), length);
+		}
+		
+		wkhtmltoimage_destroy_converter(converter);
+	});
+	
+	boost::filesystem::remove(temp);
+	
+	if (! success)
+	{
+		throw ConversionException("Could not convert to image!");
+	}
+	
+	return data;
+}
+
 wkhtmltoimage_converter*
-Latex::_new_converter(const std::string& filepath, ImageFormat format) const
+Latex::_new_converter(const std::string& input,
+					  const std::string& filepath,
+					  ImageFormat format,
+					  const Settings& settings) const
 {
-	auto settings = _new_converter_settings(filepath, format);
+	auto global = _new_converter_settings(input, filepath, format);
+	
+	for (const auto& setting : settings)
+	{
+		wkhtmltoimage_set_global_setting(global,
+										 setting.first.c_str(),
+										 setting.second.c_str());
+	}
 	
-	auto converter = wkhtmltoimage_create_converter(settings, nullptr);
+	auto converter = wkhtmltoimage_create_converter(global, nullptr);
 	
 	wkhtmltoimage_set_error_callback(converter, _throw);
 	
@@ -344,8 +1713,9 @@ Latex::_new_converter(const std::string& filepath, ImageFormat format) const
 }
 
 wkhtmltoimage_global_settings*
-Latex::_new_converter_settings(const std::string& filepath,
-					 Latex::ImageFormat format) const
+Latex::_new_converter_settings(const std::string& input,
+							   const std::string& filepath,
+							   Latex::ImageFormat format) const
 {
 	auto settings = wkhtmltoimage_create_global_settings();
 	
@@ -355,7 +1725,7 @@ Latex::_new_converter_settings(const std::string& filepath,
 	
 	wkhtmltoimage_set_global_setting(settings,
 									 "in",
-									 "temp.html");
+									 input.c_str());
 	
 	wkhtmltoimage_set_global_setting(settings,
 									 "out",
@@ -9,13 +9,22 @@
 #ifndef LATEX_HPP
 #define LATEX_HPP
 
+#include <future>
 #include <memory>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <utility>
 #include <v8.h>
+#include <vector>
 
 class wkhtmltoimage_converter;
 class wkhtmltoimage_global_settings;
+class TraceWriter;
+class CompactHtml;
+class SharedCache;
+class Macros;
+class SpriteSheet;
 
 class Latex
 {
@@ -43,6 +52,40 @@ public:
 	***************************************************************************/
 	
 	enum class WarningBehavior { Strict, Ignore, Log };
+	
+	/***********************************************************************//*!
+	*
+	*	@brief How a Latex instance starts up.
+	*
+	*	@details With Loading::Blocking, the constructor returns once the
+	*			 V8 isolate is created and KaTeX is loaded. With
+	*			 Loading::Background, it returns immediately and this
+	*			 happens on a background thread; the first render that
+	*			 needs KaTeX (or the first image conversion) waits for it
+	*			 to finish and throws if it failed. Loading::WarmUp
+	*			 additionally renders a bundled corpus of representative
+	*			 equations in the background (see warm_up()).
+	*
+	***************************************************************************/
+	
+	enum class Loading { Blocking, Background, WarmUp };
+	
+	/***********************************************************************//*!
+	*
+	*	@brief The forms of HTML snippets.
+	*
+	*	@details OutputMode::Full is KaTeX's markup as it is. With
+	*			 OutputMode::Compact, the markup is rewritten to be about
+	*			 half as large (see CompactHtml), and must be served with
+	*			 compact_stylesheet() instead of the KaTeX stylesheet.
+	*			 OutputMode::MathML keeps only the MathML tree, as a
+	*			 <math xmlns="http://www.w3.org/1998/Math/MathML"
+	*			 display="block"> element, for consumers that render
+	*			 MathML natively; it needs no stylesheet.
+	*
+	***************************************************************************/
+	
+	enum class OutputMode { Full, Compact, MathML };
 
 	/***********************************************************************//*!
 	*
@@ -99,6 +142,99 @@ public:
 		{ }
 	};
 
+	/***********************************************************************//*!
+	*
+	*	@brief The kinds of errors reported by the non-throwing API.
+	*
+	*	@details ErrorKind::Parse signifies a KaTeX ParseError (i.e. invalid
+	*			 LaTeX), while ErrorKind::Engine signifies any other
+	*			 exception raised in the JavaScript environment.
+	*
+	***************************************************************************/
+	
+	enum class ErrorKind { None, Parse, Engine };
+	
+	/***********************************************************************//*!
+	*
+	*	@brief A structured error, built from the JavaScript exception object.
+	*
+	***************************************************************************/
+	
+	struct Error
+	{
+		/*! The kind of error, ErrorKind::None if there was none. */
+		ErrorKind kind = ErrorKind::None;
+		
+		/*! The error message (e.g. "KaTeX parse error: ..."). */
+		std::string message;
+		
+		/*! The character offset of the error in the LaTeX
+			snippet, or -1 if it is not known. */
+		int position = -1;
+	};
+	
+	/***********************************************************************//*!
+	*
+	*	@brief The result of a non-throwing render.
+	*
+	*	@details Holds either the rendered HTML snippet or, if the render
+	*			 failed, an Error describing why.
+	*
+	***************************************************************************/
+	
+	struct Result
+	{
+		/*! Whether or not the render succeeded. */
+		bool ok() const noexcept { return error.kind == ErrorKind::None; }
+		
+		/*! Equivalent to ok(). */
+		explicit operator bool() const noexcept { return ok(); }
+		
+		/*! The HTML snippet, empty if the render failed. */
+		std::string html;
+		
+		/*! The error, of kind ErrorKind::None if the render succeeded. */
+		Error error;
+	};
+
+	/***********************************************************************//*!
+	*
+	*	@brief The dimensions of a rendered equation in one unit.
+	*
+	***************************************************************************/
+	
+	struct Dimensions
+	{
+		/*! The horizontal extent of the equation. */
+		double width = 0;
+		
+		/*! The extent above the baseline. */
+		double height = 0;
+		
+		/*! The extent below the baseline. */
+		double depth = 0;
+		
+		/*! The distance from the top of the box to the baseline. */
+		double baseline = 0;
+	};
+	
+	/***********************************************************************//*!
+	*
+	*	@brief The layout metrics of a rendered equation.
+	*
+	*	@see measure()
+	*
+	***************************************************************************/
+	
+	struct Metrics
+	{
+		/*! The dimensions in ems of the (KaTeX) equation font. */
+		Dimensions em;
+		
+		/*! The dimensions in CSS pixels. */
+		Dimensions px;
+	};
+
 	/***********************************************************************//*!
 	*
 	*	@brief Constructs a Latex instance.
@@ -109,11 +245,22 @@ public:
 	*
 	*	@param behavior The warning behavior to use.
 	*
+	*	@param loading Whether to load KaTeX in the background.
+	*
+	*	@param allocator The allocator of V8 ArrayBuffers, or nullptr for
+	*		   one that takes every buffer from malloc(). It may be shared
+	*		   by instances on different threads if it is thread-safe (see
+	*		   PooledAllocator).
+	*
 	*	@see WarningBehavior
 	*
+	*	@see Loading
+	*
 	***************************************************************************/
 
-	Latex(WarningBehavior behavior = WarningBehavior::Log);
+	Latex(WarningBehavior behavior = WarningBehavior::Log,
+		  Loading loading = Loading::Blocking,
+		  std::shared_ptr<v8::ArrayBuffer::Allocator> allocator = nullptr);
 	
 	/***********************************************************************//*!
 	*
@@ -124,12 +271,21 @@ public:
 	*
 	*	@param behavior The warning behavior to use.
 	*
+	*	@param loading Whether to load KaTeX in the background.
+	*
+	*	@param allocator The allocator of V8 ArrayBuffers, or nullptr for
+	*		   one that takes every buffer from malloc().
+	*
 	*	@see WarningBehavior
 	*
+	*	@see Loading
+	*
 	***************************************************************************/
 	
 	Latex(const std::string& stylesheet,
-		  WarningBehavior behavior = WarningBehavior::Log);
+		  WarningBehavior behavior = WarningBehavior::Log,
+		  Loading loading = Loading::Blocking,
+		  std::shared_ptr<v8::ArrayBuffer::Allocator> allocator = nullptr);
 	
 	/***********************************************************************//*!
 	*
@@ -215,6 +371,59 @@ public:
 	
 	virtual std::string to_html(const std::string& latex) const;
 	
+	/***********************************************************************//*!
+	*
+	*	@brief Converts a batch of LaTeX snippets to HTML snippets.
+	*
+	*	@details The V8 isolate and context are entered only once for
+	*			 the entire batch.
+	*
+	*	@param equations The LaTeX snippets to render.
+	*
+	*	@return The HTML snippets, in the same order as the equations.
+	*
+	*	@see to_html()
+	*
+	*	@throws ParseException If the parsing of any latex snippet failed.
+	*
+	***************************************************************************/
+	
+	virtual std::vector<std::string>
+	to_html(const std::vector<std::string>& equations) const;
+	
+	/***********************************************************************//*!
+	*
+	*	@brief Converts a LaTeX snippet to an HTML snippet without throwing.
+	*
+	*	@details Invalid LaTeX does not raise a ParseException, but yields
+	*			 a Result whose error describes the problem, such that
+	*			 invalid input costs about as much as valid input.
+	*
+	*	@param latex The LaTeX snippet to render.
+	*
+	*	@return A Result holding either the HTML snippet or an Error.
+	*
+	*	@see to_html()
+	*
+	***************************************************************************/
+	
+	virtual Result try_to_html(const std::string& latex) const;
+	
+	/***********************************************************************//*!
+	*
+	*	@brief Converts a batch of LaTeX snippets without throwing.
+	*
+	*	@param equations The LaTeX snippets to render.
+	*
+	*	@return One Result per equation, in the same order as the equations.
+	*
+	*	@see try_to_html()
+	*
+	***************************************************************************/
+	
+	virtual std::vector<Result>
+	try_to_html(const std::vector<std::string>& equations) const;
+	
 	/***********************************************************************//*!
 	*
 	*	@brief Converts a LaTeX snippet to a complete, valid HTML document.
@@ -231,6 +440,53 @@ public:
 	
 	virtual std::string to_complete_html(const std::string& latex) const;
 	
+	/***********************************************************************//*!
+	*
+	*	@brief Computes the layout metrics of a LaTeX snippet.
+	*
+	*	@details Height and depth are those computed by KaTeX itself, the
+	*			 width is computed natively from the metrics of the bundled
+	*			 fonts. Nothing is rasterized, so this costs about as much
+	*			 as to_html(). Pixel values assume the KaTeX stylesheet,
+	*			 which scales equations to 1.21 times the surrounding text.
+	*
+	*	@param latex The LaTeX snippet to measure.
+	*
+	*	@param font_size The font-size of the surrounding text, in pixels.
+	*
+	*	@return The dimensions of the equation in em and px.
+	*
+	*	@throws ParseException If the parsing of the latex snippet failed.
+	*
+	*	@throws FileException If a KaTeX font could not be read.
+	*
+	***************************************************************************/
+	
+	virtual Metrics measure(const std::string& latex,
+							double font_size = 16) const;
+	
+	/***********************************************************************//*!
+	*
+	*	@brief Computes the layout metrics of a batch of LaTeX snippets.
+	*
+	*	@param equations The LaTeX snippets to measure.
+	*
+	*	@param font_size The font-size of the surrounding text, in pixels.
+	*
+	*	@return The metrics, in the same order as the equations.
+	*
+	*	@see measure()
+	*
+	*	@throws ParseException If the parsing of any latex snippet failed.
+	*
+	*	@throws FileException If a KaTeX font could not be read.
+	*
+	***************************************************************************/
+	
+	virtual std::vector<Metrics>
+	measure(const std::vector<std::string>& equations,
+			double font_size = 16) const;
+	
 	/***********************************************************************//*!
 	*
 	*	@brief Converts a LaTeX snippet to an image.
@@ -241,6 +497,11 @@ public:
 	*
 	*	@param format Which image format to output as.
 	*
+	*	@details Image conversions run one at a time, process-wide, on
+	*			 the one thread that initialized wkhtmltoimage, as the
+	*			 library is built on Qt and is not thread-safe. Only the
+	*			 HTML render before it runs on the calling thread.
+	*
 	*	@return	An image of the format specified by the format argument.
 	*
 	*	@throws ParseException If the parsing of the latex snippet failed.
@@ -256,6 +517,166 @@ public:
 					   const std::string& filepath,
 					   ImageFormat format) const;
 	
+	/***********************************************************************//*!
+	*
+	*	@brief Converts a LaTeX snippet to an image held in memory.
+	*
+	*	@param latex The LaTeX snippet to render.
+	*
+	*	@param format Which image format to output as.
+	*
+	*	@return	The bytes of the image, in the format given.
+	*
+	*	@see to_image()
+	*
+	*	@throws ParseException If the parsing of the latex snippet failed.
+	*
+	*	@throws ConversionException If the conversion of the latex snippet
+	*							    to an image failed.
+	*
+	*	@throws FileException If a temporary helper file could not be opened.
+	*
+	***************************************************************************/
+	
+	virtual std::string to_image_data(const std::string& latex,
+									  ImageFormat format) const;
+	
+	/***********************************************************************//*!
+	*
+	*	@brief Converts a LaTeX snippet to an image held in memory,
+	*		   reporting invalid LaTeX instead of throwing.
+	*
+	*	@details The snippet is rendered once: if it is invalid, the
+	*			 error (with its position, see try_to_html()) is returned,
+	*			 else the image is made from that same render.
+	*
+	*	@param latex The LaTeX snippet to render.
+	*
+	*	@param format Which image format to output as.
+	*
+	*	@param data Set to the bytes of the image, or emptied if the
+	*		   snippet is invalid.
+	*
+	*	@return The error, of kind ErrorKind::None if the image was made.
+	*
+	*	@throws ConversionException If the conversion of the latex snippet
+	*							    to an image failed.
+	*
+	*	@throws FileException If a temporary helper file could not be opened.
+	*
+	***************************************************************************/
+	
+	virtual Error try_to_image_data(const std::string& latex,
+									ImageFormat format,
+									std::string& data) const;
+	
+	/***********************************************************************//*!
+	*
+	*	@brief Converts a batch of LaTeX snippets to images held in memory.
+	*
+	*	@details The images are the same as those of to_image_data() for
+	*			 each equation, whole pages, and go through the cache and
+	*			 the trace alike. For many PNGs trimmed to their equation,
+	*			 use to_sprite_sheet(), which rasterizes them all at once.
+	*
+	*	@param equations The LaTeX snippets to render.
+	*
+	*	@param format Which image format to output as.
+	*
+	*	@return The bytes of the images, in the order of the equations.
+	*
+	*	@throws ParseException If the parsing of any latex snippet failed.
+	*
+	*	@throws ConversionException If the conversion to images failed.
+	*
+	*	@throws FileException If a temporary helper file could not be opened.
+	*
+	***************************************************************************/
+	
+	virtual std::vector<std::string>
+	to_image_data(const std::vector<std::string>& equations,
+				  ImageFormat format) const;
+	
+	/***********************************************************************//*!
+	*
+	*	@brief Converts a render to images held in memory, one per format.
+	*
+	*	@details For when the HTML is wanted along with the images: they
+	*			 are made from the render instead of rendering the snippet
+	*			 again, each the same as to_image_data() would make. With
+	*			 no snippet to key on, they bypass the cache and the trace.
+	*
+	*	@param result A render of try_to_html() in OutputMode::Full (the
+	*		   default), as images need the full markup.
+	*
+	*	@param formats Which image formats to output as.
+	*
+	*	@return The bytes of the images, in the order of the formats.
+	*
+	*	@throws ParseException If the result is an error.
+	*
+	*	@throws ConversionException If the conversion to an image failed.
+	*
+	*	@throws FileException If a temporary helper file could not be opened.
+	*
+	***************************************************************************/
+	
+	virtual std::vector<std::string>
+	to_image_data(const Result& result,
+				  const std::vector<ImageFormat>& formats) const;
+	
+	/***********************************************************************//*!
+	*
+	*	@brief Rasterizes a batch of LaTeX snippets onto one sprite sheet.
+	*
+	*	@details The equations are laid out in rows on one page, using
+	*			 their measure()d sizes plus some room for error, and the
+	*			 page is rasterized once. The sheet then knows where each
+	*			 equation ended up, from the pixels. Its image and the
+	*			 manifest of sprite coordinates can be served as they are,
+	*			 or the sprites cut out one by one. Sheets are at least
+	*			 2048 pixels wide, so keep batches to a few hundred
+	*			 equations. Where the estimate fell short and equations
+	*			 were clipped (see SpriteSheet::clipped()), the page is
+	*			 rasterized again with twice the room for them, up to
+	*			 three times in all.
+	*
+	*	@param equations The LaTeX snippets to render.
+	*
+	*	@return The sprite sheet (see sprite_sheet.hpp).
+	*
+	*	@throws ParseException If the parsing of any latex snippet failed.
+	*
+	*	@throws ConversionException If the conversion to an image failed.
+	*
+	*	@throws FileException If a temporary helper file or a KaTeX font
+	*			could not be opened.
+	*
+	***************************************************************************/
+	
+	virtual SpriteSheet to_sprite_sheet(const std::vector<std::string>& equations) const;
+	
+	/***********************************************************************//*!
+	*
+	*	@brief Rasterizes a batch of renders onto one sprite sheet.
+	*
+	*	@details As to_sprite_sheet() of their snippets, without rendering
+	*			 them again.
+	*
+	*	@param results Renders of try_to_html() in OutputMode::Full (the
+	*		   default), as sprites need the full markup.
+	*
+	*	@throws ParseException If any result is an error.
+	*
+	*	@throws ConversionException If the conversion to an image failed.
+	*
+	*	@throws FileException If a temporary helper file or a KaTeX font
+	*			could not be opened.
+	*
+	***************************************************************************/
+	
+	virtual SpriteSheet to_sprite_sheet(const std::vector<Result>& results) const;
+	
 	/***********************************************************************//*!
 	*
 	*	@brief Converts a LaTeX snippet to a PNG image.
@@ -401,9 +822,332 @@ public:
 	
 	virtual void warning_behavior(WarningBehavior behavior);
 	
+	/***********************************************************************//*!
+	*
+	*	@brief Returns whether trivial equations bypass KaTeX.
+	*
+	*	@see fast_path(bool)
+	*
+	***************************************************************************/
+	
+	virtual bool fast_path() const;
+	
+	/***********************************************************************//*!
+	*
+	*	@brief Enables or disables the native fast path.
+	*
+	*	@details When enabled (the default), equations such as x, 42,
+	*			 \\alpha or x_i^2 are rendered natively (see FastPath)
+	*			 to the same markup KaTeX produces, without entering V8.
+	*
+	*	@param enabled Whether to use the fast path.
+	*
+	***************************************************************************/
+	
+	virtual void fast_path(bool enabled);
+	
+	/***********************************************************************//*!
+	*
+	*	@brief Returns the form of HTML snippets.
+	*
+	***************************************************************************/
+	
+	virtual OutputMode output_mode() const;
+	
+	/***********************************************************************//*!
+	*
+	*	@brief Sets the form of HTML snippets.
+	*
+	*	@details Applies to to_html(), try_to_html() and to_complete_html(),
+	*			 which embeds compact_stylesheet() in compact mode and no
+	*			 KaTeX stylesheet in MathML mode. Images and metrics are
+	*			 the same in every mode.
+	*
+	*	@param mode The new output mode.
+	*
+	***************************************************************************/
+	
+	virtual void output_mode(OutputMode mode);
+	
+	/***********************************************************************//*!
+	*
+	*	@brief Returns the CSS compact snippets must be served with.
+	*
+	*	@details This is the base stylesheet (see stylesheet()) and the
+	*			 additional CSS, rewritten to the classes of compact markup.
+	*			 Relative font URLs are rebased onto the directory of
+	*			 stylesheet().
+	*
+	*	@throws FileException If the base stylesheet could not be read.
+	*
+	***************************************************************************/
+	
+	virtual std::string compact_stylesheet() const;
+	
+	/***********************************************************************//*!
+	*
+	*	@brief Starts (or stops) capturing calls into a trace.
+	*
+	*	@details Every HTML and image render is recorded with its
+	*			 equation, method, CSS, start time, latency and outcome.
+	*			 Equations are recorded with their macros expanded (see
+	*			 define()), so traces replay without the macros.
+	*			 Renders nested in another render (such as the HTML
+	*			 render of an image render) are not recorded separately.
+	*			 See tools/replay to play a trace back. The same writer
+	*			 may be shared by several engines.
+	*
+	*	@param trace The trace to write to, or nullptr to stop capturing.
+	*
+	***************************************************************************/
+	
+	virtual void capture(std::shared_ptr<TraceWriter> trace);
+	
+	/***********************************************************************//*!
+	*
+	*	@brief Returns the trace calls are captured into, if any.
+	*
+	***************************************************************************/
+	
+	virtual const std::shared_ptr<TraceWriter>& capture() const;
+	
+	/***********************************************************************//*!
+	*
+	*	@brief Starts (or stops) using a cache shared with other processes.
+	*
+	*	@details HTML snippets (in the current output mode) and SVG images
+	*			 are looked up in the cache before rendering and stored in
+	*			 it after. Entries are keyed by the canonical form of the
+	*			 equation (see Canonical) and everything else the output
+	*			 depends on, so a hit may carry the TeX annotation of
+	*			 another spelling. Failed renders are not cached. Cache
+	*			 hits are not captured in traces.
+	*
+	*	@param cache The cache to use, or nullptr to stop using one.
+	*
+	***************************************************************************/
+	
+	virtual void cache(std::shared_ptr<SharedCache> cache);
+	
+	/***********************************************************************//*!
+	*
+	*	@brief Returns the shared cache in use, if any.
+	*
+	***************************************************************************/
+	
+	virtual const std::shared_ptr<SharedCache>& cache() const;
+	
+	/***********************************************************************//*!
+	*
+	*	@brief Adds macro definitions, expanded in every equation.
+	*
+	*	@details The preamble holds \\newcommand, \\renewcommand,
+	*			 \\providecommand and \\def commands (see Macros). Macros
+	*			 are expanded natively before an equation reaches KaTeX,
+	*			 so traces capture the expanded equation, and error
+	*			 positions are unknown (-1) for equations with macros.
+	*			 Other instances sharing the same macros keep them as
+	*			 they were.
+	*
+	*	@param preamble The definitions.
+	*
+	*	@throws ParseException If the preamble is malformed.
+	*
+	***************************************************************************/
+	
+	virtual void define(const std::string& preamble);
+	
+	/***********************************************************************//*!
+	*
+	*	@brief Sets the macros expanded in every equation.
+	*
+	*	@param macros The macros, which may be shared by several
+	*		   instances, or nullptr for none.
+	*
+	***************************************************************************/
+	
+	virtual void macros(std::shared_ptr<const Macros> macros);
+	
+	/***********************************************************************//*!
+	*
+	*	@brief Returns the macros expanded in every equation, if any.
+	*
+	***************************************************************************/
+	
+	virtual const std::shared_ptr<const Macros>& macros() const;
+	
+	/***********************************************************************//*!
+	*
+	*	@brief Renders a bundled corpus of representative equations.
+	*
+	*	@details V8 compiles KaTeX's hot functions only after they have
+	*			 run a number of times, so the first few hundred renders
+	*			 of a fresh instance are slower. Warming up gets this out
+	*			 of the way before real traffic arrives. The corpus is
+	*			 rendered through KaTeX, bypassing the fast path, and is
+	*			 not captured.
+	*
+	*	@param rounds How many times to render the corpus.
+	*
+	***************************************************************************/
+	
+	virtual void warm_up(std::size_t rounds = 8) const;
+	
+	/***********************************************************************//*!
+	*
+	*	@brief Returns whether KaTeX has been loaded (or failed to load).
+	*
+	*	@details Always true unless constructed with background loading.
+	*
+	***************************************************************************/
+	
+	virtual bool ready() const;
+	
 	
 protected:
 
+	/***********************************************************************//*!
+	*
+	*	@brief Creates the isolate and loads KaTeX into a new context.
+	*
+	*	@details Runs in the constructor or on the background thread.
+	*
+	***************************************************************************/
+	
+	virtual void _start();
+	
+	/***********************************************************************//*!
+	*
+	*	@brief Registers with wkhtmltoimage, initializing it for the first
+	*		   instance.
+	*
+	*	@details Runs in the constructor, never on the background thread.
+	*			 wkhtmltoimage is initialized on the thread that makes all
+	*			 conversions, which outlives the background loaders.
+	*
+	***************************************************************************/
+	
+	virtual void _register();
+	
+	/***********************************************************************//*!
+	*
+	*	@brief Waits for a background start to finish.
+	*
+	*	@throws Any exception thrown while starting up in the background.
+	*
+	***************************************************************************/
+	
+	virtual void _wait() const;
+	
+	/***********************************************************************//*!
+	*
+	*	@brief Renders the warm-up corpus, without waiting for the start.
+	*
+	***************************************************************************/
+	
+	virtual void _warm_up(std::size_t rounds) const;
+	
+	/***********************************************************************//*!
+	*
+	*	@brief Expands the macros in an equation.
+	*
+	*	@param latex The equation.
+	*
+	*	@param buffer Holds the expanded equation, if it had any macro.
+	*
+	*	@param error Set to the error if the expansion failed.
+	*
+	*	@return Either latex or buffer.
+	*
+	***************************************************************************/
+	
+	virtual const std::string& _expand(const std::string& latex,
+									   std::string& buffer,
+									   Error& error) const;
+	
+	/***********************************************************************//*!
+	*
+	*	@brief Renders a LaTeX snippet to full KaTeX markup.
+	*
+	*	@details try_to_html() without the output mode applied.
+	*
+	***************************************************************************/
+	
+	virtual Result _try_to_html(const std::string& latex) const;
+	
+	/***********************************************************************//*!
+	*
+	*	@brief Renders a batch of LaTeX snippets to full KaTeX markup.
+	*
+	***************************************************************************/
+	
+	virtual std::vector<Result>
+	_try_to_html(const std::vector<std::string>& equations) const;
+	
+	/***********************************************************************//*!
+	*
+	*	@brief Brings a successful result into an output mode.
+	*
+	*	@details The bundled KaTeX always builds the HTML tree along with
+	*			 the MathML tree, so MathML mode cuts it out afterwards.
+	*
+	***************************************************************************/
+	
+	virtual void _output(Result& result, OutputMode mode) const;
+	
+	/***********************************************************************//*!
+	*
+	*	@brief Renders a LaTeX snippet to a complete HTML document.
+	*
+	*	@param latex The LaTeX snippet to render.
+	*
+	*	@param mode The output mode of the snippet in the document.
+	*
+	*	@throws ParseException If the parsing of the latex snippet failed.
+	*
+	***************************************************************************/
+	
+	virtual std::string _document(const std::string& latex, OutputMode mode) const;
+	
+	/***********************************************************************//*!
+	*
+	*	@brief Builds a complete HTML document around a successful render.
+	*
+	*	@param result The render, in full markup.
+	*
+	*	@param mode The output mode of the snippet in the document.
+	*
+	***************************************************************************/
+	
+	virtual std::string _document(Result result, OutputMode mode) const;
+	
+	/***********************************************************************//*!
+	*
+	*	@brief Converts a LaTeX snippet to an image, through the cache.
+	*
+	*	@param filepath The file to write to, or empty to return the data.
+	*
+	*	@param error If given, set to the error of an invalid snippet
+	*		   instead of throwing ParseException.
+	*
+	***************************************************************************/
+	
+	virtual std::string _image(const std::string& latex,
+							   const std::string& filepath,
+							   ImageFormat format,
+							   Error* error = nullptr) const;
+	
+	/***********************************************************************//*!
+	*
+	*	@brief Returns the compactor for the current base stylesheet
+	*		   and additional CSS.
+	*
+	*	@throws FileException If the base stylesheet could not be read.
+	*
+	***************************************************************************/
+	
+	virtual const CompactHtml& _compactor() const;
+	
 	/***********************************************************************//*!
 	*
 	*	@brief Attempts to find the KaTeX directory.
@@ -456,6 +1200,8 @@ protected:
 	*
 	*	@brief An ArrayBuffer allocator subclass required by the V8 engine.
 	*
+	*	@details The default, unless another one is passed to a constructor.
+	*
 	***************************************************************************/
 	
 	struct Allocator : public v8::ArrayBuffer::Allocator
@@ -513,6 +1259,93 @@ protected:
 	virtual v8::Local<v8::Value> _run(const std::string& source,
 							  	      const v8::Local<v8::Context>& context) const;
 	
+	/***********************************************************************//*!
+	*
+	*	@brief Compiles and executes JavaScript code without throwing.
+	*
+	*	@param source The JavaScript source-code to execute.
+	*
+	*	@param context The context in which to compile and execute the code.
+	*
+	*	@param result Set to the return value of the execution on success.
+	*
+	*	@param error Set to the structured error on failure.
+	*
+	*	@return True if the code ran without exception, else false.
+	*
+	***************************************************************************/
+	
+	virtual bool _try_run(const std::string& source,
+						  const v8::Local<v8::Context>& context,
+						  v8::Local<v8::Value>& result,
+						  Error& error) const;
+	
+	/***********************************************************************//*!
+	*
+	*	@brief Builds a structured Error from a JavaScript exception object.
+	*
+	*	@details Reads the 'name', 'message' and 'position' properties
+	*			 KaTeX sets on its ParseError objects, rather than parsing
+	*			 the stringified exception.
+	*
+	*	@param exception The exception caught by a v8::TryCatch.
+	*
+	*	@param context The context in which the exception was raised.
+	*
+	*	@return The structured Error.
+	*
+	***************************************************************************/
+	
+	virtual Error _error(const v8::Local<v8::Value>& exception,
+						 const v8::Local<v8::Context>& context) const;
+	
+	/***********************************************************************//*!
+	*
+	*	@brief Renders a LaTeX snippet in an already-entered context.
+	*
+	*	@param latex The LaTeX snippet to render.
+	*
+	*	@param context The (entered) context holding the KaTeX library.
+	*
+	*	@return A Result holding either the HTML snippet or an Error.
+	*
+	***************************************************************************/
+	
+	virtual Result _render(const std::string& latex,
+						   const v8::Local<v8::Context>& context) const;
+	
+	/***********************************************************************//*!
+	*
+	*	@brief Renders a LaTeX snippet natively, if the fast path is
+	*		   enabled and the snippet is simple enough.
+	*
+	*	@param latex The LaTeX snippet to render.
+	*
+	*	@param result Set to the HTML snippet on success.
+	*
+	*	@return True if rendered, false if the snippet needs KaTeX.
+	*
+	***************************************************************************/
+	
+	virtual bool _render_natively(const std::string& latex, Result& result) const;
+	
+	/***********************************************************************//*!
+	*
+	*	@brief Computes the layout metrics of a rendered HTML snippet.
+	*
+	*	@details Reads height and depth from the struts KaTeX emits and
+	*			 lays out the markup natively for the width.
+	*
+	*	@param html An HTML snippet as returned by to_html().
+	*
+	*	@param font_size The font-size of the surrounding text, in pixels.
+	*
+	*	@return The dimensions of the equation in em and px.
+	*
+	***************************************************************************/
+	
+	virtual Metrics _measure(const std::string& html, double font_size) const;
+	
 	/***********************************************************************//*!
 	*
 	*	@brief Escapes the backslashes in LaTeX source for rendering.
@@ -522,32 +1355,93 @@ protected:
 	*			 backlashes then have to again be escaped for the JavaScript
 	*			 source (as they are simply backslashes for the JS
 	*			 environment otherwise, which initiate escape sequences).
+	*			 For the same reason, quotes (e.g. in f') and line breaks
+	*			 are escaped, as they would otherwise end the JS string.
+	*
+	*	@param source The LaTeX string.
 	*
-	*	@return The escaped LaTeX string.
+	*	@param output The string the escaped LaTeX is appended to.
 	*
 	***************************************************************************/
 	
-	virtual std::string _escape(std::string source) const;
+	virtual void _escape(const std::string& source, std::string& output) const;
+	
+	/***********************************************************************//*!
+	*
+	*	@brief Converts a LaTeX snippet to an image file or to memory.
+	*
+	*	@param latex The LaTeX snippet to render.
+	*
+	*	@param filepath The output file, or an empty string to
+	*					return the image from memory instead.
+	*
+	*	@param format The image-format to convert to.
+	*
+	*	@param error If given, set to the error of an invalid snippet
+	*		   instead of throwing ParseException.
+	*
+	*	@return The image bytes if filepath is empty, else an empty string.
+	*
+	***************************************************************************/
+	
+	virtual std::string _convert(const std::string& latex,
+								 const std::string& filepath,
+								 ImageFormat format,
+								 Error* error = nullptr) const;
+	
+	/*! wkhtmltoimage global settings, as names and values. */
+	using Settings = std::vector<std::pair<std::string, std::string>>;
+	
+	/***********************************************************************//*!
+	*
+	*	@brief Rasterizes a complete HTML document.
+	*
+	*	@param document The HTML document.
+	*
+	*	@param filepath The output file, or an empty string to
+	*					return the image from memory instead.
+	*
+	*	@param format The image-format to convert to.
+	*
+	*	@param settings Global settings overriding the defaults.
+	*
+	*	@return The image bytes if filepath is empty, else an empty string.
+	*
+	***************************************************************************/
+	
+	virtual std::string _rasterize(const std::string& document,
+								   const std::string& filepath,
+								   ImageFormat format,
+								   const Settings& settings = Settings()) const;
 	
 	/***********************************************************************//*!
 	*
 	*	@brief Requests, initializes and returns a wkhtmltoimage converter.
 	*
+	*	@param input The HTML file to convert.
+	*
 	*	@param filepath The output file at which to store the converted file.
 	*
 	*	@param format The image-format to convert to.
 	*
+	*	@param settings Global settings overriding the defaults.
+	*
 	*	@return A pointer to a wkhtmltoimage_converter instance.
 	*
 	***************************************************************************/
 	
 	virtual wkhtmltoimage_converter*
-	_new_converter(const std::string& filepath, ImageFormat format) const;
+	_new_converter(const std::string& input,
+				   const std::string& filepath,
+				   ImageFormat format,
+				   const Settings& settings = Settings()) const;
 
 	/***********************************************************************//*!
 	*
 	*	@brief Helper method of _new_converter to handle wkhtmltoimage settings.
 	*
+	*	@param input The HTML file to convert.
+	*
 	*	@param filepath The output file at which to store the converted file.
 	*
 	*	@param format The image-format to convert to.
@@ -557,7 +1451,8 @@ protected:
 	***************************************************************************/
 	
 	virtual wkhtmltoimage_global_settings*
-	_new_converter_settings(const std::string& filepath,
+	_new_converter_settings(const std::string& input,
+							const std::string& filepath,
 							ImageFormat format) const;
 	
 	/***********************************************************************//*!
@@ -582,8 +1477,9 @@ protected:
 	
 	friend void _log(wkhtmltoimage_converter*, const char* message);
 	
-	/*! A instance of the Allocator struct for the V8 engine. */
-	mutable Allocator _allocator;
+	/*! The allocator of the isolate's ArrayBuffers, as passed to the
+	    constructor and shared with copies of this instance. */
+	std::shared_ptr<v8::ArrayBuffer::Allocator> _allocator;
 
 	/*! The virtual environment in which the V8 runs. */
 	v8::Isolate* _isolate;
@@ -601,6 +1497,39 @@ protected:
 	
 	/*! The current WarningBehavior configuration. */
 	WarningBehavior _warning_behaviour;
+	
+	/*! Whether trivial equations are rendered natively. */
+	bool _fast_path;
+	
+	/*! The form of HTML snippets. */
+	OutputMode _output_mode;
+	
+	/*! Compacts markup, created when first needed and discarded
+	    when the base stylesheet or the additional CSS changes. */
+	mutable std::shared_ptr<const CompactHtml> _compact;
+	
+	/*! The trace calls are captured into, if any. */
+	std::shared_ptr<TraceWriter> _trace;
+	
+	/*! The cache shared with other processes, if any. */
+	std::shared_ptr<SharedCache> _cache;
+	
+	/*! The macros expanded in every equation, if any. */
+	std::shared_ptr<const Macros> _macros;
+	
+	/*! Whether a call is currently being recorded, to
+	    skip the calls nested in it. */
+	mutable bool _recording;
+	
+	/*! Whether this instance counts as a wkhtmltoimage user. */
+	bool _registered;
+	
+	/*! The thread starting the instance in the background, if any. */
+	std::thread _loader;
+	
+	/*! Becomes ready when the background start finished, invalid
+	    if the instance was started in the constructor. */
+	std::shared_future<void> _ready;
 };
 
 #endif /* LATEX_HPP */
\ No newline at end of file
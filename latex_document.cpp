@@ -0,0 +1,175 @@
+#include "latex_document.hpp"
+
+#include <functional>
+#include <unordered_set>
+
+LatexDocument::LatexDocument(const Latex& latex)
+: _latex(latex)
+{ }
+
+LatexDocument::Update
+LatexDocument::edit(const std::vector<Span>& spans,
+					const std::vector<std::string>& removed)
+{
+	Update update;
+
+	for (const auto& id : removed) _remove(id, update);
+
+	std::vector<Span> changed;
+
+	// Where a span is in changed, so that repeated ids render once
+	std::unordered_map<std::string, std::size_t> staged;
+
+	for (const auto& span : spans)
+	{
+		auto previous = staged.find(span.id);
+
+		if (previous != staged.end())
+		{
+			changed[previous->second] = span;
+		}
+
+		else if (_changed(span, std::hash<std::string>()(span.latex)))
+		{
+			staged.emplace(span.id, changed.size());
+
+			changed.push_back(span);
+		}
+	}
+
+	if (! changed.empty()) _render(changed, update);
+
+	return update;
+}
+
+LatexDocument::Update LatexDocument::sync(const std::vector<Span>& spans)
+{
+	std::unordered_set<std::string> ids;
+
+	for (const auto& span : spans) ids.insert(span.id);
+
+	std::vector<std::string> removed;
+
+	for (const auto& entry : _spans)
+	{
+		if (! ids.count(entry.first)) removed.push_back(entry.first);
+	}
+
+	return edit(spans, removed);
+}
+
+const Latex::Result& LatexDocument::fragment(const std::string& id) const
+{
+	return _spans.at(id).result;
+}
+
+bool LatexDocument::contains(const std::string& id) const
+{
+	return _spans.count(id);
+}
+
+std::size_t LatexDocument::size() const
+{
+	return _spans.size();
+}
+
+void LatexDocument::clear()
+{
+	_spans.clear();
+
+	_content.clear();
+}
+
+bool LatexDocument::_changed(const Span& span, std::size_t hash) const
+{
+	auto entry = _spans.find(span.id);
+
+	if (entry == _spans.end()) return true;
+
+	// Compare the hashes first, the strings only to rule out collisions
+	return entry->second.hash != hash || entry->second.latex != span.latex;
+}
+
+void LatexDocument::_render(const std::vector<Span>& spans, Update& update)
+{
+	std::vector<Entry> entries(spans.size());
+
+	std::vector<std::string> equations;
+
+	std::vector<std::size_t> indices;
+
+	for (std::size_t i = 0; i < spans.size(); ++i)
+	{
+		auto& entry = entries[i];
+
+		entry.latex = spans[i].latex;
+
+		entry.hash = std::hash<std::string>()(entry.latex);
+
+		// Pasted or moved content was rendered before, under another id
+		auto owner = _content.find(entry.hash);
+
+		if (owner != _content.end())
+		{
+			auto other = _spans.find(owner->second);
+
+			if (other != _spans.end() && other->second.latex == entry.latex)
+			{
+				entry.result = other->second.result;
+
+				continue;
+			}
+		}
+
+		equations.push_back(entry.latex);
+
+		indices.push_back(i);
+	}
+
+	// All at once, such that the engine's isolate is entered only once
+	auto results = _latex.try_to_html(equations);
+
+	for (std::size_t i = 0; i < indices.size(); ++i)
+	{
+		entries[indices[i]].result = std::move(results[i]);
+	}
+
+	update.changed.reserve(update.changed.size() + spans.size());
+
+	for (std::size_t i = 0; i < spans.size(); ++i)
+	{
+		const auto& id = spans[i].id;
+
+		auto& entry = entries[i];
+
+		auto existing = _spans.find(id);
+
+		if (existing != _spans.end())
+		{
+			auto owner = _content.find(existing->second.hash);
+
+			if (owner != _content.end() && owner->second == id) _content.erase(owner);
+		}
+
+		_content[entry.hash] = id;
+
+		update.changed.push_back({id, entry.result});
+
+		_spans[id] = std::move(entry);
+	}
+}
+
+void LatexDocument::_remove(const std::string& id, Update& update)
+{
+	auto entry = _spans.find(id);
+
+	if (entry == _spans.end()) return;
+
+	auto owner = _content.find(entry->second.hash);
+
+	if (owner != _content.end() && owner->second == id) _content.erase(owner);
+
+	_spans.erase(entry);
+
+	update.removed.push_back(id);
+}
@@ -0,0 +1,207 @@
+/********************************************************//*!
+*
+*	@file latex_document.hpp
+*
+*	@author Peter Goldsborough.
+*
+************************************************************/
+
+#ifndef LATEX_DOCUMENT_HPP
+#define LATEX_DOCUMENT_HPP
+
+#include "latex.hpp"
+
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/***************************************************************************//*!
+*
+*	@brief The rendered math of a document, kept up to date incrementally.
+*
+*	@details A live editor identifies every math span of its document by
+*			 a stable id and hands the document only the spans that
+*			 changed (or, if it can't tell, all of them). Only spans whose
+*			 content actually changed are rendered, in a single batch, and
+*			 content already rendered for another span is reused. The
+*			 cost of an update thus depends on the size of the edit, not
+*			 on the size of the document.
+*
+*			 A LatexDocument is not thread-safe, and uses the engine it
+*			 was constructed with from the calling thread.
+*
+*******************************************************************************/
+
+class LatexDocument
+{
+public:
+
+	/*! A math span of the document. */
+	struct Span
+	{
+		/*! An id that stays the same while the span is edited. */
+		std::string id;
+
+		/*! The span's LaTeX. */
+		std::string latex;
+	};
+
+	/*! The rendered form of a span. */
+	struct Fragment
+	{
+		std::string id;
+
+		/*! The HTML snippet, or the error if the span didn't render. */
+		Latex::Result result;
+	};
+
+	/*! The fragments to replace in (and remove from) a preview. */
+	struct Update
+	{
+		/*! Fragments that are new or whose content changed. */
+		std::vector<Fragment> changed;
+
+		/*! The ids of spans that no longer exist. */
+		std::vector<std::string> removed;
+
+		/*! Whether the preview needs no change at all. */
+		bool empty() const
+		{
+			return changed.empty() && removed.empty();
+		}
+	};
+
+	/***********************************************************************//*!
+	*
+	*	@brief Constructs an empty document.
+	*
+	*	@param latex The engine to render with, which must outlive
+	*				 the document.
+	*
+	***************************************************************************/
+
+	explicit LatexDocument(const Latex& latex);
+
+	/***********************************************************************//*!
+	*
+	*	@brief Applies an edit to the document.
+	*
+	*	@details Spans with a new id are added, spans with a known id are
+	*			 re-rendered only if their content differs. Spans that are
+	*			 not mentioned are left alone.
+	*
+	*	@param spans The spans that were added or may have changed.
+	*
+	*	@param removed The ids of spans that were deleted.
+	*
+	*	@return The fragments that changed.
+	*
+	***************************************************************************/
+
+	virtual Update edit(const std::vector<Span>& spans,
+						const std::vector<std::string>& removed = {});
+
+	/***********************************************************************//*!
+	*
+	*	@brief Brings the document in line with a complete list of spans.
+	*
+	*	@details For editors that can't tell what changed. Spans not in the
+	*			 list are removed; of the others, only those whose content
+	*			 differs are re-rendered.
+	*
+	*	@param spans All spans of the document.
+	*
+	*	@return The fragments that changed.
+	*
+	***************************************************************************/
+
+	virtual Update sync(const std::vector<Span>& spans);
+
+	/***********************************************************************//*!
+	*
+	*	@brief Returns the cached rendering of a span.
+	*
+	*	@throws std::out_of_range If there is no span with the id.
+	*
+	***************************************************************************/
+
+	virtual const Latex::Result& fragment(const std::string& id) const;
+
+	/***********************************************************************//*!
+	*
+	*	@brief Returns whether the document has a span with the given id.
+	*
+	***************************************************************************/
+
+	virtual bool contains(const std::string& id) const;
+
+	/***********************************************************************//*!
+	*
+	*	@brief Returns the number of spans in the document.
+	*
+	***************************************************************************/
+
+	virtual std::size_t size() const;
+
+	/***********************************************************************//*!
+	*
+	*	@brief Removes all spans.
+	*
+	***************************************************************************/
+
+	virtual void clear();
+
+protected:
+
+	/*! A span as rendered. */
+	struct Entry
+	{
+		/*! The hash of the content, to spot changes cheaply. */
+		std::size_t hash;
+
+		std::string latex;
+
+		Latex::Result result;
+	};
+
+	/***********************************************************************//*!
+	*
+	*	@brief Returns whether a span is new or its content changed.
+	*
+	***************************************************************************/
+
+	virtual bool _changed(const Span& span, std::size_t hash) const;
+
+	/***********************************************************************//*!
+	*
+	*	@brief Renders changed spans and records them in the document.
+	*
+	*	@param spans The changed spans, with distinct ids.
+	*
+	*	@param update The update to add the fragments to.
+	*
+	***************************************************************************/
+
+	virtual void _render(const std::vector<Span>& spans, Update& update);
+
+	/***********************************************************************//*!
+	*
+	*	@brief Removes a span, recording it in an update if it existed.
+	*
+	***************************************************************************/
+
+	virtual void _remove(const std::string& id, Update& update);
+
+	/*! The engine used for rendering. */
+	const Latex& _latex;
+
+	/*! The spans, by id. */
+	std::unordered_map<std::string, Entry> _spans;
+
+	/*! A span id for every content hash, to reuse renderings of
+	    the same content. Entries may be stale, and are verified. */
+	std::unordered_map<std::size_t, std::string> _content;
+};
+
+#endif /* LATEX_DOCUMENT_HPP */
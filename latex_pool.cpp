@@ -0,0 +1,232 @@
+#include "latex_pool.hpp"
+
+#include <algorithm>
+
+LatexPool::LatexPool(std::size_t engines, Latex::WarningBehavior behavior)
+: LatexPool(engines, [behavior] { return std::make_unique<Latex>(behavior); })
+{ }
+
+LatexPool::LatexPool(std::size_t engines, Factory factory)
+: _constructed(0)
+, _stopping(false)
+{
+	// hardware_concurrency() may return zero
+	if (engines == 0) engines = 1;
+
+	_lanes[static_cast<std::size_t>(Priority::Interactive)].limit = engines;
+
+	// Keep an engine free for interactive tasks, unless there's only one
+	_lanes[static_cast<std::size_t>(Priority::Bulk)].limit = std::max<std::size_t>(engines - 1, 1);
+
+	for (std::size_t i = 0; i < engines; ++i)
+	{
+		_workers.emplace_back([this, factory] { _work(factory); });
+	}
+
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	_ready.wait(lock, [this, engines] { return _constructed == engines; });
+
+	if (_failure)
+	{
+		_stopping = true;
+
+		lock.unlock();
+
+		_available.notify_all();
+
+		for (auto& worker : _workers) worker.join();
+
+		std::rethrow_exception(_failure);
+	}
+}
+
+LatexPool::~LatexPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		_stopping = true;
+	}
+
+	_available.notify_all();
+
+	for (auto& worker : _workers)
+	{
+		if (worker.joinable()) worker.join();
+	}
+}
+
+void LatexPool::post(Task task, Priority priority)
+{
+	post_batch([task = std::move(task)] (Latex& latex) {
+		task(latex);
+
+		return false;
+	}, priority);
+}
+
+void LatexPool::post_batch(Batch batch, Priority priority)
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		auto& lane = _lanes[static_cast<std::size_t>(priority)];
+
+		lane.queue.push_back({std::move(batch), std::chrono::steady_clock::now()});
+	}
+
+	// Not notify_one(), the woken worker may be blocked by the class' limit
+	_available.notify_all();
+}
+
+void LatexPool::limit(Priority priority, std::size_t engines)
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		_lanes[static_cast<std::size_t>(priority)].limit = std::max<std::size_t>(engines, 1);
+	}
+
+	_available.notify_all();
+}
+
+std::size_t LatexPool::limit(Priority priority) const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	return _lanes[static_cast<std::size_t>(priority)].limit;
+}
+
+LatexPool::Statistics LatexPool::statistics(Priority priority) const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	const auto& lane = _lanes[static_cast<std::size_t>(priority)];
+
+	auto statistics = lane.statistics;
+
+	statistics.queued = lane.queue.size();
+
+	return statistics;
+}
+
+std::size_t LatexPool::size() const
+{
+	return _workers.size();
+}
+
+std::size_t LatexPool::pending() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	std::size_t pending = 0;
+
+	for (const auto& lane : _lanes) pending += lane.queue.size();
+
+	return pending;
+}
+
+void LatexPool::_work(const Factory& factory)
+{
+	std::unique_ptr<Latex> latex;
+
+	try
+	{
+		latex = factory();
+	}
+
+	catch (...)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		if (! _failure) _failure = std::current_exception();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		++_constructed;
+	}
+
+	_ready.notify_one();
+
+	if (! latex) return;
+
+	while (true)
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+
+		Lane* lane = nullptr;
+
+		_available.wait(lock, [this, &lane] {
+			lane = _next();
+
+			auto idle = std::all_of(_lanes.begin(), _lanes.end(), [] (const Lane& other) {
+				return other.queue.empty();
+			});
+
+			return lane || (_stopping && idle);
+		});
+
+		// Drain the queues before shutting down
+		if (! lane) return;
+
+		auto entry = std::move(lane->queue.front());
+
+		lane->queue.pop_front();
+
+		auto& statistics = lane->statistics;
+
+		auto now = std::chrono::steady_clock::now();
+
+		auto wait = std::chrono::duration_cast<std::chrono::microseconds>(now - entry.queued);
+
+		++statistics.running;
+		++statistics.started;
+
+		statistics.total_wait += wait;
+		statistics.max_wait = std::max(statistics.max_wait, wait);
+
+		lock.unlock();
+
+		auto more = false;
+
+		try
+		{
+			more = entry.batch(*latex);
+		}
+
+		catch (...) { }
+
+		lock.lock();
+
+		--statistics.running;
+
+		// Requeue behind whatever arrived meanwhile: the batch boundary
+		if (more)
+		{
+			entry.queued = std::chrono::steady_clock::now();
+
+			lane->queue.push_back(std::move(entry));
+		}
+
+		lock.unlock();
+
+		// The freed engine slot may unblock a limited class
+		_available.notify_all();
+	}
+}
+
+LatexPool::Lane* LatexPool::_next()
+{
+	for (auto& lane : _lanes)
+	{
+		if (! lane.queue.empty() && lane.statistics.running < lane.limit)
+		{
+			return &lane;
+		}
+	}
+
+	return nullptr;
+}
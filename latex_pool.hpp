@@ -0,0 +1,296 @@
+/********************************************************//*!
+*
+*	@file latex_pool.hpp
+*
+*	@author Peter Goldsborough.
+*
+************************************************************/
+
+#ifndef LATEX_POOL_HPP
+#define LATEX_POOL_HPP
+
+#include "latex.hpp"
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+class LatexPool
+{
+public:
+
+	/*! A unit of work, executed with exclusive access to one engine. */
+	using Task = std::function<void(Latex&)>;
+
+	/*! A preemptible unit of work. Every call should do one chunk of
+		the work and return true while there is more left to do. */
+	using Batch = std::function<bool(Latex&)>;
+
+	/*! The scheduling class of a task. */
+	enum class Priority
+	{
+		/*! Latency-sensitive work, e.g. previews. Always scheduled first. */
+		Interactive,
+
+		/*! Background work, e.g. re-rendering a whole site. */
+		Bulk
+	};
+
+	/*! The state of one priority class' queue. */
+	struct Statistics
+	{
+		/*! The number of tasks waiting for an engine. */
+		std::size_t queued = 0;
+
+		/*! The number of tasks running on an engine. */
+		std::size_t running = 0;
+
+		/*! The number of tasks (or batch chunks) started so far. */
+		std::size_t started = 0;
+
+		/*! The total time started tasks spent waiting for an engine. */
+		std::chrono::microseconds total_wait{0};
+
+		/*! The longest time a started task waited for an engine. */
+		std::chrono::microseconds max_wait{0};
+	};
+
+	/*! Creates a Latex engine, called once on every worker thread. */
+	using Factory = std::function<std::unique_ptr<Latex>()>;
+
+	/***********************************************************************//*!
+	*
+	*	@brief Constructs a LatexPool with default-constructed engines.
+	*
+	*	@details Every engine is owned by exactly one worker thread, which
+	*			 also constructs it, such that each V8 isolate is only ever
+	*			 entered from a single thread. The constructor returns once
+	*			 all engines are ready.
+	*
+	*			 By default, interactive tasks may use all engines and bulk
+	*			 tasks all but one, such that an interactive task never
+	*			 waits for more than a free engine (see limit()).
+	*
+	*	@param engines The number of engines (and worker threads).
+	*
+	*	@param behavior The warning behavior of every engine.
+	*
+	*	@throws Any exception thrown while constructing an engine.
+	*
+	***************************************************************************/
+
+	explicit LatexPool(std::size_t engines = std::thread::hardware_concurrency(),
+					   Latex::WarningBehavior behavior = Latex::WarningBehavior::Log);
+
+	/***********************************************************************//*!
+	*
+	*	@brief Constructs a LatexPool with engines created by a factory.
+	*
+	*	@param engines The number of engines (and worker threads).
+	*
+	*	@param factory A callable returning a new engine, which is
+	*				   invoked once on every worker thread.
+	*
+	*	@throws Any exception thrown by the factory.
+	*
+	***************************************************************************/
+
+	LatexPool(std::size_t engines, Factory factory);
+
+	LatexPool(const LatexPool& other) = delete;
+
+	LatexPool& operator=(const LatexPool& other) = delete;
+
+	/***********************************************************************//*!
+	*
+	*	@brief Finishes all queued tasks and joins the worker threads.
+	*
+	***************************************************************************/
+
+	virtual ~LatexPool();
+
+	/***********************************************************************//*!
+	*
+	*	@brief Queues a callable to run on the next available engine.
+	*
+	*	@param function A callable taking a Latex&.
+	*
+	*	@return A future for the callable's return value (or exception).
+	*
+	***************************************************************************/
+
+	template<typename Function>
+	auto submit(Function function, Priority priority = Priority::Interactive)
+	-> std::future<typename std::result_of<Function(Latex&)>::type>
+	{
+		using Return = typename std::result_of<Function(Latex&)>::type;
+
+		// std::function needs a copyable target, packaged_task isn't
+		auto task = std::make_shared<std::packaged_task<Return(Latex&)>>(
+			std::move(function)
+		);
+
+		auto future = task->get_future();
+
+		post([task] (Latex& latex) { (*task)(latex); }, priority);
+
+		return future;
+	}
+
+	/***********************************************************************//*!
+	*
+	*	@brief Queues a task to run on the next available engine.
+	*
+	*	@details Unlike submit(), no future is created. The task must not
+	*			 throw; any exception escaping it is discarded.
+	*
+	*	@param task The task to run.
+	*
+	*	@param priority The task's priority class.
+	*
+	***************************************************************************/
+
+	virtual void post(Task task, Priority priority = Priority::Interactive);
+
+	/***********************************************************************//*!
+	*
+	*	@brief Queues a large job that can be preempted between chunks.
+	*
+	*	@details After every chunk, the batch goes to the back of its
+	*			 class' queue, so that waiting tasks (in particular
+	*			 interactive ones) get an engine at every chunk boundary.
+	*			 Chunks may run on different engines, but never
+	*			 concurrently. The batch must not throw; an exception
+	*			 escaping it is discarded and ends the batch.
+	*
+	*	@param batch The batch to run until it returns false.
+	*
+	*	@param priority The batch's priority class.
+	*
+	***************************************************************************/
+
+	virtual void post_batch(Batch batch, Priority priority = Priority::Bulk);
+
+	/***********************************************************************//*!
+	*
+	*	@brief Limits how many engines a priority class may use at once.
+	*
+	*	@param priority The priority class.
+	*
+	*	@param engines The maximum number of engines, at least one.
+	*
+	***************************************************************************/
+
+	virtual void limit(Priority priority, std::size_t engines);
+
+	/***********************************************************************//*!
+	*
+	*	@brief Returns how many engines a priority class may use at once.
+	*
+	***************************************************************************/
+
+	virtual std::size_t limit(Priority priority) const;
+
+	/***********************************************************************//*!
+	*
+	*	@brief Returns the queue depth and wait times of a priority class.
+	*
+	***************************************************************************/
+
+	virtual Statistics statistics(Priority priority) const;
+
+	/***********************************************************************//*!
+	*
+	*	@brief Returns the number of engines in the pool.
+	*
+	***************************************************************************/
+
+	virtual std::size_t size() const;
+
+	/***********************************************************************//*!
+	*
+	*	@brief Returns the number of tasks waiting for an engine,
+	*		   over all priority classes.
+	*
+	***************************************************************************/
+
+	virtual std::size_t pending() const;
+
+protected:
+
+	/***********************************************************************//*!
+	*
+	*	@brief The loop run by every worker thread.
+	*
+	*	@param factory The factory with which to construct the engine.
+	*
+	***************************************************************************/
+
+	virtual void _work(const Factory& factory);
+
+	/*! A queued batch (or task) and when it was queued. */
+	struct Entry
+	{
+		Batch batch;
+
+		std::chrono::steady_clock::time_point queued;
+	};
+
+	/*! The queue and accounting of one priority class. */
+	struct Lane
+	{
+		std::deque<Entry> queue;
+
+		std::size_t limit;
+
+		Statistics statistics;
+	};
+
+	/***********************************************************************//*!
+	*
+	*	@brief Returns the lane to take the next task from, if any.
+	*
+	*	@details Must be called with the mutex held.
+	*
+	***************************************************************************/
+
+	virtual Lane* _next();
+
+	/*! The worker threads, one per engine. */
+	std::vector<std::thread> _workers;
+
+	/*! The lanes, indexed by Priority. */
+	std::array<Lane, 2> _lanes;
+
+	/*! Guards the lanes and the fields below. */
+	mutable std::mutex _mutex;
+
+	/*! Signals new tasks (and shutdown) to the workers. */
+	std::condition_variable _available;
+
+	/*! Signals engine construction progress to the constructor. */
+	std::condition_variable _ready;
+
+	/*! The number of engines that finished construction. */
+	std::size_t _constructed;
+
+	/*! The first exception thrown while constructing an engine. */
+	std::exception_ptr _failure;
+
+	/*! Whether the pool is shutting down. */
+	bool _stopping;
+};
+
+#endif /* LATEX_POOL_HPP */
@@ -0,0 +1,707 @@
+#include "macros.hpp"
+#include "latex.hpp"
+
+#include <cstring>
+
+namespace
+{
+	bool is_letter(char c)
+	{
+		return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+	}
+
+	bool is_space(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+	}
+
+	/*! FNV-1a, which is the same in every process and build. */
+	std::uint64_t hash(const char* data,
+					   std::size_t size,
+					   std::uint64_t hash = 0xcbf29ce484222325ULL)
+	{
+		for (std::size_t i = 0; i < size; ++i)
+		{
+			hash ^= static_cast<unsigned char>(data[i]);
+			hash *= 0x100000001b3ULL;
+		}
+
+		return hash;
+	}
+
+	/*! Returns the end of the control sequence whose backslash is at i. */
+	const char* control_end(const char* i, const char* end)
+	{
+		auto finish = i + 1;
+
+		while (finish != end && is_letter(*finish)) ++finish;
+
+		// A control symbol like \, or \{ (or a trailing backslash)
+		if (finish == i + 1 && finish != end) ++finish;
+
+		return finish;
+	}
+
+	/*! Whether text ends in a control word, which a letter
+	    appended to it would become part of. */
+	bool ends_with_word(const char* begin, const char* end)
+	{
+		auto i = end;
+
+		while (i != begin && is_letter(i[-1])) --i;
+
+		if (i == end) return false;
+
+		std::size_t backslashes = 0;
+
+		for ( ; i != begin && i[-1] == '\\'; --i) ++backslashes;
+
+		return backslashes % 2 == 1;
+	}
+
+	/*! Appends text, separating it from a control word before it. */
+	void append(std::string& output,
+				const char* begin,
+				const char* end,
+				bool& after_word)
+	{
+		if (begin == end) return;
+
+		if (after_word && is_letter(*begin)) output += ' ';
+
+		output.append(begin, end);
+
+		after_word = ends_with_word(begin, end);
+	}
+
+	/*! Reads a preamble, reporting errors with their position. */
+	struct Reader
+	{
+		[[noreturn]] void fail(const std::string& message) const
+		{
+			throw Latex::ParseException("Macro preamble error: " + message +
+										" at position " +
+										std::to_string(i - begin));
+		}
+
+		/*! Skips whitespace and comments. */
+		void skip()
+		{
+			while (i != end)
+			{
+				if (*i == '%')
+				{
+					while (i != end && *i != '\n') ++i;
+				}
+
+				else if (is_space(*i)) ++i;
+
+				else break;
+			}
+		}
+
+		bool next(char c)
+		{
+			skip();
+
+			if (i == end || *i != c) return false;
+
+			++i;
+
+			return true;
+		}
+
+		std::string name()
+		{
+			skip();
+
+			if (i == end || *i != '\\') fail("Expected a macro name");
+
+			auto start = i;
+
+			i = control_end(i, end);
+
+			return std::string(start, i);
+		}
+
+		/*! Reads up to the closing delimiter of a group that was opened. */
+		std::string until(char close)
+		{
+			auto start = i;
+
+			int depth = 0;
+
+			for ( ; i != end; ++i)
+			{
+				if (*i == '\\')
+				{
+					if (i + 1 != end) ++i;
+				}
+
+				else if (*i == '{') ++depth;
+
+				else if (*i == '}' && depth > 0) --depth;
+
+				else if (*i == close && depth == 0) return std::string(start, i++);
+			}
+
+			fail(std::string("Missing ") + close);
+		}
+
+		const char* begin;
+
+		const char* i;
+
+		const char* end;
+	};
+}
+
+/*! The state of one expansion, a stack of the text being read. */
+struct Macros::Expander
+{
+	struct Frame
+	{
+		const char* i;
+
+		const char* end;
+	};
+
+	Expander(const Macros& macros_, std::string& output_)
+	: macros(macros_)
+	, output(output_)
+	{ }
+
+	[[noreturn]] void fail(const std::string& message) const
+	{
+		throw Latex::ParseException("Macro expansion error: " + message);
+	}
+
+	/*! Returns the next character, dropping the frames that
+	    were read entirely, or nullptr if all were. */
+	const char* peek()
+	{
+		while (! frames.empty())
+		{
+			if (frames.back().i != frames.back().end) return frames.back().i;
+
+			frames.pop_back();
+		}
+
+		return nullptr;
+	}
+
+	void skip_spaces()
+	{
+		for (auto c = peek(); c && is_space(*c); c = peek()) ++frames.back().i;
+	}
+
+	/*! Appends output, separating it from a control word before it. */
+	void emit(const char* begin, const char* end, bool word)
+	{
+		if (begin == end) return;
+
+		if (after_word && is_letter(*begin)) output += ' ';
+
+		output.append(begin, end);
+
+		after_word = word;
+	}
+
+	/*! Reads the rest of a group opened by a brace or bracket, which
+	    may span frames, into arguments. Returns false at the end. */
+	bool group(char close)
+	{
+		int depth = 0;
+
+		for (auto c = peek(); c; c = peek())
+		{
+			++frames.back().i;
+
+			if (*c == '\\')
+			{
+				arguments += *c;
+
+				if ((c = peek()))
+				{
+					arguments += *c;
+
+					++frames.back().i;
+				}
+
+				continue;
+			}
+
+			if (*c == close && depth == 0) return true;
+
+			if (*c == '{') ++depth;
+
+			else if (*c == '}') --depth;
+
+			arguments += *c;
+		}
+
+		return false;
+	}
+
+	/*! Reads an undelimited argument into arguments. */
+	void argument(const Macro& macro)
+	{
+		skip_spaces();
+
+		auto c = peek();
+
+		if (! c || *c == '}') fail("Missing argument for " + macro.name);
+
+		auto& frame = frames.back();
+
+		if (*c == '{')
+		{
+			++frame.i;
+
+			if (! group('}')) fail("Missing } in argument of " + macro.name);
+
+			return;
+		}
+
+		auto finish = c + 1;
+
+		if (*c == '\\') finish = control_end(c, frame.end);
+
+		// A whole UTF-8 character
+		else while (finish != frame.end && (*finish & 0xC0) == 0x80) ++finish;
+
+		arguments.append(c, finish);
+
+		frame.i = finish;
+	}
+
+	void call(const Macro& macro, bool word)
+	{
+		if (++expansions > macros._expansions)
+		{
+			fail("More than " + std::to_string(macros._expansions) +
+				 " expansions, at " + macro.name);
+		}
+
+		// TeX skips spaces after control words
+		if (word) skip_spaces();
+
+		arguments.clear();
+
+		std::size_t bounds[10] = {0};
+
+		unsigned parameter = 1;
+
+		if (macro.optional)
+		{
+			skip_spaces();
+
+			auto c = peek();
+
+			if (c && *c == '[')
+			{
+				++frames.back().i;
+
+				if (! group(']')) fail("Missing ] in argument of " + macro.name);
+			}
+
+			else arguments += macro.default_value;
+
+			bounds[parameter++] = arguments.size();
+		}
+
+		for ( ; parameter <= macro.parameters; ++parameter)
+		{
+			argument(macro);
+
+			bounds[parameter] = arguments.size();
+		}
+
+		// Drop finished frames first, so that a macro ending
+		// in another macro does not count as nesting
+		peek();
+
+		if (frames.size() >= macros._depth)
+		{
+			fail("Macros nested more than " + std::to_string(macros._depth) +
+				 " deep, at " + macro.name);
+		}
+
+		auto text = macro.text.data();
+
+		if (macro.parameters == 0)
+		{
+			frames.push_back({text, text + macro.text.size()});
+
+			return;
+		}
+
+		// Each frame substitutes into its own buffer, which is free
+		// again once the frame is done. Reserved, as frames point in
+		if (buffers.empty()) buffers.reserve(macros._depth);
+
+		while (buffers.size() <= frames.size()) buffers.emplace_back();
+
+		auto& buffer = buffers[frames.size()];
+
+		buffer.clear();
+
+		bool word_end = false;
+
+		for (const auto& segment : macro.segments)
+		{
+			append(buffer, text + segment.begin, text + segment.end, word_end);
+
+			if (segment.parameter)
+			{
+				auto first = arguments.data() + bounds[segment.parameter - 1];
+				auto last = arguments.data() + bounds[segment.parameter];
+
+				append(buffer, first, last, word_end);
+			}
+		}
+
+		frames.push_back({buffer.data(), buffer.data() + buffer.size()});
+	}
+
+	void run()
+	{
+		while (auto c = peek())
+		{
+			auto& frame = frames.back();
+
+			if (*c != '\\')
+			{
+				auto next = static_cast<const char*>(std::memchr(c, '\\', frame.end - c));
+
+				if (! next) next = frame.end;
+
+				emit(c, next, false);
+
+				frame.i = next;
+
+				continue;
+			}
+
+			auto finish = control_end(c, frame.end);
+
+			bool word = finish - c > 1 && is_letter(c[1]);
+
+			frame.i = finish;
+
+			if (auto macro = macros._find(c, finish - c)) call(*macro, word);
+
+			else emit(c, finish, word);
+		}
+	}
+
+	const Macros& macros;
+
+	std::string& output;
+
+	std::vector<Frame> frames;
+
+	std::vector<std::string> buffers;
+
+	/*! The arguments of the current call, back to back. */
+	std::string arguments;
+
+	std::size_t expansions = 0;
+
+	/*! Whether the output ends in a control word. */
+	bool after_word = false;
+};
+
+Macros::Macros(std::size_t depth, std::size_t expansions)
+: _fingerprint(0)
+, _depth(depth)
+, _expansions(expansions)
+{ }
+
+void Macros::define(const std::string& preamble)
+{
+	// Defined on a copy, so that an error leaves this as it was
+	auto macros = _macros;
+
+	Reader reader{preamble.data(), preamble.data(), preamble.data() + preamble.size()};
+
+	for (reader.skip(); reader.i != reader.end; reader.skip())
+	{
+		auto command = reader.name();
+
+		Macro macro;
+
+		std::string body;
+
+		if (command == "\\def")
+		{
+			macro.name = reader.name();
+
+			reader.skip();
+
+			// Parameters are #1#2..., without delimiters
+			while (reader.i != reader.end && *reader.i == '#')
+			{
+				if (reader.i + 1 == reader.end ||
+					reader.i[1] != static_cast<char>('1' + macro.parameters))
+				{
+					reader.fail("Expected parameter #" + std::to_string(macro.parameters + 1));
+				}
+
+				++macro.parameters;
+
+				reader.i += 2;
+			}
+
+			if (reader.i == reader.end || *reader.i != '{')
+			{
+				reader.fail("Delimited parameters are not supported");
+			}
+
+			++reader.i;
+
+			body = reader.until('}');
+		}
+
+		else if (command == "\\newcommand" ||
+				 command == "\\renewcommand" ||
+				 command == "\\providecommand")
+		{
+			reader.next('*');
+
+			if (reader.next('{'))
+			{
+				macro.name = reader.name();
+
+				if (! reader.next('}')) reader.fail("Expected }");
+			}
+
+			else macro.name = reader.name();
+
+			if (reader.next('['))
+			{
+				auto count = reader.until(']');
+
+				if (count.size() != 1 || count[0] < '0' || count[0] > '9')
+				{
+					reader.fail("Expected a number of parameters from 0 to 9");
+				}
+
+				macro.parameters = static_cast<unsigned>(count[0] - '0');
+
+				if (macro.parameters > 0 && reader.next('['))
+				{
+					macro.optional = true;
+
+					macro.default_value = reader.until(']');
+				}
+			}
+
+			if (! reader.next('{')) reader.fail("Expected the body of " + macro.name);
+
+			body = reader.until('}');
+		}
+
+		else reader.fail("Unsupported command " + command);
+
+		_compile(body, macro);
+
+		auto existing = macros.begin();
+
+		while (existing != macros.end() && existing->name != macro.name) ++existing;
+
+		if (existing == macros.end())
+		{
+			if (command == "\\renewcommand")
+			{
+				reader.fail(macro.name + " is not defined");
+			}
+
+			macros.push_back(std::move(macro));
+		}
+
+		else if (command == "\\newcommand")
+		{
+			reader.fail(macro.name + " is already defined");
+		}
+
+		else if (command != "\\providecommand") *existing = std::move(macro);
+	}
+
+	_macros.swap(macros);
+
+	_index();
+}
+
+bool Macros::expand(const std::string& latex, std::string& output) const
+{
+	if (_macros.empty()) return false;
+
+	auto begin = latex.data();
+	auto end = begin + latex.size();
+
+	// Most equations have no macro and are only scanned
+	for (auto i = begin; ; )
+	{
+		i = static_cast<const char*>(std::memchr(i, '\\', end - i));
+
+		if (! i) return false;
+
+		auto finish = control_end(i, end);
+
+		if (_find(i, finish - i))
+		{
+			std::string expanded;
+
+			expanded.reserve(latex.size() * 2);
+
+			expanded.append(begin, i);
+
+			Expander expander(*this, expanded);
+
+			expander.after_word = ends_with_word(begin, i);
+
+			expander.frames.push_back({i, end});
+
+			expander.run();
+
+			output.swap(expanded);
+
+			return true;
+		}
+
+		i = finish;
+	}
+}
+
+bool Macros::defined(const std::string& name) const noexcept
+{
+	return _find(name.data(), name.size()) != nullptr;
+}
+
+std::size_t Macros::size() const noexcept
+{
+	return _macros.size();
+}
+
+bool Macros::empty() const noexcept
+{
+	return _macros.empty();
+}
+
+std::uint64_t Macros::fingerprint() const noexcept
+{
+	return _fingerprint;
+}
+
+void Macros::_compile(const std::string& body, Macro& macro) const
+{
+	Segment segment{0, 0, 0};
+
+	for (std::size_t i = 0; i < body.size(); ++i)
+	{
+		// Escaped, as in \#
+		if (body[i] == '\\' && i + 1 < body.size())
+		{
+			macro.text.append(body, i++, 2);
+
+			continue;
+		}
+
+		if (body[i] != '#')
+		{
+			macro.text += body[i];
+
+			continue;
+		}
+
+		if (++i == body.size())
+		{
+			throw Latex::ParseException("Macro preamble error: # at the end of " +
+										macro.name);
+		}
+
+		if (body[i] == '#')
+		{
+			macro.text += '#';
+
+			continue;
+		}
+
+		auto parameter = static_cast<unsigned>(body[i] - '0');
+
+		if (body[i] < '1' || parameter > macro.parameters)
+		{
+			throw Latex::ParseException("Macro preamble error: illegal parameter #" +
+										std::string(1, body[i]) + " in " + macro.name);
+		}
+
+		segment.end = macro.text.size();
+		segment.parameter = parameter;
+
+		macro.segments.push_back(segment);
+
+		segment.begin = segment.end;
+	}
+
+	segment.end = macro.text.size();
+	segment.parameter = 0;
+
+	macro.segments.push_back(segment);
+}
+
+const Macros::Macro* Macros::_find(const char* name, std::size_t size) const noexcept
+{
+	if (_table.empty()) return nullptr;
+
+	auto mask = _table.size() - 1;
+
+	for (auto slot = hash(name, size) & mask; _table[slot]; slot = (slot + 1) & mask)
+	{
+		const auto& macro = _macros[_table[slot] - 1];
+
+		if (macro.name.size() == size && std::memcmp(macro.name.data(), name, size) == 0)
+		{
+			return &macro;
+		}
+	}
+
+	return nullptr;
+}
+
+void Macros::_index()
+{
+	std::size_t size = 8;
+
+	while (size < 2 * _macros.size()) size *= 2;
+
+	_table.assign(size, 0);
+
+	_fingerprint = hash(nullptr, 0);
+
+	for (std::size_t i = 0; i < _macros.size(); ++i)
+	{
+		const auto& macro = _macros[i];
+
+		auto slot = hash(macro.name.data(), macro.name.size()) & (size - 1);
+
+		while (_table[slot]) slot = (slot + 1) & (size - 1);
+
+		_table[slot] = static_cast<std::uint32_t>(i + 1);
+
+		// The compiled form, with the parameters between the texts
+		std::string form = macro.name + '\0' +
+						   static_cast<char>(macro.parameters) +
+						   static_cast<char>(macro.optional) +
+						   macro.default_value + '\0';
+
+		for (const auto& segment : macro.segments)
+		{
+			form.append(macro.text, segment.begin, segment.end - segment.begin);
+
+			form += static_cast<char>(segment.parameter);
+		}
+
+		_fingerprint = hash(form.data(), form.size(), _fingerprint);
+	}
+}
@@ -0,0 +1,180 @@
+/********************************************************//*!
+*
+*	@file macros.hpp
+*
+*	@author Peter Goldsborough.
+*
+************************************************************/
+
+#ifndef MACROS_HPP
+#define MACROS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/***************************************************************************//*!
+*
+*	@brief A table of user-defined macros, expanded natively before
+*		   equations reach KaTeX (which has no macro support of its own).
+*
+*	@details Definitions are given as a LaTeX preamble of \\newcommand,
+*			 \\renewcommand, \\providecommand and \\def commands, e.g.
+*
+*			 \\newcommand{\\R}{\\mathbb{R}}
+*			 \\newcommand{\\norm}[1]{\\left\\lVert #1 \\right\\rVert}
+*			 \\newcommand{\\E}[1][X]{\\mathbb{E}\\left[#1\\right]}
+*
+*			 Each definition is compiled once into a body of text and
+*			 parameter slots. A hash table from names to definitions makes
+*			 looking up a control sequence a single probe. Expansion is a
+*			 single pass over the equation. It works like TeX's input stack:
+*			 a macro's substituted body is read next, and arguments may come
+*			 from the body or from whatever follows it. Equations without
+*			 any macro are not copied at all.
+*
+*			 Arguments are a braced group, a control sequence or a single
+*			 (UTF-8) character, as in TeX. An optional first argument in
+*			 brackets has a default. Recursion is bounded both in depth and
+*			 in the total number of expansions of an equation, so that
+*			 self-referencing definitions fail instead of hanging.
+*
+*			 Delimited parameters of \\def (like \\def\\a#1.{...}) are not
+*			 supported. Instances are not modified by expansion and may be
+*			 shared between threads.
+*
+*******************************************************************************/
+
+class Macros
+{
+public:
+
+	/***********************************************************************//*!
+	*
+	*	@brief Constructs an empty table.
+	*
+	*	@param depth The most macros that may be nested in one another.
+	*
+	*	@param expansions The most macros expanded in one equation.
+	*
+	***************************************************************************/
+
+	explicit Macros(std::size_t depth = 64, std::size_t expansions = 10000);
+
+	virtual ~Macros() = default;
+
+	/***********************************************************************//*!
+	*
+	*	@brief Adds the definitions of a preamble.
+	*
+	*	@details Comments (from % to the end of a line) are ignored.
+	*			 Either all definitions of the preamble are added, or
+	*			 none are.
+	*
+	*	@throws Latex::ParseException If the preamble is malformed, a
+	*			\\newcommand redefines a macro or a \\renewcommand
+	*			defines a new one.
+	*
+	***************************************************************************/
+
+	virtual void define(const std::string& preamble);
+
+	/***********************************************************************//*!
+	*
+	*	@brief Expands all macros in an equation.
+	*
+	*	@param latex The equation.
+	*
+	*	@param output Set to the expanded equation if it had any macro,
+	*		   left alone otherwise.
+	*
+	*	@return Whether the equation had any macro.
+	*
+	*	@throws Latex::ParseException If a macro misses an argument or the
+	*			recursion limits were exceeded.
+	*
+	***************************************************************************/
+
+	virtual bool expand(const std::string& latex, std::string& output) const;
+
+	/***********************************************************************//*!
+	*
+	*	@brief Returns whether a macro (like "\\R") is defined.
+	*
+	***************************************************************************/
+
+	bool defined(const std::string& name) const noexcept;
+
+	/*! The number of macros defined. */
+	std::size_t size() const noexcept;
+
+	bool empty() const noexcept;
+
+	/***********************************************************************//*!
+	*
+	*	@brief Returns a hash of all definitions, which changes whenever
+	*		   expansions may.
+	*
+	***************************************************************************/
+
+	std::uint64_t fingerprint() const noexcept;
+
+protected:
+
+	/*! A run of a body's text, followed by a parameter. */
+	struct Segment
+	{
+		std::size_t begin;
+
+		std::size_t end;
+
+		/*! The parameter after the text, 1-9, or 0 for none. */
+		unsigned parameter;
+	};
+
+	struct Macro
+	{
+		/*! The name, backslash included. */
+		std::string name;
+
+		unsigned parameters = 0;
+
+		/*! Whether the first parameter is optional. */
+		bool optional = false;
+
+		/*! The value of the optional parameter if it is not given. */
+		std::string default_value;
+
+		/*! The body, without parameter references and with ## as #. */
+		std::string text;
+
+		std::vector<Segment> segments;
+	};
+
+	struct Expander;
+
+	/*! Parses a definition's body into its compiled form. */
+	virtual void _compile(const std::string& body, Macro& macro) const;
+
+	/*! Returns the definition of a control sequence, or nullptr. */
+	const Macro* _find(const char* name, std::size_t size) const noexcept;
+
+	/*! Rebuilds the hash table and fingerprint from the definitions. */
+	void _index();
+
+	/*! The definitions, in the order they were defined. */
+	std::vector<Macro> _macros;
+
+	/*! Open-addressed indices into _macros (plus one, 0 if empty),
+	    of a power-of-two size. */
+	std::vector<std::uint32_t> _table;
+
+	std::uint64_t _fingerprint;
+
+	std::size_t _depth;
+
+	std::size_t _expansions;
+};
+
+#endif /* MACROS_HPP */
@@ -0,0 +1,223 @@
+#include "micro_batcher.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <unordered_map>
+
+MicroBatcher::MicroBatcher(LatexPool& pool,
+						   std::chrono::microseconds window,
+						   std::size_t batch_size,
+						   LatexPool::Priority priority)
+: _pool(pool)
+, _limit(window)
+, _window(0)
+, _batch_size(std::max<std::size_t>(batch_size, 1))
+, _priority(priority)
+, _stopping(false)
+{
+	_collector = std::thread([this] { _collect(); });
+}
+
+MicroBatcher::~MicroBatcher()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		_stopping = true;
+	}
+
+	_arrived.notify_all();
+
+	_collector.join();
+}
+
+void MicroBatcher::post(std::string latex, Callback callback)
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	++_statistics.requests;
+
+	// Idle, so straight to the pool, without the collector's hop
+	if (_window.count() == 0 && _pending.empty())
+	{
+		_adapt(1);
+
+		lock.unlock();
+
+		std::vector<Request> batch;
+
+		batch.push_back({std::move(latex), std::move(callback)});
+
+		_flush(std::move(batch));
+
+		return;
+	}
+
+	if (_pending.empty()) _opened = std::chrono::steady_clock::now();
+
+	_pending.push_back({std::move(latex), std::move(callback)});
+
+	// The collector only needs to know of the first and the last call
+	if (_pending.size() == 1 || _pending.size() >= _batch_size)
+	{
+		lock.unlock();
+
+		_arrived.notify_all();
+	}
+}
+
+std::future<Latex::Result> MicroBatcher::submit(std::string latex)
+{
+	// std::function needs a copyable target, promise isn't
+	auto promise = std::make_shared<std::promise<Latex::Result>>();
+
+	auto future = promise->get_future();
+
+	post(std::move(latex), [promise] (Latex::Result& result) {
+		promise->set_value(std::move(result));
+	});
+
+	return future;
+}
+
+Latex::Result MicroBatcher::try_to_html(const std::string& latex)
+{
+	return submit(latex).get();
+}
+
+std::string MicroBatcher::to_html(const std::string& latex)
+{
+	auto result = try_to_html(latex);
+
+	if (! result) throw Latex::ParseException(result.error.message);
+
+	return std::move(result.html);
+}
+
+MicroBatcher::Statistics MicroBatcher::statistics() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	auto statistics = _statistics;
+
+	statistics.window = _window;
+
+	return statistics;
+}
+
+void MicroBatcher::_collect()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	while (true)
+	{
+		_arrived.wait(lock, [this] { return _stopping || ! _pending.empty(); });
+
+		if (_pending.empty()) return;
+
+		// Closes early when full, or when shutting down
+		_arrived.wait_until(lock, _opened + _window, [this] {
+			return _stopping || _pending.size() >= _batch_size;
+		});
+
+		std::vector<Request> batch;
+
+		batch.swap(_pending);
+
+		// Calls may have come in before the collector woke up
+		if (batch.size() > _batch_size)
+		{
+			auto rest = batch.begin() + static_cast<std::ptrdiff_t>(_batch_size);
+
+			_pending.assign(std::make_move_iterator(rest),
+							std::make_move_iterator(batch.end()));
+
+			batch.erase(rest, batch.end());
+
+			_opened = std::chrono::steady_clock::now();
+		}
+
+		_adapt(batch.size());
+
+		lock.unlock();
+
+		_flush(std::move(batch));
+
+		lock.lock();
+	}
+}
+
+void MicroBatcher::_flush(std::vector<Request> batch)
+{
+	// Shared, as std::function copies its target
+	auto requests = std::make_shared<std::vector<Request>>(std::move(batch));
+
+	_pool.post([requests] (Latex& latex) {
+		std::vector<std::string> equations;
+
+		// Which equation each request renders
+		std::vector<std::size_t> slots;
+
+		std::unordered_map<std::string, std::size_t> seen;
+
+		slots.reserve(requests->size());
+
+		for (const auto& request : *requests)
+		{
+			auto entry = seen.emplace(request.latex, equations.size());
+
+			if (entry.second) equations.push_back(request.latex);
+
+			slots.push_back(entry.first->second);
+		}
+
+		std::vector<Latex::Result> results;
+
+		try
+		{
+			results = latex.try_to_html(equations);
+		}
+
+		catch (const std::exception& exception)
+		{
+			Latex::Result failure;
+
+			failure.error.kind = Latex::ErrorKind::Engine;
+			failure.error.message = exception.what();
+
+			results.assign(equations.size(), failure);
+		}
+
+		for (std::size_t i = 0; i < requests->size(); ++i)
+		{
+			// Copied, as several requests may share it
+			auto result = results[slots[i]];
+
+			try
+			{
+				(*requests)[i].callback(result);
+			}
+
+			// The other callers still get their results
+			catch (...) { }
+		}
+	}, _priority);
+}
+
+void MicroBatcher::_adapt(std::size_t size)
+{
+	++_statistics.batches;
+
+	_statistics.largest = std::max(_statistics.largest, size);
+
+	// Calls wait for an engine anyway, so waiting for company
+	// costs little and batches free the engines sooner
+	if (size >= _batch_size || _pool.pending() > 0)
+	{
+		_window = std::min(_limit, std::max(2 * _window, _limit / 8));
+	}
+
+	// Nobody came along, so wait less (down to not at all)
+	else if (size == 1) _window /= 2;
+}
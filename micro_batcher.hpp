@@ -0,0 +1,206 @@
+/********************************************************//*!
+*
+*	@file micro_batcher.hpp
+*
+*	@author Peter Goldsborough.
+*
+************************************************************/
+
+#ifndef MICRO_BATCHER_HPP
+#define MICRO_BATCHER_HPP
+
+#include "latex_pool.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/***************************************************************************//*!
+*
+*	@brief Gathers concurrent single-equation renders into batches.
+*
+*	@details Every render task enters a V8 isolate and context once, which
+*			 at very high call rates costs more than small equations do.
+*			 A batch enters them once for all its equations (see
+*			 Latex::try_to_html()). The batcher collects the calls of
+*			 independent callers for a short window, or until a batch is
+*			 full, renders them as one pool task and hands each caller
+*			 its own result.
+*
+*			 The window adapts to the load. It starts at zero, where
+*			 calls go straight to the pool, so that single calls on an
+*			 idle system wait no longer than without the batcher. When
+*			 the pool's engines are saturated (tasks are queued) or a
+*			 batch fills up, the window grows, up to its maximum: calls
+*			 would wait for an engine anyway, and batches free engines
+*			 sooner. When batches stop finding company, the window halves
+*			 on every batch until it is back at zero.
+*
+*			 Identical equations in a batch are rendered once. All member
+*			 functions are thread-safe. The pool must outlive the batcher.
+*
+*******************************************************************************/
+
+class MicroBatcher
+{
+public:
+
+	/*! Receives the result of a render, on the engine's thread.
+		It must not throw and should not block. */
+	using Callback = std::function<void(Latex::Result&)>;
+
+	/*! The batching so far. */
+	struct Statistics
+	{
+		std::size_t requests = 0;
+
+		std::size_t batches = 0;
+
+		/*! The size of the largest batch. */
+		std::size_t largest = 0;
+
+		/*! The current window. */
+		std::chrono::microseconds window{0};
+	};
+
+	/***********************************************************************//*!
+	*
+	*	@brief Constructs a MicroBatcher in front of a pool.
+	*
+	*	@param pool The pool to render batches with.
+	*
+	*	@param window The longest time a call waits for others.
+	*
+	*	@param batch_size The most equations in a batch.
+	*
+	*	@param priority The priority class of the batches.
+	*
+	***************************************************************************/
+
+	MicroBatcher(LatexPool& pool,
+				 std::chrono::microseconds window = std::chrono::microseconds(200),
+				 std::size_t batch_size = 32,
+				 LatexPool::Priority priority = LatexPool::Priority::Interactive);
+
+	MicroBatcher(const MicroBatcher& other) = delete;
+
+	MicroBatcher& operator=(const MicroBatcher& other) = delete;
+
+	/***********************************************************************//*!
+	*
+	*	@brief Hands the calls still being collected to the pool.
+	*
+	***************************************************************************/
+
+	virtual ~MicroBatcher();
+
+	/***********************************************************************//*!
+	*
+	*	@brief Queues an equation to be rendered to HTML in a batch.
+	*
+	*	@param latex The LaTeX snippet to render.
+	*
+	*	@param callback Receives the result.
+	*
+	***************************************************************************/
+
+	virtual void post(std::string latex, Callback callback);
+
+	/***********************************************************************//*!
+	*
+	*	@brief Queues an equation to be rendered to HTML in a batch.
+	*
+	*	@return A future for the result.
+	*
+	***************************************************************************/
+
+	virtual std::future<Latex::Result> submit(std::string latex);
+
+	/***********************************************************************//*!
+	*
+	*	@brief Renders an equation to HTML in a batch, and waits for it.
+	*
+	*	@see Latex::try_to_html()
+	*
+	***************************************************************************/
+
+	virtual Latex::Result try_to_html(const std::string& latex);
+
+	/***********************************************************************//*!
+	*
+	*	@brief Renders an equation to HTML in a batch, and waits for it.
+	*
+	*	@throws Latex::ParseException If the parsing of the snippet failed.
+	*
+	*	@see Latex::to_html()
+	*
+	***************************************************************************/
+
+	virtual std::string to_html(const std::string& latex);
+
+	/***********************************************************************//*!
+	*
+	*	@brief Returns the batching so far and the current window.
+	*
+	***************************************************************************/
+
+	virtual Statistics statistics() const;
+
+protected:
+
+	struct Request
+	{
+		std::string latex;
+
+		Callback callback;
+	};
+
+	/*! The loop of the collector thread, which closes batches
+		when their window is over. */
+	virtual void _collect();
+
+	/*! Posts a batch to the pool. */
+	virtual void _flush(std::vector<Request> batch);
+
+	/*! Adapts the window after a batch of the given size.
+		Must be called with the mutex held. */
+	virtual void _adapt(std::size_t size);
+
+	LatexPool& _pool;
+
+	/*! The largest window. */
+	std::chrono::microseconds _limit;
+
+	/*! The current window. */
+	std::chrono::microseconds _window;
+
+	std::size_t _batch_size;
+
+	LatexPool::Priority _priority;
+
+	/*! The batch being collected. */
+	std::vector<Request> _pending;
+
+	/*! When the first call of the batch being collected came. */
+	std::chrono::steady_clock::time_point _opened;
+
+	Statistics _statistics;
+
+	/*! Guards all fields above. */
+	mutable std::mutex _mutex;
+
+	/*! Signals new calls (and shutdown) to the collector. */
+	std::condition_variable _arrived;
+
+	bool _stopping;
+
+	std::thread _collector;
+};
+
+#endif /* MICRO_BATCHER_HPP */
@@ -0,0 +1,107 @@
+#include "pooled_allocator.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+namespace
+{
+	/*! The smallest pooled size, as a power of two. */
+	const std::size_t smallest = 6;
+
+	std::size_t class_size(std::size_t index)
+	{
+		return std::size_t(1) << (index + smallest);
+	}
+}
+
+PooledAllocator::PooledAllocator(std::size_t retained)
+: _limit(retained)
+, _retained(0)
+{ }
+
+PooledAllocator::~PooledAllocator()
+{
+	for (auto& buffers : _free)
+	{
+		for (auto buffer : buffers) std::free(buffer);
+	}
+}
+
+void* PooledAllocator::Allocate(size_t length)
+{
+	auto data = AllocateUninitialized(length);
+
+	return data ? std::memset(data, 0, length) : data;
+}
+
+void* PooledAllocator::AllocateUninitialized(size_t length)
+{
+	auto index = _class(length);
+
+	if (index == classes) return std::malloc(length);
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		auto& buffers = _free[index];
+
+		if (! buffers.empty())
+		{
+			auto buffer = buffers.back();
+
+			buffers.pop_back();
+
+			_retained -= class_size(index);
+
+			return buffer;
+		}
+	}
+
+	return std::malloc(class_size(index));
+}
+
+void PooledAllocator::Free(void* data, size_t length)
+{
+	if (! data) return;
+
+	auto index = _class(length);
+
+	if (index < classes)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		if (_retained + class_size(index) <= _limit)
+		{
+			try
+			{
+				_free[index].push_back(data);
+
+				_retained += class_size(index);
+
+				return;
+			}
+
+			// Growing the free list failed, so don't keep it
+			catch (const std::bad_alloc&) { }
+		}
+	}
+
+	std::free(data);
+}
+
+std::size_t PooledAllocator::retained() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	return _retained;
+}
+
+std::size_t PooledAllocator::_class(std::size_t length) noexcept
+{
+	std::size_t index = 0;
+
+	while (index < classes && class_size(index) < length) ++index;
+
+	return index;
+}
@@ -0,0 +1,83 @@
+/********************************************************//*!
+*
+*	@file pooled_allocator.hpp
+*
+*	@author Peter Goldsborough.
+*
+************************************************************/
+
+#ifndef POOLED_ALLOCATOR_HPP
+#define POOLED_ALLOCATOR_HPP
+
+#include <array>
+#include <cstddef>
+#include <mutex>
+#include <v8.h>
+#include <vector>
+
+/***************************************************************************//*!
+*
+*	@brief An ArrayBuffer allocator that keeps freed buffers for reuse.
+*
+*	@details Buffers are rounded up to a power of two between 64 bytes
+*			 and 1 MiB, and freed buffers are kept in a free list per
+*			 size, up to a total of retained bytes. Larger buffers, and
+*			 those freed beyond that total, go back to free() at once.
+*			 Buffers are zeroed only when V8 asks for zeroed memory,
+*			 and then only as far as it asked for.
+*
+*			 The allocator is thread-safe, so several instances can share
+*			 it (see the Latex constructors).
+*
+*******************************************************************************/
+
+class PooledAllocator : public v8::ArrayBuffer::Allocator
+{
+public:
+
+	/***********************************************************************//*!
+	*
+	*	@brief Constructs a PooledAllocator.
+	*
+	*	@param retained The most bytes of freed buffers kept for reuse.
+	*
+	***************************************************************************/
+
+	explicit PooledAllocator(std::size_t retained = 16 << 20);
+
+	PooledAllocator(const PooledAllocator& other) = delete;
+
+	PooledAllocator& operator=(const PooledAllocator& other) = delete;
+
+	/*! Frees the buffers kept for reuse. */
+	virtual ~PooledAllocator();
+
+	virtual void* Allocate(size_t length) override;
+
+	virtual void* AllocateUninitialized(size_t length) override;
+
+	virtual void Free(void* data, size_t length) override;
+
+	/*! The bytes of freed buffers currently kept for reuse. */
+	std::size_t retained() const;
+
+protected:
+
+	/*! The number of buffer sizes, 2^6 to 2^20 bytes. */
+	static const std::size_t classes = 15;
+
+	/*! Returns the size class of a length, or classes if it is
+		too large to be pooled. */
+	static std::size_t _class(std::size_t length) noexcept;
+
+	/*! The freed buffers of each size class. */
+	std::array<std::vector<void*>, classes> _free;
+
+	std::size_t _limit;
+
+	std::size_t _retained;
+
+	mutable std::mutex _mutex;
+};
+
+#endif /* POOLED_ALLOCATOR_HPP */
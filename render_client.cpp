@@ -0,0 +1,194 @@
+#include "render_client.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+RenderClient::RenderClient(const std::string& path)
+: _socket(::socket(AF_UNIX, SOCK_STREAM, 0))
+, _next_id(0)
+, _bulk(false)
+{
+	if (_socket < 0) throw Exception(std::strerror(errno));
+
+	sockaddr_un address{};
+
+	address.sun_family = AF_UNIX;
+
+	if (path.size() >= sizeof address.sun_path)
+	{
+		::close(_socket);
+
+		throw Exception("Socket path too long: " + path);
+	}
+
+	std::strcpy(address.sun_path, path.c_str());
+
+	if (::connect(_socket,
+				  reinterpret_cast<sockaddr*>(&address),
+				  sizeof address) < 0)
+	{
+		auto error = errno;
+
+		::close(_socket);
+
+		throw Exception("Could not connect to " + path + ": " + std::strerror(error));
+	}
+
+#ifdef SO_NOSIGPIPE
+	int on = 1;
+
+	::setsockopt(_socket, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof on);
+#endif
+}
+
+RenderClient::~RenderClient()
+{
+	::close(_socket);
+}
+
+std::string RenderClient::to_html(const std::string& latex)
+{
+	return _render_one(Operation::HTML, latex);
+}
+
+std::string RenderClient::to_image(const std::string& latex, Operation format)
+{
+	if (format == Operation::HTML)
+	{
+		throw Exception("Not an image format", Status::ProtocolError);
+	}
+
+	return _render_one(format, latex);
+}
+
+std::vector<RenderProtocol::Item>
+RenderClient::render(Operation operation, const std::vector<std::string>& equations)
+{
+	auto id = send(operation, equations);
+
+	auto response = _receive(id);
+
+	if (response.items.size() != equations.size())
+	{
+		throw Exception("Mismatched response");
+	}
+
+	return std::move(response.items);
+}
+
+std::uint32_t RenderClient::send(Operation operation,
+								 const std::vector<std::string>& equations)
+{
+	RenderProtocol::Request request;
+
+	request.id = _next_id++;
+	request.operation = operation;
+	request.bulk = _bulk;
+	request.equations = equations;
+
+	try
+	{
+		RenderProtocol::write_frame(_socket, RenderProtocol::encode(request));
+	}
+
+	catch (const RenderProtocol::Exception& exception)
+	{
+		throw Exception(exception.what());
+	}
+
+	return request.id;
+}
+
+RenderProtocol::Response RenderClient::receive()
+{
+	if (! _early.empty())
+	{
+		auto response = std::move(_early.begin()->second);
+
+		_early.erase(_early.begin());
+
+		return response;
+	}
+
+	std::string payload;
+
+	try
+	{
+		if (! RenderProtocol::read_frame(_socket, payload))
+		{
+			throw Exception("Connection closed by daemon");
+		}
+
+		return RenderProtocol::decode_response(payload);
+	}
+
+	catch (const RenderProtocol::Exception& exception)
+	{
+		throw Exception(exception.what());
+	}
+}
+
+RenderProtocol::Response RenderClient::_receive(std::uint32_t id)
+{
+	auto early = _early.find(id);
+
+	if (early != _early.end())
+	{
+		auto response = std::move(early->second);
+
+		_early.erase(early);
+
+		return response;
+	}
+
+	while (true)
+	{
+		std::string payload;
+
+		try
+		{
+			if (! RenderProtocol::read_frame(_socket, payload))
+			{
+				throw Exception("Connection closed by daemon");
+			}
+
+			auto response = RenderProtocol::decode_response(payload);
+
+			if (response.id == id) return response;
+
+			_early.emplace(response.id, std::move(response));
+		}
+
+		catch (const RenderProtocol::Exception& exception)
+		{
+			throw Exception(exception.what());
+		}
+	}
+}
+
+void RenderClient::bulk(bool enabled)
+{
+	_bulk = enabled;
+}
+
+bool RenderClient::bulk() const
+{
+	return _bulk;
+}
+
+std::string RenderClient::_render_one(Operation operation, const std::string& latex)
+{
+	auto items = render(operation, {latex});
+
+	auto& item = items.front();
+
+	if (item.status != Status::OK)
+	{
+		throw Exception(item.data, item.status, item.position);
+	}
+
+	return std::move(item.data);
+}
@@ -0,0 +1,208 @@
+/********************************************************//*!
+*
+*	@file render_client.hpp
+*
+*	@author Peter Goldsborough.
+*
+************************************************************/
+
+#ifndef RENDER_CLIENT_HPP
+#define RENDER_CLIENT_HPP
+
+#include "render_protocol.hpp"
+
+#include <cstdint>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/***************************************************************************//*!
+*
+*	@brief A client for the render daemon (see tools/daemon).
+*
+*	@details The client does not depend on V8 or wkhtmltox, as all
+*			 rendering happens in the daemon's warm engines. A single
+*			 client is not thread-safe; use one per thread.
+*
+*******************************************************************************/
+
+class RenderClient
+{
+public:
+
+	using Operation = RenderProtocol::Operation;
+
+	using Status = RenderProtocol::Status;
+
+	/***********************************************************************//*!
+	*
+	*	@brief An exception thrown when the daemon could not render.
+	*
+	***************************************************************************/
+
+	struct Exception : public std::runtime_error
+	{
+		Exception(const std::string& what,
+				  Status status_ = Status::ProtocolError,
+				  int position_ = -1)
+		: std::runtime_error(what)
+		, status(status_)
+		, position(position_)
+		{ }
+
+		/*! Why the render failed. */
+		Status status;
+
+		/*! The character offset of a parse error, else -1. */
+		int position;
+	};
+
+	/***********************************************************************//*!
+	*
+	*	@brief Connects to a render daemon.
+	*
+	*	@param path The path of the daemon's Unix domain socket.
+	*
+	*	@throws Exception If the connection could not be established.
+	*
+	***************************************************************************/
+
+	explicit RenderClient(const std::string& path = RenderProtocol::default_socket);
+
+	RenderClient(const RenderClient& other) = delete;
+
+	RenderClient& operator=(const RenderClient& other) = delete;
+
+	/***********************************************************************//*!
+	*
+	*	@brief Closes the connection.
+	*
+	***************************************************************************/
+
+	virtual ~RenderClient();
+
+	/***********************************************************************//*!
+	*
+	*	@brief Converts a LaTeX snippet to an HTML snippet.
+	*
+	*	@throws Exception If the snippet could not be rendered.
+	*
+	***************************************************************************/
+
+	virtual std::string to_html(const std::string& latex);
+
+	/***********************************************************************//*!
+	*
+	*	@brief Converts a LaTeX snippet to image bytes.
+	*
+	*	@param latex The LaTeX snippet to render.
+	*
+	*	@param format One of Operation::PNG, Operation::JPG or Operation::SVG.
+	*
+	*	@throws Exception If the snippet could not be rendered.
+	*
+	***************************************************************************/
+
+	virtual std::string to_image(const std::string& latex, Operation format);
+
+	/***********************************************************************//*!
+	*
+	*	@brief Renders a batch of equations in a single round trip.
+	*
+	*	@param operation What to render the equations to.
+	*
+	*	@param equations The LaTeX snippets to render.
+	*
+	*	@return One item per equation, holding its data or error.
+	*
+	*	@throws Exception On connection or protocol errors.
+	*
+	***************************************************************************/
+
+	virtual std::vector<RenderProtocol::Item>
+	render(Operation operation, const std::vector<std::string>& equations);
+
+	/***********************************************************************//*!
+	*
+	*	@brief Sends a request without waiting for its response.
+	*
+	*	@details Together with receive(), this allows pipelining many
+	*			 requests over the one connection.
+	*
+	*	@return The id of the request, as carried by its response.
+	*
+	*	@throws Exception On connection errors.
+	*
+	***************************************************************************/
+
+	virtual std::uint32_t send(Operation operation,
+							   const std::vector<std::string>& equations);
+
+	/***********************************************************************//*!
+	*
+	*	@brief Receives the next response, for any outstanding request.
+	*
+	*	@throws Exception On connection or protocol errors.
+	*
+	***************************************************************************/
+
+	virtual RenderProtocol::Response receive();
+
+	/***********************************************************************//*!
+	*
+	*	@brief Marks all further requests as bulk (background) work.
+	*
+	*	@details The daemon schedules bulk requests behind interactive
+	*			 ones and renders large bulk requests in chunks, between
+	*			 which interactive requests may overtake them.
+	*
+	*	@param enabled Whether further requests are bulk requests.
+	*
+	***************************************************************************/
+
+	virtual void bulk(bool enabled);
+
+	/***********************************************************************//*!
+	*
+	*	@brief Returns whether requests are sent as bulk work.
+	*
+	***************************************************************************/
+
+	virtual bool bulk() const;
+
+protected:
+
+	/***********************************************************************//*!
+	*
+	*	@brief Receives the response to a particular request.
+	*
+	*	@details Responses to other requests arriving in the meantime
+	*			 are kept for later calls of receive().
+	*
+	***************************************************************************/
+
+	virtual RenderProtocol::Response _receive(std::uint32_t id);
+
+	/***********************************************************************//*!
+	*
+	*	@brief Renders a single equation, throwing on failure.
+	*
+	***************************************************************************/
+
+	virtual std::string _render_one(Operation operation, const std::string& latex);
+
+	/*! The connected socket. */
+	int _socket;
+
+	/*! The id of the next request. */
+	std::uint32_t _next_id;
+
+	/*! Whether requests are marked as bulk work. */
+	bool _bulk;
+
+	/*! Responses that arrived while waiting for another one. */
+	std::map<std::uint32_t, RenderProtocol::Response> _early;
+};
+
+#endif /* RENDER_CLIENT_HPP */
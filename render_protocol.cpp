@@ -0,0 +1,338 @@
+#include "render_protocol.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // Clients set SO_NOSIGPIPE instead (e.g. on OS X)
+#endif
+
+const std::uint32_t RenderProtocol::max_frame;
+
+const char* const RenderProtocol::default_socket = "/tmp/latexpp.sock";
+
+namespace
+{
+	/*! Marks bulk requests in the operation byte. */
+	const std::uint8_t bulk_flag = 0x80;
+
+	void put(std::string& buffer, std::uint32_t value)
+	{
+		char bytes[4] = {
+			static_cast<char>(value >> 24),
+			static_cast<char>(value >> 16),
+			static_cast<char>(value >> 8),
+			static_cast<char>(value)
+		};
+
+		buffer.append(bytes, 4);
+	}
+
+	void put(std::string& buffer, const std::string& data)
+	{
+		put(buffer, static_cast<std::uint32_t>(data.size()));
+
+		buffer += data;
+	}
+
+	/*! Reads fields from a payload, throwing if it is too short. */
+	class Reader
+	{
+	public:
+
+		Reader(const std::string& payload)
+		: _data(payload.data())
+		, _left(payload.size())
+		{ }
+
+		std::uint8_t byte()
+		{
+			_need(1);
+
+			--_left;
+
+			return static_cast<std::uint8_t>(*_data++);
+		}
+
+		std::uint32_t word()
+		{
+			_need(4);
+
+			auto bytes = reinterpret_cast<const unsigned char*>(_data);
+
+			_data += 4;
+			_left -= 4;
+
+			return (std::uint32_t(bytes[0]) << 24) |
+				   (std::uint32_t(bytes[1]) << 16) |
+				   (std::uint32_t(bytes[2]) << 8)  |
+				    std::uint32_t(bytes[3]);
+		}
+
+		std::string string()
+		{
+			auto length = word();
+
+			_need(length);
+
+			std::string data(_data, length);
+
+			_data += length;
+			_left -= length;
+
+			return data;
+		}
+
+		/*! Upper bound for counts, to not reserve absurd amounts. */
+		std::size_t left() const
+		{
+			return _left;
+		}
+
+		void end() const
+		{
+			if (_left) throw RenderProtocol::Exception("Trailing bytes in frame");
+		}
+
+	private:
+
+		void _need(std::size_t bytes) const
+		{
+			if (_left < bytes) throw RenderProtocol::Exception("Truncated frame");
+		}
+
+		const char* _data;
+
+		std::size_t _left;
+	};
+
+	/*! Reads exactly length bytes; returns the number read before EOF. */
+	std::size_t read_fully(int socket, char* buffer, std::size_t length)
+	{
+		std::size_t total = 0;
+
+		while (total < length)
+		{
+			auto count = ::read(socket, buffer + total, length - total);
+
+			if (count == 0) break;
+
+			if (count < 0)
+			{
+				if (errno == EINTR) continue;
+
+				throw RenderProtocol::Exception(std::strerror(errno));
+			}
+
+			total += static_cast<std::size_t>(count);
+		}
+
+		return total;
+	}
+}
+
+std::string RenderProtocol::encode(const Request& request)
+{
+	std::string payload;
+
+	put(payload, request.id);
+
+	auto operation = static_cast<std::uint8_t>(request.operation);
+
+	if (request.bulk) operation |= bulk_flag;
+
+	payload += static_cast<char>(operation);
+
+	put(payload, static_cast<std::uint32_t>(request.equations.size()));
+
+	for (const auto& equation : request.equations) put(payload, equation);
+
+	return payload;
+}
+
+std::string RenderProtocol::encode(const Response& response)
+{
+	std::string payload;
+
+	put(payload, response.id);
+
+	put(payload, static_cast<std::uint32_t>(response.items.size()));
+
+	for (const auto& item : response.items)
+	{
+		payload += static_cast<char>(item.status);
+
+		put(payload, static_cast<std::uint32_t>(item.position));
+
+		put(payload, item.data);
+	}
+
+	return payload;
+}
+
+RenderProtocol::Request RenderProtocol::decode_request(const std::string& payload)
+{
+	Reader reader(payload);
+
+	Request request;
+
+	request.id = reader.word();
+
+	auto operation = reader.byte();
+
+	request.bulk = operation & bulk_flag;
+
+	operation = static_cast<std::uint8_t>(operation & ~bulk_flag);
+
+	if (operation > static_cast<std::uint8_t>(Operation::SVG))
+	{
+		throw Exception("Unknown operation");
+	}
+
+	request.operation = static_cast<Operation>(operation);
+
+	auto count = reader.word();
+
+	// Every equation needs at least its four length bytes
+	if (count > reader.left() / 4) throw Exception("Truncated frame");
+
+	request.equations.reserve(count);
+
+	for (std::uint32_t i = 0; i < count; ++i)
+	{
+		request.equations.push_back(reader.string());
+	}
+
+	reader.end();
+
+	return request;
+}
+
+bool RenderProtocol::request_id(const std::string& payload, std::uint32_t& id) noexcept
+{
+	if (payload.size() < 4) return false;
+
+	auto bytes = reinterpret_cast<const unsigned char*>(payload.data());
+
+	id = (std::uint32_t(bytes[0]) << 24) |
+		 (std::uint32_t(bytes[1]) << 16) |
+		 (std::uint32_t(bytes[2]) << 8)  |
+		  std::uint32_t(bytes[3]);
+
+	return true;
+}
+
+RenderProtocol::Response RenderProtocol::decode_response(const std::string& payload)
+{
+	Reader reader(payload);
+
+	Response response;
+
+	response.id = reader.word();
+
+	auto count = reader.word();
+
+	if (count > reader.left() / 9) throw Exception("Truncated frame");
+
+	response.items.resize(count);
+
+	for (auto& item : response.items)
+	{
+		auto status = reader.byte();
+
+		if (status > static_cast<std::uint8_t>(Status::ProtocolError))
+		{
+			throw Exception("Unknown status");
+		}
+
+		item.status = static_cast<Status>(status);
+
+		item.position = static_cast<std::int32_t>(reader.word());
+
+		item.data = reader.string();
+	}
+
+	reader.end();
+
+	return response;
+}
+
+bool RenderProtocol::read_frame(int socket, std::string& payload)
+{
+	unsigned char header[4];
+
+	auto count = read_fully(socket, reinterpret_cast<char*>(header), 4);
+
+	if (count == 0) return false;
+
+	if (count < 4) throw Exception("Truncated frame");
+
+	auto length = (std::uint32_t(header[0]) << 24) |
+				  (std::uint32_t(header[1]) << 16) |
+				  (std::uint32_t(header[2]) << 8)  |
+				   std::uint32_t(header[3]);
+
+	if (length > max_frame) throw Exception("Frame too large");
+
+	payload.resize(length);
+
+	if (read_fully(socket, &payload[0], length) < length)
+	{
+		throw Exception("Truncated frame");
+	}
+
+	return true;
+}
+
+void RenderProtocol::write_frame(int socket, const std::string& payload)
+{
+	if (payload.size() > max_frame) throw Exception("Frame too large");
+
+	std::string header;
+
+	put(header, static_cast<std::uint32_t>(payload.size()));
+
+	// Header and payload in one system call, without copying the payload
+	iovec buffers[2] = {
+		{ const_cast<char*>(header.data()), header.size() },
+		{ const_cast<char*>(payload.data()), payload.size() }
+	};
+
+	msghdr message{};
+
+	message.msg_iov = buffers;
+	message.msg_iovlen = 2;
+
+	while (buffers[0].iov_len + buffers[1].iov_len > 0)
+	{
+		auto count = ::sendmsg(socket, &message, MSG_NOSIGNAL);
+
+		if (count < 0)
+		{
+			if (errno == EINTR) continue;
+
+			throw Exception(std::strerror(errno));
+		}
+
+		// Advance past what was written (possibly into the payload)
+		for (auto& buffer : buffers)
+		{
+			auto done = std::min(static_cast<std::size_t>(count), buffer.iov_len);
+
+			buffer.iov_base = static_cast<char*>(buffer.iov_base) + done;
+			buffer.iov_len -= done;
+
+			count -= done;
+		}
+
+		if (buffers[0].iov_len == 0)
+		{
+			message.msg_iov = buffers + 1;
+			message.msg_iovlen = 1;
+		}
+	}
+}
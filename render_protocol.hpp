@@ -0,0 +1,193 @@
+/********************************************************//*!
+*
+*	@file render_protocol.hpp
+*
+*	@author Peter Goldsborough.
+*
+************************************************************/
+
+#ifndef RENDER_PROTOCOL_HPP
+#define RENDER_PROTOCOL_HPP
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/***************************************************************************//*!
+*
+*	@brief The wire format spoken between the render daemon and its clients.
+*
+*	@details Every message is a frame: a 32-bit big-endian payload length,
+*			 followed by the payload. All integers are big-endian.
+*
+*			 A request payload is the request id (u32), the operation
+*			 (u8), the number of equations (u32) and then, per equation,
+*			 its length (u32) and its UTF-8 bytes. The high bit of the
+*			 operation byte marks bulk (background) requests.
+*
+*			 A response payload is the request id (u32) and the number of
+*			 items (u32), followed by one item per equation: its status
+*			 (u8), the error position (i32, -1 if unknown), the length of
+*			 the data (u32) and the data. The data is the HTML snippet or
+*			 image bytes on success, and the error message otherwise.
+*
+*			 Requests may be pipelined; responses carry the id of their
+*			 request but are not necessarily sent in request order. A
+*			 malformed request is answered with a single ProtocolError
+*			 item, under its id if the payload is long enough to hold
+*			 one, else under id 0.
+*
+*******************************************************************************/
+
+struct RenderProtocol
+{
+	/*! What to render the equations of a request to. */
+	enum class Operation : std::uint8_t { HTML, PNG, JPG, SVG };
+
+	/*! The outcome of rendering one equation. */
+	enum class Status : std::uint8_t
+	{
+		OK,
+		ParseError,
+		EngineError,
+		ConversionError,
+		ProtocolError
+	};
+
+	/*! The maximum size of a frame's payload. */
+	static const std::uint32_t max_frame = 64 * 1024 * 1024;
+
+	/*! The socket path the daemon listens on by default. */
+	static const char* const default_socket;
+
+	/***********************************************************************//*!
+	*
+	*	@brief An exception signifying a malformed frame or an I/O error.
+	*
+	***************************************************************************/
+
+	struct Exception : public std::runtime_error
+	{
+		Exception(const std::string& what)
+		: std::runtime_error(what)
+		{ }
+	};
+
+	/*! A (batch) render request. */
+	struct Request
+	{
+		std::uint32_t id = 0;
+
+		Operation operation = Operation::HTML;
+
+		/*! Whether the request is background work, which yields to
+			interactive requests. */
+		bool bulk = false;
+
+		std::vector<std::string> equations;
+	};
+
+	/*! The result for one equation of a request. */
+	struct Item
+	{
+		Status status = Status::OK;
+
+		std::int32_t position = -1;
+
+		std::string data;
+	};
+
+	/*! The response to a request, with one item per equation. */
+	struct Response
+	{
+		std::uint32_t id = 0;
+
+		std::vector<Item> items;
+	};
+
+	/***********************************************************************//*!
+	*
+	*	@brief Serializes a request into a frame payload.
+	*
+	***************************************************************************/
+
+	static std::string encode(const Request& request);
+
+	/***********************************************************************//*!
+	*
+	*	@brief Serializes a response into a frame payload.
+	*
+	***************************************************************************/
+
+	static std::string encode(const Response& response);
+
+	/***********************************************************************//*!
+	*
+	*	@brief Deserializes a request from a frame payload.
+	*
+	*	@throws Exception If the payload is malformed.
+	*
+	***************************************************************************/
+
+	static Request decode_request(const std::string& payload);
+
+	/***********************************************************************//*!
+	*
+	*	@brief Reads the id of a request from its frame payload.
+	*
+	*	@details Lets a malformed request be answered under its id.
+	*
+	*	@param payload The payload, which may be malformed otherwise.
+	*
+	*	@param id Set to the id, if the payload is long enough to hold one.
+	*
+	*	@return Whether the payload was long enough.
+	*
+	***************************************************************************/
+
+	static bool request_id(const std::string& payload, std::uint32_t& id) noexcept;
+
+	/***********************************************************************//*!
+	*
+	*	@brief Deserializes a response from a frame payload.
+	*
+	*	@throws Exception If the payload is malformed.
+	*
+	***************************************************************************/
+
+	static Response decode_response(const std::string& payload);
+
+	/***********************************************************************//*!
+	*
+	*	@brief Reads one frame from a socket.
+	*
+	*	@param socket The file descriptor to read from.
+	*
+	*	@param payload Set to the payload of the frame.
+	*
+	*	@return False if the peer closed the connection before a
+	*			new frame started, else true.
+	*
+	*	@throws Exception On I/O errors, truncated or oversized frames.
+	*
+	***************************************************************************/
+
+	static bool read_frame(int socket, std::string& payload);
+
+	/***********************************************************************//*!
+	*
+	*	@brief Writes one frame to a socket.
+	*
+	*	@param socket The file descriptor to write to.
+	*
+	*	@param payload The payload of the frame.
+	*
+	*	@throws Exception On I/O errors or oversized payloads.
+	*
+	***************************************************************************/
+
+	static void write_frame(int socket, const std::string& payload);
+};
+
+#endif /* RENDER_PROTOCOL_HPP */
@@ -0,0 +1,619 @@
+#include "shared_cache.hpp"
+#include "latex.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <limits>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2,
+			  "Atomics in shared memory must be lock-free");
+
+namespace
+{
+	/*! Entries per set. */
+	const std::size_t ways = 16;
+}
+
+/*! Where an entry's bytes are in the data area of its set. */
+struct SharedCache::Entry
+{
+	std::atomic<std::uint64_t> high;
+
+	std::atomic<std::uint64_t> low;
+
+	/*! The clock of the last use, 0 if the entry is empty. */
+	std::atomic<std::uint64_t> used;
+
+	std::atomic<std::uint32_t> offset;
+
+	std::atomic<std::uint32_t> size;
+};
+
+/*! The start of every set; the set's data area follows. */
+struct alignas(64) SharedCache::Set
+{
+	/*! The sequence in the low half, odd while a writer is at the
+	    set, and the token of the last writer's lock in the high half.
+	    Both change in one exchange, so a lock word is never reused
+	    before the token wraps around. */
+	std::atomic<std::uint64_t> lock;
+
+	alignas(64) Entry entries[ways];
+
+	const char* data() const noexcept
+	{
+		return reinterpret_cast<const char*>(this) + sizeof(Set);
+	}
+
+	char* data() noexcept
+	{
+		return reinterpret_cast<char*>(this) + sizeof(Set);
+	}
+};
+
+/*! The start of the file. Counters have their own cache lines,
+    since all processes bump them. */
+struct SharedCache::Header
+{
+	char magic[8];
+
+	std::uint64_t sets;
+
+	std::uint64_t set_size;
+
+	std::uint64_t ways;
+
+	alignas(64) std::atomic<std::uint64_t> clock;
+
+	alignas(64) std::atomic<std::uint64_t> tokens;
+
+	alignas(64) std::atomic<std::uint64_t> hits;
+
+	alignas(64) std::atomic<std::uint64_t> misses;
+
+	alignas(64) std::atomic<std::uint64_t> inserts;
+
+	alignas(64) std::atomic<std::uint64_t> evictions;
+
+	alignas(64) std::atomic<std::uint64_t> skipped;
+
+	alignas(64) std::atomic<std::uint64_t> oversized;
+
+	alignas(64) std::atomic<std::uint64_t> recovered;
+};
+
+namespace
+{
+	const char magic[8] = {'L', 'T', 'X', 'C', 'A', 'C', 'H', '3'};
+
+	/*! Where the sets start. */
+	const std::size_t header_size = 4096;
+
+	static_assert(sizeof(SharedCache::Header) <= header_size, "Header too large");
+
+	/*! How long a lock may stay the same before its writer counts
+	    as dead. Writers hold locks for a copy of at most a set. */
+	const std::chrono::seconds lock_timeout(2);
+
+	/*! How often a writer whose lock was taken over tries to empty
+	    the set, yielding in between. */
+	const std::size_t repair_attempts = 1000;
+
+	/*! Returns the sequence half of a lock word. */
+	std::uint32_t sequence_of(std::uint64_t lock) noexcept
+	{
+		return static_cast<std::uint32_t>(lock);
+	}
+
+	/*! Returns the token half of a lock word. */
+	std::uint32_t token_of(std::uint64_t lock) noexcept
+	{
+		return static_cast<std::uint32_t>(lock >> 32);
+	}
+
+	/*! Returns the lock word of a token and a sequence. */
+	std::uint64_t lock_word(std::uint32_t token, std::uint32_t sequence) noexcept
+	{
+		return (static_cast<std::uint64_t>(token) << 32) | sequence;
+	}
+
+	bool matches(const SharedCache::Entry& entry, const SharedCache::Key& key) noexcept
+	{
+		return entry.high.load(std::memory_order_relaxed) == key.high &&
+			   entry.low.load(std::memory_order_relaxed) == key.low;
+	}
+
+	/*! Empties an entry of a locked set. */
+	void clear(SharedCache::Entry& entry) noexcept
+	{
+		entry.used.store(0, std::memory_order_relaxed);
+
+		entry.high.store(0, std::memory_order_relaxed);
+		entry.low.store(0, std::memory_order_relaxed);
+
+		entry.offset.store(0, std::memory_order_relaxed);
+		entry.size.store(0, std::memory_order_relaxed);
+	}
+
+	/*! Moves the entries of a locked set to the start of its data
+	    area, in order, and returns where the free space starts. */
+	std::size_t compact(SharedCache::Set& set) noexcept
+	{
+		SharedCache::Entry* live[ways];
+
+		std::size_t count = 0;
+
+		for (auto& entry : set.entries)
+		{
+			if (entry.used.load(std::memory_order_relaxed) != 0) live[count++] = &entry;
+		}
+
+		std::sort(live, live + count, [] (const SharedCache::Entry* first,
+										  const SharedCache::Entry* second) {
+			return first->offset.load(std::memory_order_relaxed) <
+				   second->offset.load(std::memory_order_relaxed);
+		});
+
+		std::size_t end = 0;
+
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			auto offset = live[i]->offset.load(std::memory_order_relaxed);
+
+			auto size = live[i]->size.load(std::memory_order_relaxed);
+
+			// Forward only, as the entries are in order
+			if (offset != end) std::memmove(set.data() + end, set.data() + offset, size);
+
+			live[i]->offset.store(static_cast<std::uint32_t>(end), std::memory_order_relaxed);
+
+			end += size;
+		}
+
+		return end;
+	}
+
+	/*! Closes a file descriptor unless released. */
+	struct Descriptor
+	{
+		~Descriptor() { if (file >= 0) ::close(file); }
+
+		int file;
+	};
+}
+
+bool SharedCache::View::valid() const noexcept
+{
+	if (! _set) return false;
+
+	std::atomic_thread_fence(std::memory_order_acquire);
+
+	return _set->lock.load(std::memory_order_relaxed) == _lock;
+}
+
+bool SharedCache::View::copy(std::string& output) const
+{
+	if (! _data) return false;
+
+	output.assign(_data, _size);
+
+	return valid();
+}
+
+SharedCache::SharedCache(const std::string& path,
+						 std::size_t entries,
+						 std::size_t entry_size)
+: _file(-1)
+, _mapping(nullptr)
+, _mapping_size(0)
+, _header(nullptr)
+{
+	auto sets = std::max<std::size_t>((entries + ways - 1) / ways, 1);
+
+	// Whole cache lines, with offsets and sizes that fit 32 bits
+	auto set_size = (std::max<std::size_t>(entry_size, 64) * ways + 63) / 64 * 64;
+
+	set_size = std::min<std::size_t>(set_size, std::numeric_limits<std::uint32_t>::max() / 2);
+
+	Descriptor descriptor{::open(path.c_str(), O_RDWR | O_CREAT, 0644)};
+
+	if (descriptor.file < 0)
+	{
+		throw Latex::FileException("Could not open cache " + path);
+	}
+
+	// Serializes the creation of the file between processes
+	if (::flock(descriptor.file, LOCK_EX) < 0)
+	{
+		throw Latex::FileException("Could not lock cache " + path);
+	}
+
+	struct stat status;
+
+	::fstat(descriptor.file, &status);
+
+	bool created = status.st_size == 0;
+
+	_mapping_size = header_size + sets * (sizeof(Set) + set_size);
+
+	if (created && ::ftruncate(descriptor.file, static_cast<off_t>(_mapping_size)) < 0)
+	{
+		throw Latex::FileException("Could not size cache " + path);
+	}
+
+	if (! created && static_cast<std::size_t>(status.st_size) != _mapping_size)
+	{
+		throw Latex::FileException(path + " is a cache of another size");
+	}
+
+	_mapping = ::mmap(nullptr,
+					  _mapping_size,
+					  PROT_READ | PROT_WRITE,
+					  MAP_SHARED,
+					  descriptor.file,
+					  0);
+
+	if (_mapping == MAP_FAILED)
+	{
+		_mapping = nullptr;
+
+		throw Latex::FileException("Could not map cache " + path);
+	}
+
+	_header = static_cast<Header*>(_mapping);
+
+	if (created)
+	{
+		// The file is zero-filled, which is every atomic's initial state
+		_header->sets = sets;
+		_header->set_size = set_size;
+		_header->ways = ways;
+
+		std::memcpy(_header->magic, magic, sizeof magic);
+	}
+
+	else if (std::memcmp(_header->magic, magic, sizeof magic) != 0 ||
+			 _header->sets != sets ||
+			 _header->set_size != set_size ||
+			 _header->ways != ways)
+	{
+		::munmap(_mapping, _mapping_size);
+
+		_mapping = nullptr;
+
+		throw Latex::FileException(path + " is not a cache of this geometry");
+	}
+
+	::flock(descriptor.file, LOCK_UN);
+
+	_suspects.resize(sets);
+
+	std::swap(_file, descriptor.file);
+}
+
+SharedCache::~SharedCache()
+{
+	if (_mapping) ::munmap(_mapping, _mapping_size);
+
+	if (_file >= 0) ::close(_file);
+}
+
+SharedCache::View SharedCache::find(const Key& key) const noexcept
+{
+	auto& set = _set(_index(key));
+
+	auto lock = set.lock.load(std::memory_order_acquire);
+
+	for (std::size_t way = 0; way < ways && ! (sequence_of(lock) & 1); ++way)
+	{
+		auto& entry = set.entries[way];
+
+		auto used = entry.used.load(std::memory_order_relaxed);
+
+		if (used == 0 || ! matches(entry, key)) continue;
+
+		auto offset = entry.offset.load(std::memory_order_relaxed);
+
+		auto size = entry.size.load(std::memory_order_relaxed);
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		// Torn by a writer, which may have moved any entry of the set
+		if (set.lock.load(std::memory_order_relaxed) != lock) break;
+
+		if (static_cast<std::size_t>(offset) + size > capacity()) break;
+
+		auto now = _header->clock.fetch_add(1, std::memory_order_relaxed) + 1;
+
+		// Unless a writer has emptied or replaced the entry since
+		entry.used.compare_exchange_strong(used, now, std::memory_order_relaxed);
+
+		_header->hits.fetch_add(1, std::memory_order_relaxed);
+
+		View view;
+
+		view._set = &set;
+		view._lock = lock;
+		view._data = set.data() + offset;
+		view._size = size;
+
+		return view;
+	}
+
+	_header->misses.fetch_add(1, std::memory_order_relaxed);
+
+	return View();
+}
+
+bool SharedCache::get(const Key& key, std::string& value) const
+{
+	return find(key).copy(value);
+}
+
+bool SharedCache::insert(const Key& key, const std::string& value) noexcept
+{
+	if (value.size() > capacity())
+	{
+		_header->oversized.fetch_add(1, std::memory_order_relaxed);
+
+		return false;
+	}
+
+	auto index = _index(key);
+
+	std::uint64_t lock;
+
+	if (! _lock(index, lock))
+	{
+		_header->skipped.fetch_add(1, std::memory_order_relaxed);
+
+		return false;
+	}
+
+	auto& set = _set(index);
+
+	// The old version of the entry goes first, without counting as an eviction
+	for (auto& entry : set.entries)
+	{
+		if (entry.used.load(std::memory_order_relaxed) != 0 && matches(entry, key)) clear(entry);
+	}
+
+	Entry* empty;
+
+	// Evict the least recently used entries until the value fits
+	while (true)
+	{
+		empty = nullptr;
+
+		Entry* oldest = nullptr;
+
+		std::size_t bytes = 0;
+
+		for (auto& entry : set.entries)
+		{
+			auto used = entry.used.load(std::memory_order_relaxed);
+
+			if (used == 0)
+			{
+				empty = &entry;
+
+				continue;
+			}
+
+			bytes += entry.size.load(std::memory_order_relaxed);
+
+			if (! oldest || used < oldest->used.load(std::memory_order_relaxed))
+			{
+				oldest = &entry;
+			}
+		}
+
+		if (empty && bytes + value.size() <= capacity()) break;
+
+		clear(*oldest);
+
+		_header->evictions.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	std::size_t end = 0;
+
+	for (auto& entry : set.entries)
+	{
+		if (entry.used.load(std::memory_order_relaxed) == 0) continue;
+
+		end = std::max<std::size_t>(end,
+									entry.offset.load(std::memory_order_relaxed) +
+									entry.size.load(std::memory_order_relaxed));
+	}
+
+	// The free space is all there, but not all after the last entry
+	if (end + value.size() > capacity()) end = compact(set);
+
+	std::memcpy(set.data() + end, value.data(), value.size());
+
+	empty->high.store(key.high, std::memory_order_relaxed);
+	empty->low.store(key.low, std::memory_order_relaxed);
+
+	empty->offset.store(static_cast<std::uint32_t>(end), std::memory_order_relaxed);
+	empty->size.store(static_cast<std::uint32_t>(value.size()), std::memory_order_relaxed);
+
+	auto now = _header->clock.fetch_add(1, std::memory_order_relaxed) + 1;
+
+	empty->used.store(now, std::memory_order_relaxed);
+
+	_unlock(index, lock);
+
+	_header->inserts.fetch_add(1, std::memory_order_relaxed);
+
+	return true;
+}
+
+std::size_t SharedCache::capacity() const noexcept
+{
+	return _header->set_size;
+}
+
+SharedCache::Statistics SharedCache::statistics() const noexcept
+{
+	Statistics statistics;
+
+	statistics.hits = _header->hits.load(std::memory_order_relaxed);
+	statistics.misses = _header->misses.load(std::memory_order_relaxed);
+	statistics.inserts = _header->inserts.load(std::memory_order_relaxed);
+	statistics.evictions = _header->evictions.load(std::memory_order_relaxed);
+	statistics.skipped = _header->skipped.load(std::memory_order_relaxed);
+	statistics.oversized = _header->oversized.load(std::memory_order_relaxed);
+	statistics.recovered = _header->recovered.load(std::memory_order_relaxed);
+
+	return statistics;
+}
+
+SharedCache::Key SharedCache::key(const std::string& equation,
+								  const std::string& options) noexcept
+{
+	// FNV-1a, which is the same in every process and build
+	std::uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for (unsigned char c : options)
+	{
+		hash ^= c;
+		hash *= 0x100000001b3ULL;
+	}
+
+	auto key = Canonical::digest(equation);
+
+	key.high ^= hash;
+	key.low ^= hash * 0x9e3779b97f4a7c15ULL;
+
+	return key;
+}
+
+SharedCache::Set& SharedCache::_set(std::size_t index) const noexcept
+{
+	auto base = static_cast<char*>(_mapping) + header_size;
+
+	return *reinterpret_cast<Set*>(base + index * (sizeof(Set) + _header->set_size));
+}
+
+std::size_t SharedCache::_index(const Key& key) const noexcept
+{
+	return static_cast<std::size_t>(key.low % _header->sets);
+}
+
+bool SharedCache::_lock(std::size_t index, std::uint64_t& lock) noexcept
+{
+	auto& set = _set(index);
+
+	auto current = set.lock.load(std::memory_order_relaxed);
+
+	auto sequence = sequence_of(current) + 1;
+
+	bool abandoned = sequence_of(current) & 1;
+
+	if (abandoned)
+	{
+		// Busy, unless the same lock has been held for too long; it is
+		// then taken over, staying odd as the set's contents are torn
+		try
+		{
+			if (! _abandoned(index, current)) return false;
+		}
+
+		catch (const std::system_error&)
+		{
+			return false;
+		}
+
+		sequence = sequence_of(current) + 2;
+	}
+
+	auto token = static_cast<std::uint32_t>(_header->tokens.fetch_add(1, std::memory_order_relaxed) + 1);
+
+	auto locked = lock_word(token, sequence);
+
+	// Fails if anyone took or released the lock since it was read,
+	// so a lock is only ever taken over from the writer that was timed
+	if (! set.lock.compare_exchange_strong(current,
+										   locked,
+										   std::memory_order_acquire,
+										   std::memory_order_relaxed))
+	{
+		return false;
+	}
+
+	// Readers must see the odd sequence before any new contents
+	std::atomic_thread_fence(std::memory_order_release);
+
+	if (abandoned)
+	{
+		for (auto& entry : set.entries) clear(entry);
+
+		_header->recovered.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	lock = locked;
+
+	return true;
+}
+
+void SharedCache::_unlock(std::size_t index, std::uint64_t lock) noexcept
+{
+	auto& set = _set(index);
+
+	auto unlocked = lock_word(token_of(lock), sequence_of(lock) + 1);
+
+	if (set.lock.compare_exchange_strong(lock,
+										 unlocked,
+										 std::memory_order_release,
+										 std::memory_order_relaxed))
+	{
+		return;
+	}
+
+	// This writer was stalled for longer than the timeout, and wrote
+	// into the set alongside the writer that took the lock over
+	for (std::size_t attempt = 0; attempt < repair_attempts; ++attempt)
+	{
+		std::uint64_t again;
+
+		if (_lock(index, again))
+		{
+			for (auto& entry : set.entries) clear(entry);
+
+			set.lock.store(lock_word(token_of(again), sequence_of(again) + 1),
+						   std::memory_order_release);
+
+			return;
+		}
+
+		std::this_thread::yield();
+	}
+}
+
+bool SharedCache::_abandoned(std::size_t index, std::uint64_t lock) const
+{
+	auto now = std::chrono::steady_clock::now();
+
+	std::lock_guard<std::mutex> guard(_suspects_mutex);
+
+	auto& suspect = _suspects[index];
+
+	// Lock words are unique to a lock, so an unchanged word is the same lock
+	if (suspect.lock != lock)
+	{
+		suspect.lock = lock;
+
+		suspect.since = now;
+
+		return false;
+	}
+
+	return now - suspect.since >= lock_timeout;
+}
@@ -0,0 +1,272 @@
+/********************************************************//*!
+*
+*	@file shared_cache.hpp
+*
+*	@author Peter Goldsborough.
+*
+************************************************************/
+
+#ifndef SHARED_CACHE_HPP
+#define SHARED_CACHE_HPP
+
+#include "canonical.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/***************************************************************************//*!
+*
+*	@brief A render cache in a memory-mapped file that processes share.
+*
+*	@details The cache is a fixed-size, set-associative hash table. It
+*			 lives in a file, and every process that opens the same file
+*			 sees the same cache. Put the file on a tmpfs like /dev/shm to
+*			 keep it in memory. It survives worker restarts and is only
+*			 gone when the file is removed.
+*
+*			 Each key maps to a set of 16 entries, which share one data
+*			 area. Entries are variable-length: a snippet of a few hundred
+*			 bytes takes no more room than that, and an SVG can take the
+*			 whole area. Within a set, the least recently used entries are
+*			 evicted until a new one fits, and the rest are compacted when
+*			 the free space is fragmented.
+*
+*			 Every set is guarded by a sequence lock. Readers never block
+*			 or write the data, and writers never wait: a writer that
+*			 finds its set busy gives up the insert. Each lock is taken
+*			 with a token unique to it, so a lock that stays the same for
+*			 longer than a timeout is known to be left by a writer that
+*			 died (or was stopped) mid-write, without asking the process,
+*			 which may be in another PID namespace or reused. The next
+*			 writer then takes it over and empties the set.
+*
+*			 find() returns a view of the entry in the mapping itself,
+*			 without copying it. A later insert into the same set may
+*			 overwrite or move the entry, so a view's contents only count
+*			 once View::valid() confirms them, after they have been used
+*			 (say, copied into a response).
+*
+*	@see Latex::cache()
+*
+*******************************************************************************/
+
+class SharedCache
+{
+public:
+
+	using Key = Canonical::Fingerprint;
+
+	struct Set;
+
+	struct Entry;
+
+	/*! A view of a cached entry. */
+	class View
+	{
+	public:
+
+		View() = default;
+
+		/*! Whether the entry was found. */
+		explicit operator bool() const noexcept { return _data != nullptr; }
+
+		/*! The entry's bytes, in the shared mapping. */
+		const char* data() const noexcept { return _data; }
+
+		std::size_t size() const noexcept { return _size; }
+
+		/*! Whether the entry is still the one that was found, i.e.
+		    whether everything read from data() so far is valid. */
+		bool valid() const noexcept;
+
+		/*! Copies the entry, returning false if it changed meanwhile. */
+		bool copy(std::string& output) const;
+
+	private:
+
+		friend class SharedCache;
+
+		const Set* _set = nullptr;
+
+		/*! The set's lock word when the entry was found. */
+		std::uint64_t _lock = 0;
+
+		const char* _data = nullptr;
+
+		std::size_t _size = 0;
+	};
+
+	/*! Counts kept in the file, across all processes. */
+	struct Statistics
+	{
+		std::uint64_t hits = 0;
+
+		std::uint64_t misses = 0;
+
+		std::uint64_t inserts = 0;
+
+		std::uint64_t evictions = 0;
+
+		/*! Inserts given up because the set was busy. */
+		std::uint64_t skipped = 0;
+
+		/*! Inserts given up because the value was larger than
+		    capacity(). */
+		std::uint64_t oversized = 0;
+
+		/*! Locks taken over from writers that died mid-write. */
+		std::uint64_t recovered = 0;
+	};
+
+	/***********************************************************************//*!
+	*
+	*	@brief Opens a cache file, creating it if it doesn't exist.
+	*
+	*	@param path The cache file, e.g. /dev/shm/latexpp-cache.
+	*
+	*	@param entries The number of entries (rounded up to a whole set).
+	*
+	*	@param entry_size The average size of an entry in bytes. A set's
+	*		   data area holds 16 times as much, and a single entry can
+	*		   take all of it (see capacity()).
+	*
+	*	@throws Latex::FileException If the file could not be opened or
+	*			mapped, or is an existing cache of a different geometry.
+	*
+	***************************************************************************/
+
+	explicit SharedCache(const std::string& path,
+						 std::size_t entries = 32768,
+						 std::size_t entry_size = 4096);
+
+	SharedCache(const SharedCache& other) = delete;
+
+	SharedCache& operator=(const SharedCache& other) = delete;
+
+	/***********************************************************************//*!
+	*
+	*	@brief Unmaps the cache. The file and its entries stay.
+	*
+	***************************************************************************/
+
+	virtual ~SharedCache();
+
+	/***********************************************************************//*!
+	*
+	*	@brief Looks an entry up.
+	*
+	*	@return A view of the entry, which is false if there is none.
+	*
+	***************************************************************************/
+
+	virtual View find(const Key& key) const noexcept;
+
+	/***********************************************************************//*!
+	*
+	*	@brief Looks an entry up and copies it.
+	*
+	*	@return Whether the entry was found (and was not overwritten
+	*			while being copied).
+	*
+	***************************************************************************/
+
+	virtual bool get(const Key& key, std::string& value) const;
+
+	/***********************************************************************//*!
+	*
+	*	@brief Stores an entry, evicting another one if needed.
+	*
+	*	@return False if the entry was not stored, because it was too
+	*			large or another process was writing the same set.
+	*
+	***************************************************************************/
+
+	virtual bool insert(const Key& key, const std::string& value) noexcept;
+
+	/***********************************************************************//*!
+	*
+	*	@brief Returns the largest entry the cache can hold, in bytes:
+	*		   the size of a set's data area.
+	*
+	***************************************************************************/
+
+	std::size_t capacity() const noexcept;
+
+	/***********************************************************************//*!
+	*
+	*	@brief Returns the statistics of all processes using the cache.
+	*
+	***************************************************************************/
+
+	Statistics statistics() const noexcept;
+
+	/***********************************************************************//*!
+	*
+	*	@brief Derives a key from an equation and what else its render
+	*		   depends on.
+	*
+	*	@details Only the same spelling of an equation shares a key, as
+	*			 rendered output echoes the spelling (see Canonical).
+	*
+	*	@param equation The LaTeX equation.
+	*
+	*	@param options Everything else the result depends on, e.g. the
+	*		   output format and CSS.
+	*
+	***************************************************************************/
+
+	static Key key(const std::string& equation, const std::string& options) noexcept;
+
+	struct Header;
+
+protected:
+
+	/*! Returns the i-th set. */
+	Set& _set(std::size_t index) const noexcept;
+
+	/*! Returns the index of the set a key maps to. */
+	std::size_t _index(const Key& key) const noexcept;
+
+	/*! Claims a set for writing, taking over a lock a dead writer
+	    left behind, and sets lock to the set's new lock word. */
+	bool _lock(std::size_t index, std::uint64_t& lock) noexcept;
+
+	/*! Releases a set. If the lock was taken over meanwhile, what
+	    was written may have torn the new owner's entries, so the set
+	    is emptied as soon as it is free again. */
+	void _unlock(std::size_t index, std::uint64_t lock) noexcept;
+
+	/*! Returns whether a set has been locked with the same lock word
+	    for longer than the timeout, as seen by this process. */
+	bool _abandoned(std::size_t index, std::uint64_t lock) const;
+
+	/*! A busy lock word this process saw, and when it first saw it. */
+	struct Suspect
+	{
+		std::uint64_t lock = 0;
+
+		std::chrono::steady_clock::time_point since;
+	};
+
+	/*! The file descriptor of the cache file. */
+	int _file;
+
+	/*! The mapping of the whole file. */
+	void* _mapping;
+
+	std::size_t _mapping_size;
+
+	Header* _header;
+
+	/*! The last busy lock word seen on every set. */
+	mutable std::vector<Suspect> _suspects;
+
+	mutable std::mutex _suspects_mutex;
+};
+
+#endif /* SHARED_CACHE_HPP */
@@ -0,0 +1,161 @@
+/********************************************************//*!
+*
+*	@file single_flight.hpp
+*
+*	@author Peter Goldsborough.
+*
+************************************************************/
+
+#ifndef SINGLE_FLIGHT_HPP
+#define SINGLE_FLIGHT_HPP
+
+#include <cstddef>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/***************************************************************************//*!
+*
+*	@brief Coalesces concurrent identical renders into one.
+*
+*	@details When many threads ask for the same thing at the same time (say,
+*			 the images of a freshly published page), the first caller for
+*			 a key does the work and all callers arriving while it is in
+*			 flight wait for, and share, its result or exception. Nothing
+*			 is cached beyond that: once a flight lands, the next caller
+*			 for the key starts a new one.
+*
+*			 All member functions are thread-safe.
+*
+*	@tparam Value The (copyable) result type of a render.
+*
+*******************************************************************************/
+
+template<typename Value>
+class SingleFlight
+{
+public:
+
+	/*! How much work was done and how much was saved. */
+	struct Statistics
+	{
+		/*! Calls that did the work themselves. */
+		std::size_t executed = 0;
+
+		/*! Calls that waited on another call's work instead. */
+		std::size_t coalesced = 0;
+	};
+
+	/***********************************************************************//*!
+	*
+	*	@brief Runs a function, unless one with the same key is in flight.
+	*
+	*	@details The key must capture everything the result depends on,
+	*			 e.g. the equation, the output format, engine options
+	*			 and CSS.
+	*
+	*	@param key The identity of the work.
+	*
+	*	@param function A callable returning a Value.
+	*
+	*	@return The value returned by whichever call did the work.
+	*
+	*	@throws Any exception thrown by whichever call did the work.
+	*
+	***************************************************************************/
+
+	template<typename Function>
+	Value run(const std::string& key, Function function)
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+
+		auto flight = _flights.find(key);
+
+		if (flight != _flights.end())
+		{
+			auto future = flight->second;
+
+			++_statistics.coalesced;
+
+			lock.unlock();
+
+			return future.get();
+		}
+
+		std::promise<Value> promise;
+
+		_flights.emplace(key, promise.get_future().share());
+
+		++_statistics.executed;
+
+		lock.unlock();
+
+		try
+		{
+			Value value = function();
+
+			_land(key);
+
+			promise.set_value(value);
+
+			return value;
+		}
+
+		catch (...)
+		{
+			_land(key);
+
+			promise.set_exception(std::current_exception());
+
+			throw;
+		}
+	}
+
+	/***********************************************************************//*!
+	*
+	*	@brief Returns the number of calls that did or saved work so far.
+	*
+	***************************************************************************/
+
+	Statistics statistics() const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		return _statistics;
+	}
+
+	/***********************************************************************//*!
+	*
+	*	@brief Returns the number of distinct keys currently in flight.
+	*
+	***************************************************************************/
+
+	std::size_t in_flight() const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		return _flights.size();
+	}
+
+private:
+
+	/*! Ends a flight, such that later calls start a new one. */
+	void _land(const std::string& key)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		_flights.erase(key);
+	}
+
+	/*! Guards the flights and the statistics. */
+	mutable std::mutex _mutex;
+
+	/*! The results of the calls in flight, by key. */
+	std::unordered_map<std::string, std::shared_future<Value>> _flights;
+
+	Statistics _statistics;
+};
+
+#endif /* SINGLE_FLIGHT_HPP */
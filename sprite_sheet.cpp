@@ -0,0 +1,331 @@
+#include "sprite_sheet.hpp"
+#include "latex.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <zlib.h>
+
+namespace
+{
+	const unsigned char white = 0xFF;
+
+	/*! Reads a number of a PPM header, skipping whitespace and comments. */
+	std::size_t header_number(const std::string& ppm, std::size_t& i)
+	{
+		while (i < ppm.size())
+		{
+			if (ppm[i] == '#')
+			{
+				while (i < ppm.size() && ppm[i] != '\n') ++i;
+			}
+
+			else if (std::isspace(static_cast<unsigned char>(ppm[i]))) ++i;
+
+			else break;
+		}
+
+		if (i == ppm.size() || ! std::isdigit(static_cast<unsigned char>(ppm[i])))
+		{
+			throw Latex::ConversionException("Malformed PPM image header!");
+		}
+
+		std::size_t number = 0;
+
+		for ( ; i < ppm.size() && std::isdigit(static_cast<unsigned char>(ppm[i])); ++i)
+		{
+			number = number * 10 + static_cast<std::size_t>(ppm[i] - '0');
+		}
+
+		return number;
+	}
+
+	void put32(std::string& output, std::uint32_t value)
+	{
+		output += static_cast<char>(value >> 24);
+		output += static_cast<char>(value >> 16);
+		output += static_cast<char>(value >> 8);
+		output += static_cast<char>(value);
+	}
+
+	void chunk(std::string& png, const char* type, const std::string& data)
+	{
+		put32(png, static_cast<std::uint32_t>(data.size()));
+
+		auto start = png.size();
+
+		png.append(type, 4);
+		png += data;
+
+		auto bytes = reinterpret_cast<const Bytef*>(png.data() + start);
+
+		put32(png, static_cast<std::uint32_t>(crc32(0, bytes, static_cast<uInt>(png.size() - start))));
+	}
+}
+
+std::size_t SpriteSheet::pack(std::vector<Sprite>& cells, std::size_t width)
+{
+	std::size_t x = 0;
+	std::size_t y = 0;
+
+	std::size_t row = 0;
+
+	for (auto& cell : cells)
+	{
+		if (x > 0 && x + cell.width > width)
+		{
+			x = 0;
+
+			y += row;
+
+			row = 0;
+		}
+
+		cell.x = x;
+		cell.y = y;
+
+		x += cell.width;
+
+		row = std::max(row, cell.height);
+	}
+
+	return y + row;
+}
+
+SpriteSheet::SpriteSheet(const std::string& ppm,
+						 const std::vector<Sprite>& cells,
+						 std::size_t padding)
+{
+	if (ppm.compare(0, 2, "P6") != 0)
+	{
+		throw Latex::ConversionException("Expected a PPM image!");
+	}
+
+	std::size_t i = 2;
+
+	_width = header_number(ppm, i);
+	_height = header_number(ppm, i);
+
+	if (header_number(ppm, i) != 255)
+	{
+		throw Latex::ConversionException("Expected an 8-bit PPM image!");
+	}
+
+	// A single whitespace character ends the header
+	auto size = _width * _height * 3;
+
+	if (ppm.size() < ++i + size)
+	{
+		throw Latex::ConversionException("Truncated PPM image!");
+	}
+
+	_pixels.assign(ppm, i, size);
+
+	_sprites.reserve(cells.size());
+
+	_clipped_sprites.reserve(cells.size());
+
+	for (const auto& cell : cells)
+	{
+		_sprites.push_back(_trim(cell, padding));
+
+		_clipped_sprites.push_back(_clipped(cell, padding));
+	}
+}
+
+std::size_t SpriteSheet::width() const noexcept
+{
+	return _width;
+}
+
+std::size_t SpriteSheet::height() const noexcept
+{
+	return _height;
+}
+
+std::size_t SpriteSheet::size() const noexcept
+{
+	return _sprites.size();
+}
+
+const std::vector<SpriteSheet::Sprite>& SpriteSheet::sprites() const noexcept
+{
+	return _sprites;
+}
+
+bool SpriteSheet::clipped(std::size_t index) const
+{
+	return _clipped_sprites.at(index);
+}
+
+std::string SpriteSheet::png() const
+{
+	Sprite whole;
+
+	whole.width = _width;
+	whole.height = _height;
+
+	return _png(whole);
+}
+
+std::string SpriteSheet::png(std::size_t index) const
+{
+	return _png(_sprites.at(index));
+}
+
+std::string SpriteSheet::manifest() const
+{
+	std::string json = "{\"width\":" + std::to_string(_width);
+
+	json += ",\"height\":" + std::to_string(_height) + ",\"sprites\":[";
+
+	for (std::size_t i = 0; i < _sprites.size(); ++i)
+	{
+		const auto& sprite = _sprites[i];
+
+		if (i > 0) json += ',';
+
+		json += "{\"x\":" + std::to_string(sprite.x);
+		json += ",\"y\":" + std::to_string(sprite.y);
+		json += ",\"width\":" + std::to_string(sprite.width);
+		json += ",\"height\":" + std::to_string(sprite.height) + "}";
+	}
+
+	return json + "]}";
+}
+
+std::string SpriteSheet::_png(const Sprite& area) const
+{
+	static const char signature[] = "\x89PNG\r\n\x1a\n";
+
+	std::string png(signature, 8);
+
+	std::string header;
+
+	put32(header, static_cast<std::uint32_t>(area.width));
+	put32(header, static_cast<std::uint32_t>(area.height));
+
+	// 8-bit RGB, deflate, adaptive filtering, no interlacing
+	header += std::string("\x08\x02\x00\x00\x00", 5);
+
+	chunk(png, "IHDR", header);
+
+	// Each row starts with its filter type, none
+	std::string rows;
+
+	rows.reserve(area.height * (1 + area.width * 3));
+
+	for (auto y = area.y; y < area.y + area.height; ++y)
+	{
+		rows += '\0';
+
+		rows.append(_pixels, (y * _width + area.x) * 3, area.width * 3);
+	}
+
+	auto bound = compressBound(static_cast<uLong>(rows.size()));
+
+	std::string data(bound, '\0');
+
+	if (compress2(reinterpret_cast<Bytef*>(&data[0]),
+				  &bound,
+				  reinterpret_cast<const Bytef*>(rows.data()),
+				  static_cast<uLong>(rows.size()),
+				  Z_DEFAULT_COMPRESSION) != Z_OK)
+	{
+		throw Latex::ConversionException("Could not compress PNG image!");
+	}
+
+	data.resize(bound);
+
+	chunk(png, "IDAT", data);
+
+	chunk(png, "IEND", std::string());
+
+	return png;
+}
+
+SpriteSheet::Sprite SpriteSheet::_trim(const Sprite& cell, std::size_t padding) const
+{
+	// Cells may reach past the page if it was cut short
+	auto right = std::min(cell.x + cell.width, _width);
+	auto bottom = std::min(cell.y + cell.height, _height);
+
+	auto left = right;
+	auto top = bottom;
+
+	std::size_t ink_right = 0;
+	std::size_t ink_bottom = 0;
+
+	for (auto y = cell.y; y < bottom; ++y)
+	{
+		auto row = reinterpret_cast<const unsigned char*>(_pixels.data()) + y * _width * 3;
+
+		for (auto x = cell.x; x < right; ++x)
+		{
+			auto pixel = row + x * 3;
+
+			if (pixel[0] == white && pixel[1] == white && pixel[2] == white) continue;
+
+			left = std::min(left, x);
+			top = std::min(top, y);
+
+			ink_right = std::max(ink_right, x + 1);
+			ink_bottom = std::max(ink_bottom, y + 1);
+		}
+	}
+
+	Sprite sprite;
+
+	// Blank (such as \, alone), so keep a pixel
+	if (left == right)
+	{
+		sprite.x = std::min(cell.x, _width ? _width - 1 : 0);
+		sprite.y = std::min(cell.y, _height ? _height - 1 : 0);
+
+		sprite.width = std::min<std::size_t>(1, _width);
+		sprite.height = std::min<std::size_t>(1, _height);
+
+		return sprite;
+	}
+
+	sprite.x = left - std::min(padding, left - cell.x);
+	sprite.y = top - std::min(padding, top - cell.y);
+
+	sprite.width = std::min(ink_right + padding, right) - sprite.x;
+	sprite.height = std::min(ink_bottom + padding, bottom) - sprite.y;
+
+	return sprite;
+}
+
+bool SpriteSheet::_clipped(const Sprite& cell, std::size_t padding) const
+{
+	// Too small to have a margin inside
+	if (cell.width <= 2 * padding + 2 || cell.height <= 2 * padding + 2) return true;
+
+	auto left = cell.x + padding;
+	auto top = cell.y + padding;
+
+	auto right = cell.x + cell.width - padding;
+	auto bottom = cell.y + cell.height - padding;
+
+	if (right > _width || bottom > _height) return true;
+
+	auto ink = [this] (std::size_t x, std::size_t y) {
+		auto pixel = reinterpret_cast<const unsigned char*>(_pixels.data()) + (y * _width + x) * 3;
+
+		return pixel[0] != white || pixel[1] != white || pixel[2] != white;
+	};
+
+	for (auto x = left; x < right; ++x)
+	{
+		if (ink(x, top) || ink(x, bottom - 1)) return true;
+	}
+
+	for (auto y = top; y < bottom; ++y)
+	{
+		if (ink(left, y) || ink(right - 1, y)) return true;
+	}
+
+	return false;
+}
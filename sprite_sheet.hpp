@@ -0,0 +1,177 @@
+/********************************************************//*!
+*
+*	@file sprite_sheet.hpp
+*
+*	@author Peter Goldsborough.
+*
+************************************************************/
+
+#ifndef SPRITE_SHEET_HPP
+#define SPRITE_SHEET_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/***************************************************************************//*!
+*
+*	@brief Many equations rasterized onto one image, and where each is.
+*
+*	@details Most of the cost of an image is wkhtmltoimage's per-page
+*			 work: creating a converter, loading the page, its stylesheet
+*			 and fonts. A sprite sheet pays for that once per batch. The
+*			 equations are laid out in cells on one page (see pack()),
+*			 and the page is rasterized once. Each equation's sprite is
+*			 then found from the pixels of its cell: the box around all
+*			 non-white pixels, plus some padding. Sprites can be cut out
+*			 as images of their own, or the sheet can be served whole
+*			 along with its manifest() of sprite coordinates. Cells are
+*			 sized from estimates, so a sheet also tells which sprites
+*			 were clipped at the edge of their box.
+*
+*			 Sheets hold the raw RGB pixels of the page and encode PNGs
+*			 on demand, with zlib.
+*
+*	@see Latex::to_sprite_sheet()
+*
+*******************************************************************************/
+
+class SpriteSheet
+{
+public:
+
+	/*! A rectangle of the sheet, in pixels. */
+	struct Sprite
+	{
+		std::size_t x = 0;
+
+		std::size_t y = 0;
+
+		std::size_t width = 0;
+
+		std::size_t height = 0;
+	};
+
+	/***********************************************************************//*!
+	*
+	*	@brief Lays cells out in rows, in order.
+	*
+	*	@details A row takes cells until the next one would make it
+	*			 wider than the sheet. It is as tall as its tallest cell.
+	*			 Cells wider than the sheet get a row to themselves.
+	*
+	*	@param cells The cells, whose x and y are set.
+	*
+	*	@param width The width of the sheet.
+	*
+	*	@return The height of the sheet.
+	*
+	***************************************************************************/
+
+	static std::size_t pack(std::vector<Sprite>& cells, std::size_t width);
+
+	/***********************************************************************//*!
+	*
+	*	@brief Constructs a sheet from a rasterized page.
+	*
+	*	@param ppm The page as a binary PPM (P6) image.
+	*
+	*	@param cells Where the equations were laid out on the page.
+	*
+	*	@param padding The white margin kept around each sprite's
+	*		   pixels, within its cell.
+	*
+	*	@throws Latex::ConversionException If the image is not a PPM.
+	*
+	***************************************************************************/
+
+	SpriteSheet(const std::string& ppm,
+				const std::vector<Sprite>& cells,
+				std::size_t padding = 2);
+
+	virtual ~SpriteSheet() = default;
+
+	/*! The width of the sheet in pixels. */
+	std::size_t width() const noexcept;
+
+	/*! The height of the sheet in pixels. */
+	std::size_t height() const noexcept;
+
+	/*! The number of sprites. */
+	std::size_t size() const noexcept;
+
+	/*! The sprites, in the order of the equations. */
+	const std::vector<Sprite>& sprites() const noexcept;
+
+	/***********************************************************************//*!
+	*
+	*	@brief Returns whether a sprite was clipped.
+	*
+	*	@details The box of an equation is its cell without the padding.
+	*			 Boxes are laid out with a white margin inside, so ink on
+	*			 the outermost pixels of a box means the equation did not
+	*			 fit it (or the page was cut short).
+	*
+	***************************************************************************/
+
+	bool clipped(std::size_t index) const;
+
+	/***********************************************************************//*!
+	*
+	*	@brief Returns the whole sheet as a PNG image.
+	*
+	*	@throws Latex::ConversionException If the image could not be encoded.
+	*
+	***************************************************************************/
+
+	virtual std::string png() const;
+
+	/***********************************************************************//*!
+	*
+	*	@brief Returns one sprite as a PNG image.
+	*
+	*	@throws Latex::ConversionException If the image could not be encoded.
+	*
+	***************************************************************************/
+
+	virtual std::string png(std::size_t index) const;
+
+	/***********************************************************************//*!
+	*
+	*	@brief Returns the coordinates of the sprites as JSON.
+	*
+	*	@details Of the form {"width":W,"height":H,"sprites":[{"x":X,
+	*			 "y":Y,"width":W,"height":H},...]}, the sprites in the
+	*			 order of the equations.
+	*
+	***************************************************************************/
+
+	virtual std::string manifest() const;
+
+protected:
+
+	/*! Encodes a rectangle of the sheet as a PNG image. */
+	virtual std::string _png(const Sprite& area) const;
+
+	/*! Returns the box around the non-white pixels of a cell,
+	    grown by the padding within the cell. */
+	virtual Sprite _trim(const Sprite& cell, std::size_t padding) const;
+
+	/*! Returns whether there are non-white pixels on the edge
+	    of a cell's box, its cell without the padding. */
+	virtual bool _clipped(const Sprite& cell, std::size_t padding) const;
+
+	std::size_t _width;
+
+	std::size_t _height;
+
+	/*! The pixels, row by row, three bytes (RGB) each. */
+	std::string _pixels;
+
+	std::vector<Sprite> _sprites;
+
+	/*! Whether each sprite was clipped. */
+	std::vector<bool> _clipped_sprites;
+};
+
+#endif /* SPRITE_SHEET_HPP */
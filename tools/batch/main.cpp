@@ -0,0 +1,582 @@
+#include "../../latex_pool.hpp"
+#include "../../sprite_sheet.hpp"
+#include "../options.hpp"
+
+#include <algorithm>
+#include <boost/filesystem.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	struct Options
+	{
+		std::string input = "-";
+
+		std::string directory = ".";
+
+		std::size_t engines = std::thread::hardware_concurrency();
+
+		bool ordered = false;
+
+		/*! Equations per sprite sheet for PNGs, 0 for a page each. */
+		std::size_t sprites = 0;
+	};
+
+	struct Job
+	{
+		std::size_t sequence;
+
+		std::string id;
+
+		std::string latex;
+
+		std::vector<std::string> formats;
+	};
+
+	void usage(const char* program)
+	{
+		std::cerr << "Usage: " << program
+				  << " [-i input.ndjson] [-o directory] [-j engines] [-s count] [--ordered]\n\n"
+				  << "Reads one {\"id\", \"latex\", \"formats\"} JSON object per line\n"
+				  << "(from stdin by default) and writes one JSON result per line\n"
+				  << "to stdout. Formats are any of html, png, jpg and svg; images\n"
+				  << "are written to the output directory as <id>.<format>.\n"
+				  << "The engines render HTML in parallel, but images are all\n"
+				  << "rasterized on one thread, so they don't scale with -j.\n"
+				  << "Results are written in completion order, unless --ordered\n"
+				  << "is given, in which case they follow the input order.\n"
+				  << "With -s, the PNGs of every count consecutive equations\n"
+				  << "are rasterized together on one sprite sheet and cut out,\n"
+				  << "which is much faster for bulk exports. These PNGs are\n"
+				  << "trimmed to the equation." << std::endl;
+	}
+
+	bool parse_options(int argc, const char* argv[], Options& options)
+	{
+		for (int i = 1; i < argc; ++i)
+		{
+			std::string argument = argv[i];
+
+			if (argument == "--ordered") options.ordered = true;
+
+			else if (i + 1 >= argc) return false;
+
+			else if (argument == "-i") options.input = argv[++i];
+
+			else if (argument == "-o") options.directory = argv[++i];
+
+			else if (argument == "-j")
+			{
+				if (! parse_count(argv[++i], options.engines)) return false;
+			}
+
+			else if (argument == "-s")
+			{
+				if (! parse_count(argv[++i], options.sprites)) return false;
+			}
+
+			else return false;
+		}
+
+		return true;
+	}
+
+	std::string escape(const std::string& text)
+	{
+		std::string escaped;
+
+		escaped.reserve(text.size() + 16);
+
+		for (unsigned char c : text)
+		{
+			switch (c)
+			{
+				case '"': escaped += "\\\""; break;
+
+				case '\\': escaped += "\\\\"; break;
+
+				case '\n': escaped += "\\n"; break;
+
+				case '\r': escaped += "\\r"; break;
+
+				case '\t': escaped += "\\t"; break;
+
+				default:
+					if (c < 0x20)
+					{
+						char code[7];
+
+						std::snprintf(code, sizeof code, "\\u%04x", c);
+
+						escaped += code;
+					}
+
+					else escaped += static_cast<char>(c);
+			}
+		}
+
+		return escaped;
+	}
+
+	std::string error_line(const std::string& id,
+						   const std::string& kind,
+						   const std::string& message,
+						   int position = -1)
+	{
+		std::string line = "{\"id\":\"" + escape(id) + "\",\"ok\":false,";
+
+		line += "\"error\":{\"kind\":\"" + kind + "\",";
+		line += "\"message\":\"" + escape(message) + "\"";
+
+		if (position >= 0)
+		{
+			line += ",\"position\":" + std::to_string(position);
+		}
+
+		return line + "}}";
+	}
+
+	std::string filename(const Job& job, const std::string& extension)
+	{
+		std::string name = job.id.empty() ? std::to_string(job.sequence) : job.id;
+
+		for (auto& c : name)
+		{
+			if (! std::isalnum(static_cast<unsigned char>(c)) &&
+				c != '-' && c != '_' && c != '.')
+			{
+				c = '_';
+			}
+		}
+
+		return name + "." + extension;
+	}
+
+	bool parse_job(const std::string& line, Job& job, std::string& error)
+	{
+		boost::property_tree::ptree tree;
+
+		std::istringstream stream(line);
+
+		try
+		{
+			boost::property_tree::read_json(stream, tree);
+		}
+
+		catch (const boost::property_tree::json_parser_error& exception)
+		{
+			error = exception.message();
+
+			return false;
+		}
+
+		job.id = tree.get<std::string>("id", std::to_string(job.sequence));
+
+		auto latex = tree.get_optional<std::string>("latex");
+
+		if (! latex)
+		{
+			error = "Missing 'latex' field";
+
+			return false;
+		}
+
+		job.latex = *latex;
+
+		auto formats = tree.get_child_optional("formats");
+
+		if (! formats) job.formats = {"html"};
+
+		// An empty array parses the same as an empty string
+		else if (formats->empty() && formats->data().empty())
+		{
+			error = "Empty 'formats' field, expected any of html, png, jpg and svg";
+
+			return false;
+		}
+
+		// A single format may be given as a plain string
+		else if (formats->empty()) job.formats = {formats->data()};
+
+		else for (const auto& format : *formats)
+		{
+			job.formats.push_back(format.second.data());
+		}
+
+		return true;
+	}
+
+	/*! Renders a job. Its PNG, if any, is written from png if given. */
+	std::string render(Latex& latex,
+					   const Job& job,
+					   const std::string& directory,
+					   bool& failed,
+					   const std::string* png = nullptr)
+	{
+		static const char* kinds[] = {"none", "parse", "engine"};
+
+		failed = true;
+
+		auto result = latex.try_to_html(job.latex);
+
+		if (! result)
+		{
+			return error_line(job.id,
+							  kinds[static_cast<int>(result.error.kind)],
+							  result.error.message,
+							  result.error.position);
+		}
+
+		std::string line = "{\"id\":\"" + escape(job.id) + "\",\"ok\":true";
+
+		std::string files;
+
+		for (const auto& format : job.formats)
+		{
+			if (format == "html")
+			{
+				line += ",\"html\":\"" + escape(result.html) + "\"";
+
+				continue;
+			}
+
+			Latex::ImageFormat image;
+
+			if (format == "png") image = Latex::ImageFormat::PNG;
+
+			else if (format == "jpg") image = Latex::ImageFormat::JPG;
+
+			else if (format == "svg") image = Latex::ImageFormat::SVG;
+
+			else return error_line(job.id, "input", "Unknown format " + format);
+
+			auto path = (boost::filesystem::path(directory) /
+						 filename(job, format)).string();
+
+			try
+			{
+				if (png && image == Latex::ImageFormat::PNG)
+				{
+					std::ofstream file(path, std::ios::binary);
+
+					if (! file.write(png->data(), static_cast<std::streamsize>(png->size())))
+					{
+						throw Latex::FileException("Could not write " + path);
+					}
+				}
+
+				else latex.to_image(job.latex, path, image);
+			}
+
+			catch (const Latex::ConversionException& exception)
+			{
+				return error_line(job.id, "conversion", exception.what());
+			}
+
+			catch (const Latex::FileException& exception)
+			{
+				return error_line(job.id, "file", exception.what());
+			}
+
+			if (! files.empty()) files += ",";
+
+			files += "\"" + format + "\":\"" + escape(path) + "\"";
+		}
+
+		if (! files.empty()) line += ",\"files\":{" + files + "}";
+
+		failed = false;
+
+		return line + "}";
+	}
+
+	/*! Writes result lines in completion or input order and keeps count. */
+	class Output
+	{
+	public:
+
+		Output(std::ostream& stream, bool ordered)
+		: _stream(stream)
+		, _ordered(ordered)
+		, _next(0)
+		, _written(0)
+		, _errors(0)
+		{ }
+
+		void write(std::size_t sequence, std::string line, bool failed)
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+
+			if (failed) ++_errors;
+
+			if (! _ordered)
+			{
+				_stream << line << '\n';
+
+				++_written;
+			}
+
+			else
+			{
+				_pending.emplace(sequence, std::move(line));
+
+				for (auto i = _pending.begin();
+					 i != _pending.end() && i->first == _next;
+					 i = _pending.erase(i), ++_next)
+				{
+					_stream << i->second << '\n';
+				}
+
+				_written = _next;
+			}
+
+			_done.notify_all();
+		}
+
+		/*! Blocks until fewer than limit lines are not yet written,
+		    whether in flight or completed and held back for order. */
+		void wait(std::size_t submitted, std::size_t limit)
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+
+			_done.wait(lock, [&] { return submitted - _written < limit; });
+		}
+
+		std::size_t errors()
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+
+			_stream.flush();
+
+			return _errors;
+		}
+
+	private:
+
+		std::ostream& _stream;
+
+		bool _ordered;
+
+		std::size_t _next;
+
+		/*! The number of lines written to the stream. */
+		std::size_t _written;
+
+		std::size_t _errors;
+
+		std::map<std::size_t, std::string> _pending;
+
+		std::mutex _mutex;
+
+		std::condition_variable _done;
+	};
+
+	void process(Latex& latex,
+				 const Job& job,
+				 const std::string& directory,
+				 Output& output,
+				 const std::string* png = nullptr)
+	{
+		bool failed = true;
+
+		std::string result;
+
+		try
+		{
+			result = render(latex, job, directory, failed, png);
+		}
+
+		catch (const std::exception& exception)
+		{
+			result = error_line(job.id, "engine", exception.what());
+		}
+
+		output.write(job.sequence, std::move(result), failed);
+	}
+
+	/*! Processes jobs together, cutting their PNGs from one sprite sheet. */
+	void process(Latex& latex,
+				 const std::vector<Job>& jobs,
+				 const std::string& directory,
+				 Output& output)
+	{
+		std::vector<std::string> equations;
+
+		std::vector<std::size_t> owners;
+
+		for (std::size_t i = 0; i < jobs.size(); ++i)
+		{
+			const auto& formats = jobs[i].formats;
+
+			if (std::find(formats.begin(), formats.end(), "png") != formats.end())
+			{
+				equations.push_back(jobs[i].latex);
+
+				owners.push_back(i);
+			}
+		}
+
+		std::vector<std::string> images;
+
+		if (! equations.empty())
+		{
+			try
+			{
+				auto sheet = latex.to_sprite_sheet(equations);
+
+				for (std::size_t i = 0; i < sheet.size(); ++i)
+				{
+					images.push_back(sheet.png(i));
+				}
+			}
+
+			// Any error spoils the whole sheet. Rendered one by one,
+			// the faulty job reports it and the others succeed.
+			catch (const std::exception&)
+			{
+				images.clear();
+			}
+		}
+
+		std::vector<const std::string*> pngs(jobs.size(), nullptr);
+
+		for (std::size_t i = 0; i < images.size(); ++i)
+		{
+			pngs[owners[i]] = &images[i];
+		}
+
+		for (std::size_t i = 0; i < jobs.size(); ++i)
+		{
+			process(latex, jobs[i], directory, output, pngs[i]);
+		}
+	}
+}
+
+int main(int argc, const char* argv[])
+{
+	Options options;
+
+	if (! parse_options(argc, argv, options))
+	{
+		usage(argv[0]);
+
+		return EXIT_FAILURE;
+	}
+
+	std::ifstream file;
+
+	if (options.input != "-")
+	{
+		file.open(options.input);
+
+		if (! file)
+		{
+			std::cerr << "Could not open " << options.input << std::endl;
+
+			return EXIT_FAILURE;
+		}
+	}
+
+	std::istream& input = (options.input == "-") ? std::cin : file;
+
+	boost::filesystem::create_directories(options.directory);
+
+	std::ios::sync_with_stdio(false);
+
+	auto start = std::chrono::steady_clock::now();
+
+	Output output(std::cout, options.ordered);
+
+	std::size_t submitted = 0;
+
+	{
+		LatexPool pool(options.engines);
+
+		options.engines = pool.size();
+
+		// Bounds memory (and the reorder buffer) for huge inputs
+		const auto limit = 4 * pool.size() * std::max<std::size_t>(options.sprites, 1);
+
+		auto& directory = options.directory;
+
+		// The jobs of the sprite sheet being gathered
+		std::vector<Job> sheet;
+
+		std::string line;
+
+		while (std::getline(input, line))
+		{
+			if (line.empty()) continue;
+
+			output.wait(submitted, limit);
+
+			Job job;
+
+			job.sequence = submitted++;
+
+			std::string error;
+
+			if (! parse_job(line, job, error))
+			{
+				output.write(job.sequence,
+							 error_line(job.id, "input", error),
+							 true);
+
+				continue;
+			}
+
+			if (options.sprites == 0)
+			{
+				pool.post([&output, &directory, job] (Latex& latex) {
+					process(latex, job, directory, output);
+				});
+
+				continue;
+			}
+
+			sheet.push_back(std::move(job));
+
+			if (sheet.size() < options.sprites) continue;
+
+			pool.post([&output, &directory, sheet] (Latex& latex) {
+				process(latex, sheet, directory, output);
+			});
+
+			sheet.clear();
+		}
+
+		if (! sheet.empty())
+		{
+			pool.post([&output, &directory, sheet] (Latex& latex) {
+				process(latex, sheet, directory, output);
+			});
+		}
+
+		// The pool's destructor waits for all remaining renders
+	}
+
+	auto errors = output.errors();
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	std::cerr << "Rendered " << submitted << " equations ("
+			  << errors << " errors) in " << elapsed.count() << " s, "
+			  << (submitted / elapsed.count()) << " equations/s with "
+			  << options.engines << " engines." << std::endl;
+
+	return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,204 @@
+#include "../../canonical.hpp"
+#include "../../latex.hpp"
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace
+{
+	/*! Spellings that canonicalization changes, in many ways. */
+	const char* const equations[] = {
+		" x^2 ",
+		"x ^ 2",
+		"x^{2}",
+		"x_{i}^{2}",
+		"x^{2}_{i}",
+		"a_{\\alpha}",
+		"e^{i \\pi} + 1 = 0",
+		"\\alpha _ i",
+		"\\frac {a} {b}",
+		"\\frac{1}{ 1 + x }",
+		"\\sqrt {x}",
+		"\\sqrt[ 3 ]{x}",
+		"\\sum_{i = 1}^{n} i",
+		"\\int _0 ^1 f(x) \\, dx",
+		"\\mathrm {d} x",
+		"\\mathbf{ A } x",
+		"f ( x ) = x ^ { 2 } + 1",
+		"\\left( x \\right)",
+		"\\left\\{ a , b \\right\\}",
+		"a \\cdot b",
+		"\\alpha\\beta \\gamma",
+		"\\text{a  b} + c",
+		"\\text{ if } x > 0",
+		"\\color{red}{ x + y }",
+		"\\begin{matrix} a & b \\\\ c & d \\end{matrix}",
+		"x' + y''",
+		"x^{'}",
+		"{x}",
+		"{ { x } }",
+		"a \\, b \\; c \\quad d",
+		"\\hat {a} \\vec{ v }",
+		"\\overline { z }",
+		"\\lim _{ n \\to \\infty } a_n",
+		"10 ^ { -3 }",
+		"1 , 000",
+		"a = b \\\\ c = d",
+		"\\Big ( x \\Big )",
+		"x _ {\\text{max}}",
+		"\\sin x + \\cos  y",
+		"\\operatorname {f} (x)"
+	};
+
+	void usage(const char* program)
+	{
+		std::cerr << "Usage: " << program << " [-i equations.txt]\n\n"
+				  << "Checks that equations look the same as their canonical\n"
+				  << "forms (see canonical.hpp). Both are rendered through KaTeX\n"
+				  << "and rasterized as complete pages, and KaTeX must accept\n"
+				  << "both or neither, and the pixels must be the same. The\n"
+				  << "markup is not expected to be the same, as it echoes the\n"
+				  << "spelling; equations whose markup differs in more than\n"
+				  << "the TeX annotation are counted. Equations are read one\n"
+				  << "per line (- for stdin), or a built-in set is used.\n"
+				  << "Differences are reported on stderr, and make the exit\n"
+				  << "status non-zero." << std::endl;
+	}
+
+	/*! Rasterizes complete pages to raw pixels. */
+	class Renderer : public Latex
+	{
+	public:
+
+		using Latex::Latex;
+
+		/*! Returns the page of an equation as a PPM image. */
+		std::string pixels(const std::string& latex) const
+		{
+			auto document = _document(latex, OutputMode::Full);
+
+			return _rasterize(document, "", ImageFormat::PNG, {{"fmt", "ppm"}});
+		}
+	};
+
+	/*! Returns markup without its TeX annotation, which echoes the input. */
+	std::string without_annotation(const std::string& html)
+	{
+		auto begin = html.find("<annotation");
+
+		auto end = html.find("</annotation>", begin);
+
+		if (begin == std::string::npos || end == std::string::npos) return html;
+
+		return html.substr(0, begin) + html.substr(end + std::string("</annotation>").size());
+	}
+}
+
+int main(int argc, const char* argv[])
+{
+	std::vector<std::string> corpus;
+
+	if (argc == 1)
+	{
+		corpus.assign(std::begin(equations), std::end(equations));
+	}
+
+	else if (argc == 3 && std::string(argv[1]) == "-i")
+	{
+		std::string path = argv[2];
+
+		std::ifstream file;
+
+		if (path != "-")
+		{
+			file.open(path);
+
+			if (! file)
+			{
+				std::cerr << "Could not open " << path << std::endl;
+
+				return EXIT_FAILURE;
+			}
+		}
+
+		std::istream& input = (path == "-") ? std::cin : file;
+
+		std::string equation;
+
+		while (std::getline(input, equation))
+		{
+			if (! equation.empty()) corpus.push_back(equation);
+		}
+	}
+
+	else
+	{
+		usage(argv[0]);
+
+		return EXIT_FAILURE;
+	}
+
+	std::size_t checked = 0;
+
+	std::size_t mismatches = 0;
+
+	std::size_t markup = 0;
+
+	try
+	{
+		Renderer renderer;
+
+		// Everything through KaTeX, the reference
+		renderer.fast_path(false);
+
+		for (const auto& equation : corpus)
+		{
+			auto form = Canonical::form(equation);
+
+			if (form == equation) continue;
+
+			++checked;
+
+			auto raw = renderer.try_to_html(equation);
+
+			auto canonical = renderer.try_to_html(form);
+
+			if (static_cast<bool>(raw) != static_cast<bool>(canonical))
+			{
+				++mismatches;
+
+				std::cerr << "KaTeX " << (raw ? "accepts " : "rejects ") << equation
+						  << " but " << (canonical ? "accepts " : "rejects ") << form
+						  << std::endl;
+
+				continue;
+			}
+
+			if (! raw) continue;
+
+			if (without_annotation(raw.html) != without_annotation(canonical.html)) ++markup;
+
+			if (renderer.pixels(equation) == renderer.pixels(form)) continue;
+
+			++mismatches;
+
+			std::cerr << equation << " looks different from " << form << std::endl;
+		}
+	}
+
+	catch (const std::exception& exception)
+	{
+		std::cerr << exception.what() << std::endl;
+
+		return EXIT_FAILURE;
+	}
+
+	std::cerr << "Compared " << checked << " equations with their canonical forms: "
+			  << mismatches << " differ, " << markup << " in markup beyond the "
+			  << "annotation." << std::endl;
+
+	return mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+}
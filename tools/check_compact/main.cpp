@@ -0,0 +1,248 @@
+#include "../../latex.hpp"
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace
+{
+	struct Options
+	{
+		/*! The equations, or empty for the built-in ones. */
+		std::string input;
+
+		/*! The base stylesheet, or empty for the bundled one. */
+		std::string stylesheet;
+
+		/*! A file of additional CSS, if any. */
+		std::string css;
+	};
+
+	/*! Equations exercising most of what KaTeX lays out. */
+	const char* const equations[] = {
+		"x",
+		"x_i^2",
+		"e^{i\\pi} + 1 = 0",
+		"\\frac{a}{b}",
+		"\\frac{1}{1 + \\frac{1}{x}}",
+		"\\dfrac{n!}{k!(n - k)!}",
+		"\\binom{n}{k}",
+		"\\sqrt{2}",
+		"\\sqrt[3]{x^2 + y^2}",
+		"\\sum_{i = 1}^{n} i = \\frac{n(n + 1)}{2}",
+		"\\int_0^\\infty e^{-x^2} dx = \\frac{\\sqrt\\pi}{2}",
+		"\\prod_{p} \\frac{1}{1 - p^{-s}}",
+		"\\lim_{n \\to \\infty} \\left(1 + \\frac{1}{n}\\right)^n",
+		"\\left[ \\begin{matrix} a & b \\\\ c & d \\end{matrix} \\right]",
+		"\\left\\{ x \\in \\mathbb{R} \\middle| x > 0 \\right\\}",
+		"\\overline{z} \\cdot \\underline{w}",
+		"\\hat{a} \\vec{v} \\tilde{n} \\bar{x} \\dot{y} \\ddot{y}",
+		"\\mathbf{A} \\mathit{B} \\mathrm{C} \\mathcal{D} \\mathfrak{E} \\mathsf{F} \\mathtt{G}",
+		"\\text{if } x \\geq 0",
+		"\\alpha \\beta \\gamma \\Gamma \\Delta \\Omega",
+		"a \\leq b \\neq c \\approx d \\equiv e",
+		"A \\subseteq B \\cup C \\cap D",
+		"f \\circ g \\colon X \\rightarrow Y",
+		"\\forall \\epsilon > 0 \\, \\exists \\delta > 0",
+		"\\nabla \\times \\mathbf{E} = -\\frac{\\partial \\mathbf{B}}{\\partial t}",
+		"\\langle \\psi | \\phi \\rangle",
+		"\\lfloor x \\rfloor + \\lceil y \\rceil",
+		"\\Big( \\big( x \\big) \\Big)",
+		"x \\quad y \\qquad z \\; w \\! v",
+		"\\color{red}{x} + \\color{blue}{y}",
+		"{\\scriptstyle a} {\\scriptscriptstyle b} {\\displaystyle c}",
+		"\\overbrace{a + b}^{n} \\underbrace{c + d}_{m}",
+		"\\cancel{x}",
+		"\\boxed{E = mc^2}",
+		"\\Huge x \\tiny y"
+	};
+
+	void usage(const char* program)
+	{
+		std::cerr << "Usage: " << program
+				  << " [-i equations.txt] [-s stylesheet] [-c css]\n\n"
+				  << "Checks that compact markup looks exactly like KaTeX's.\n"
+				  << "Each equation is rasterized as a complete page in full\n"
+				  << "and in compact output mode, and the pixels must be the\n"
+				  << "same. Equations are read one per line (- for stdin), or\n"
+				  << "a built-in set is used. With -s, the pages are styled\n"
+				  << "with another base stylesheet, and with -c, additional\n"
+				  << "CSS is read from a file and added. Differences are\n"
+				  << "reported on stderr, and make the exit status non-zero.\n"
+				  << "Equations KaTeX rejects are skipped." << std::endl;
+	}
+
+	bool parse_options(int argc, const char* argv[], Options& options)
+	{
+		for (int i = 1; i + 1 < argc; i += 2)
+		{
+			std::string argument = argv[i];
+
+			if (argument == "-i") options.input = argv[i + 1];
+
+			else if (argument == "-s") options.stylesheet = argv[i + 1];
+
+			else if (argument == "-c") options.css = argv[i + 1];
+
+			else return false;
+		}
+
+		return argc % 2 == 1;
+	}
+
+	bool read_file(const std::string& path, std::string& text)
+	{
+		std::ifstream file(path);
+
+		if (! file) return false;
+
+		text.assign(std::istreambuf_iterator<char>(file),
+					std::istreambuf_iterator<char>());
+
+		return true;
+	}
+
+	/*! Rasterizes complete pages to raw pixels. */
+	class Renderer : public Latex
+	{
+	public:
+
+		using Latex::Latex;
+
+		/*! Returns the page of an equation as a PPM image. */
+		std::string pixels(const std::string& latex, OutputMode mode) const
+		{
+			auto document = _document(latex, mode);
+
+			return _rasterize(document, "", ImageFormat::PNG, {{"fmt", "ppm"}});
+		}
+	};
+
+	/*! Returns the number of bytes that differ, if the sizes agree. */
+	std::size_t differences(const std::string& first, const std::string& second)
+	{
+		if (first.size() != second.size()) return first.size() + second.size();
+
+		std::size_t count = 0;
+
+		// Headers of the same size are the same, as are the image sizes
+		for (std::size_t i = 0; i < first.size(); ++i)
+		{
+			if (first[i] != second[i]) ++count;
+		}
+
+		return count;
+	}
+}
+
+int main(int argc, const char* argv[])
+{
+	Options options;
+
+	if (! parse_options(argc, argv, options))
+	{
+		usage(argv[0]);
+
+		return EXIT_FAILURE;
+	}
+
+	std::vector<std::string> corpus;
+
+	if (options.input.empty())
+	{
+		corpus.assign(std::begin(equations), std::end(equations));
+	}
+
+	else
+	{
+		std::ifstream file;
+
+		if (options.input != "-")
+		{
+			file.open(options.input);
+
+			if (! file)
+			{
+				std::cerr << "Could not open " << options.input << std::endl;
+
+				return EXIT_FAILURE;
+			}
+		}
+
+		std::istream& input = (options.input == "-") ? std::cin : file;
+
+		std::string equation;
+
+		while (std::getline(input, equation))
+		{
+			if (! equation.empty()) corpus.push_back(equation);
+		}
+	}
+
+	std::size_t checked = 0;
+
+	std::size_t skipped = 0;
+
+	std::size_t mismatches = 0;
+
+	try
+	{
+		Renderer renderer;
+
+		if (! options.stylesheet.empty()) renderer.stylesheet(options.stylesheet);
+
+		if (! options.css.empty())
+		{
+			std::string css;
+
+			if (! read_file(options.css, css))
+			{
+				std::cerr << "Could not open " << options.css << std::endl;
+
+				return EXIT_FAILURE;
+			}
+
+			renderer.add_css(css);
+		}
+
+		for (const auto& equation : corpus)
+		{
+			if (! renderer.try_to_html(equation))
+			{
+				++skipped;
+
+				continue;
+			}
+
+			++checked;
+
+			auto full = renderer.pixels(equation, Latex::OutputMode::Full);
+
+			auto compact = renderer.pixels(equation, Latex::OutputMode::Compact);
+
+			auto count = differences(full, compact);
+
+			if (count == 0) continue;
+
+			++mismatches;
+
+			std::cerr << "Compact page of " << equation << " differs in "
+					  << count << " bytes" << std::endl;
+		}
+	}
+
+	catch (const std::exception& exception)
+	{
+		std::cerr << exception.what() << std::endl;
+
+		return EXIT_FAILURE;
+	}
+
+	std::cerr << "Compared " << checked << " equations (" << skipped
+			  << " skipped): " << mismatches << " differ." << std::endl;
+
+	return mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,297 @@
+#include "../../fast_path.hpp"
+#include "../../latex.hpp"
+#include "../../sprite_sheet.hpp"
+#include "../options.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace
+{
+	struct Options
+	{
+		/*! The equations, or empty for the generated corpus. */
+		std::string input;
+
+		/*! How much wider than measured an equation's ink may be. */
+		std::size_t tolerance = 3;
+
+		/*! Equations per sprite sheet of the width check. */
+		std::size_t sheet = 200;
+	};
+
+	/*! The atoms of the fast path's subset (see fast_path.hpp). */
+	const char* const greek[] = {
+		"\\Gamma", "\\Delta", "\\Theta", "\\Lambda", "\\Xi", "\\Pi",
+		"\\Sigma", "\\Upsilon", "\\Phi", "\\Psi", "\\Omega",
+		"\\alpha", "\\beta", "\\gamma", "\\delta", "\\epsilon", "\\zeta",
+		"\\eta", "\\theta", "\\iota", "\\kappa", "\\lambda", "\\mu",
+		"\\nu", "\\xi", "\\pi", "\\rho", "\\sigma", "\\tau", "\\upsilon",
+		"\\phi", "\\chi", "\\psi", "\\omega", "\\varepsilon",
+		"\\vartheta", "\\varpi", "\\varrho", "\\varsigma", "\\varphi"
+	};
+
+	/*! The white margin of to_sprite_sheet() around a sprite's ink. */
+	const std::size_t sprite_margin = 2;
+
+	/*! The font size the widths are measured at, that of the page. */
+	const double font_size = 16;
+
+	void usage(const char* program)
+	{
+		std::cerr << "Usage: " << program << " [-i equations.txt] [-t pixels] [-s count]\n\n"
+				  << "Checks the native renderers against the engine. Every\n"
+				  << "equation the fast path accepts must render to exactly\n"
+				  << "the markup of KaTeX, and the width FontMetrics measures\n"
+				  << "for every equation must hold the ink wkhtmltoimage draws\n"
+				  << "for it on a sprite sheet of count equations (200 by\n"
+				  << "default), up to a tolerance of 3 pixels by default.\n"
+				  << "Equations are read one per line (- for stdin); without\n"
+				  << "-i, every atom of the fast path's subset is checked alone,\n"
+				  << "with each other atom as a sub- and superscript, with\n"
+				  << "both, and next to it. Mismatches are reported on stderr,\n"
+				  << "and make the exit status non-zero." << std::endl;
+	}
+
+	bool parse_options(int argc, const char* argv[], Options& options)
+	{
+		for (int i = 1; i + 1 < argc; i += 2)
+		{
+			std::string argument = argv[i];
+
+			if (argument == "-i") options.input = argv[i + 1];
+
+			else if (argument == "-t")
+			{
+				if (! parse_count(argv[i + 1], options.tolerance)) return false;
+			}
+
+			else if (argument == "-s")
+			{
+				if (! parse_count(argv[i + 1], options.sheet)) return false;
+
+				if (options.sheet == 0) return false;
+			}
+
+			else return false;
+		}
+
+		return argc % 2 == 1;
+	}
+
+	/*! Generates equations covering the fast path's subset. */
+	std::vector<std::string> corpus()
+	{
+		std::vector<std::string> atoms;
+
+		for (char c = 'a'; c <= 'z'; ++c) atoms.emplace_back(1, c);
+
+		for (char c = 'A'; c <= 'Z'; ++c) atoms.emplace_back(1, c);
+
+		for (char c = '0'; c <= '9'; ++c) atoms.emplace_back(1, c);
+
+		atoms.insert(atoms.end(), std::begin(greek), std::end(greek));
+
+		std::vector<std::string> equations(atoms);
+
+		for (std::size_t i = 0; i < atoms.size(); ++i)
+		{
+			for (std::size_t j = 0; j < atoms.size(); ++j)
+			{
+				const auto& other = atoms[(i + j + 1) % atoms.size()];
+
+				equations.push_back(atoms[i] + "_" + atoms[j]);
+
+				equations.push_back(atoms[i] + "^" + atoms[j]);
+
+				equations.push_back(atoms[i] + "_" + atoms[j] + "^" + other);
+
+				equations.push_back(atoms[i] + "^" + other + "_" + atoms[j]);
+
+				// Spaced, so that a command doesn't run into a letter
+				equations.push_back(atoms[i] + " " + atoms[j]);
+			}
+		}
+
+		return equations;
+	}
+
+	/*! Compares the fast path's markup with KaTeX's. */
+	std::size_t check_markup(const Latex& latex, const std::vector<std::string>& equations)
+	{
+		std::size_t checked = 0;
+
+		std::size_t mismatches = 0;
+
+		for (const auto& equation : equations)
+		{
+			std::string native;
+
+			if (! FastPath::render(equation, native)) continue;
+
+			++checked;
+
+			// The fast path is disabled, so this is KaTeX's markup
+			auto result = latex.try_to_html(equation);
+
+			if (result && result.html == native) continue;
+
+			++mismatches;
+
+			std::cerr << "Markup of " << equation << " differs\n"
+					  << "  fast path: " << native << "\n"
+					  << "  KaTeX:     "
+					  << (result ? result.html : "error: " + result.error.message)
+					  << std::endl;
+		}
+
+		std::cerr << "Compared the markup of " << checked << " equations in the "
+				  << "fast path's subset: " << mismatches << " mismatches." << std::endl;
+
+		return mismatches;
+	}
+
+	/*! Compares the measured widths with the rasterized ink. */
+	std::size_t check_widths(const Latex& latex,
+							 const std::vector<std::string>& equations,
+							 const Options& options)
+	{
+		std::size_t checked = 0;
+
+		std::size_t mismatches = 0;
+
+		double widest = 0;
+
+		for (std::size_t first = 0; first < equations.size(); first += options.sheet)
+		{
+			auto last = std::min(first + options.sheet, equations.size());
+
+			std::vector<std::string> batch(equations.begin() + first,
+										   equations.begin() + last);
+
+			std::vector<Latex::Metrics> metrics;
+
+			try
+			{
+				metrics = latex.measure(batch, font_size);
+			}
+
+			// Checked one by one below, skipping the invalid ones
+			catch (const Latex::ParseException&) { }
+
+			if (metrics.empty())
+			{
+				std::vector<std::string> valid;
+
+				for (const auto& equation : batch)
+				{
+					if (latex.try_to_html(equation)) valid.push_back(equation);
+				}
+
+				batch.swap(valid);
+
+				if (batch.empty()) continue;
+
+				metrics = latex.measure(batch, font_size);
+			}
+
+			auto sheet = latex.to_sprite_sheet(batch);
+
+			for (std::size_t i = 0; i < batch.size(); ++i)
+			{
+				++checked;
+
+				const auto& sprite = sheet.sprites()[i];
+
+				auto ink = (sprite.width > 2 * sprite_margin) ? sprite.width - 2 * sprite_margin : 0;
+
+				auto excess = static_cast<double>(ink) - metrics[i].px.width;
+
+				widest = std::max(widest, excess);
+
+				if (! sheet.clipped(i) && excess <= options.tolerance) continue;
+
+				++mismatches;
+
+				std::cerr << "Width of " << batch[i] << " is off: measured "
+						  << metrics[i].px.width << " px, inked " << ink << " px"
+						  << (sheet.clipped(i) ? " (clipped)" : "") << std::endl;
+			}
+		}
+
+		std::cerr << "Compared the widths of " << checked << " equations: "
+				  << mismatches << " mismatches, ink at most " << widest
+				  << " px wider than measured." << std::endl;
+
+		return mismatches;
+	}
+}
+
+int main(int argc, const char* argv[])
+{
+	Options options;
+
+	if (! parse_options(argc, argv, options))
+	{
+		usage(argv[0]);
+
+		return EXIT_FAILURE;
+	}
+
+	std::vector<std::string> equations;
+
+	if (options.input.empty()) equations = corpus();
+
+	else
+	{
+		std::ifstream file;
+
+		if (options.input != "-")
+		{
+			file.open(options.input);
+
+			if (! file)
+			{
+				std::cerr << "Could not open " << options.input << std::endl;
+
+				return EXIT_FAILURE;
+			}
+		}
+
+		std::istream& input = (options.input == "-") ? std::cin : file;
+
+		std::string equation;
+
+		while (std::getline(input, equation))
+		{
+			if (! equation.empty()) equations.push_back(equation);
+		}
+	}
+
+	Latex latex;
+
+	// Everything through KaTeX, the reference
+	latex.fast_path(false);
+
+	std::size_t mismatches = 0;
+
+	try
+	{
+		mismatches += check_markup(latex, equations);
+
+		mismatches += check_widths(latex, equations, options);
+	}
+
+	catch (const std::exception& exception)
+	{
+		std::cerr << exception.what() << std::endl;
+
+		return EXIT_FAILURE;
+	}
+
+	return mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+}
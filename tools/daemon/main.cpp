@@ -0,0 +1,690 @@
+#include "../../latex_pool.hpp"
+#include "../../macros.hpp"
+#include "../../micro_batcher.hpp"
+#include "../../pooled_allocator.hpp"
+#include "../../render_protocol.hpp"
+#include "../../shared_cache.hpp"
+#include "../../single_flight.hpp"
+#include "../../trace.hpp"
+#include "../options.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <poll.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+
+namespace
+{
+	std::atomic<bool> running(true);
+
+	void stop(int)
+	{
+		running = false;
+	}
+
+	struct Options
+	{
+		std::string socket = RenderProtocol::default_socket;
+
+		std::size_t engines = std::thread::hardware_concurrency();
+
+		/*! The most engines bulk requests may use, 0 for the default. */
+		std::size_t bulk_engines = 0;
+
+		/*! Where to capture a trace of all renders, if anywhere. */
+		std::string trace;
+
+		/*! The cache file shared with other daemons, if any. */
+		std::string cache;
+
+		/*! A file of macro definitions, if any. */
+		std::string macros;
+
+		/*! The longest a single HTML render waits for others to batch
+			with, in microseconds, 0 to not batch them. */
+		std::size_t window = 0;
+
+		/*! The most equations in such a batch. */
+		std::size_t batch_size = 32;
+
+		/*! The most requests of a connection being rendered at once. */
+		std::size_t pipelined = 64;
+	};
+
+	/*! How many equations of a bulk request render between preemptions. */
+	const std::size_t bulk_chunk = 16;
+
+	void usage(const char* program)
+	{
+		std::cerr << "Usage: " << program << " [-s socket] [-j engines] [-b engines] [-t trace] [-c cache] [-m macros]\n"
+				  << "       [-w microseconds] [-n equations] [-p requests]\n\n"
+				  << "Keeps a pool of warm engines and serves render requests\n"
+				  << "(see render_protocol.hpp) on a Unix domain socket until\n"
+				  << "interrupted. At most -b engines (by default, all but\n"
+				  << "one) render bulk requests. With -t, all renders are\n"
+				  << "captured to a trace for tools/replay. With -c, renders\n"
+				  << "are shared with other processes through a cache file\n"
+				  << "(best put on a tmpfs, e.g. /dev/shm). With -m, the\n"
+				  << "\\newcommand definitions in a file are expanded in\n"
+				  << "every equation. With -w, single HTML requests wait up to\n"
+				  << "that long under load to render with others, in batches\n"
+				  << "of at most -n equations. A client may have at most -p\n"
+				  << "requests (by default 64) rendering at once; further ones\n"
+				  << "are read when earlier ones are answered." << std::endl;
+	}
+
+	bool parse_options(int argc, const char* argv[], Options& options)
+	{
+		for (int i = 1; i + 1 < argc; i += 2)
+		{
+			std::string argument = argv[i];
+
+			if (argument == "-s") options.socket = argv[i + 1];
+
+			else if (argument == "-j")
+			{
+				if (! parse_count(argv[i + 1], options.engines)) return false;
+			}
+
+			else if (argument == "-b")
+			{
+				if (! parse_count(argv[i + 1], options.bulk_engines)) return false;
+			}
+
+			else if (argument == "-t") options.trace = argv[i + 1];
+
+			else if (argument == "-c") options.cache = argv[i + 1];
+
+			else if (argument == "-m") options.macros = argv[i + 1];
+
+			else if (argument == "-w")
+			{
+				if (! parse_count(argv[i + 1], options.window)) return false;
+			}
+
+			else if (argument == "-n")
+			{
+				if (! parse_count(argv[i + 1], options.batch_size)) return false;
+			}
+
+			else if (argument == "-p")
+			{
+				if (! parse_count(argv[i + 1], options.pipelined)) return false;
+			}
+
+			else return false;
+		}
+
+		return argc % 2 == 1 && options.pipelined > 0;
+	}
+
+	/*! A client connection, shared by its reader and its pending renders. */
+	struct Connection
+	{
+		explicit Connection(int socket_)
+		: socket(socket_)
+		, finished(false)
+		, in_flight(0)
+		{ }
+
+		~Connection()
+		{
+			::close(socket);
+		}
+
+		void send(const RenderProtocol::Response& response)
+		{
+			auto payload = RenderProtocol::encode(response);
+
+			// Responses of concurrent renders must not interleave
+			std::lock_guard<std::mutex> lock(mutex);
+
+			try
+			{
+				RenderProtocol::write_frame(socket, payload);
+			}
+
+			// The client went away, nobody to tell
+			catch (const RenderProtocol::Exception&) { }
+		}
+
+		/*! Waits until fewer than limit requests are being
+		*   rendered, and counts in one more. */
+		void admit(std::size_t limit)
+		{
+			std::unique_lock<std::mutex> lock(admission);
+
+			settled.wait(lock, [&] { return in_flight < limit; });
+
+			++in_flight;
+		}
+
+		/*! Sends the response to an admitted request. */
+		void complete(const RenderProtocol::Response& response)
+		{
+			send(response);
+
+			{
+				std::lock_guard<std::mutex> lock(admission);
+
+				--in_flight;
+			}
+
+			settled.notify_all();
+		}
+
+		int socket;
+
+		std::mutex mutex;
+
+		std::atomic<bool> finished;
+
+		/*! The requests being rendered. */
+		std::size_t in_flight;
+
+		/*! Guards in_flight. */
+		std::mutex admission;
+
+		/*! Signals answered requests to the reader. */
+		std::condition_variable settled;
+	};
+
+	RenderProtocol::Item failure(RenderProtocol::Status status,
+								 const std::string& message,
+								 int position = -1)
+	{
+		RenderProtocol::Item item;
+
+		item.status = status;
+		item.data = message;
+		item.position = position;
+
+		return item;
+	}
+
+	RenderProtocol::Item item(Latex::Result& result)
+	{
+		if (result) return failure(RenderProtocol::Status::OK, std::move(result.html));
+
+		auto status = (result.error.kind == Latex::ErrorKind::Parse) ?
+					  RenderProtocol::Status::ParseError :
+					  RenderProtocol::Status::EngineError;
+
+		return failure(status, result.error.message, result.error.position);
+	}
+
+	/*! Renders shared by concurrent requests for the same equation. */
+	using Flights = SingleFlight<RenderProtocol::Item>;
+
+	/*! Identifies a render by everything its result depends on. */
+	std::string key(const Latex& latex,
+					RenderProtocol::Operation operation,
+					const std::string& equation)
+	{
+		std::string key(1, static_cast<char>(operation));
+
+		key += latex.fast_path() ? '1' : '0';
+		key += static_cast<char>(latex.warning_behavior());
+		key += static_cast<char>(latex.output_mode());
+
+		// NUL-separated, as neither part can contain one meaningfully
+		key += latex.stylesheet() + '\0';
+		key += latex.additional_css() + '\0';
+
+		// Expansions depend on the macros as much as on the equation
+		if (latex.macros()) key += std::to_string(latex.macros()->fingerprint());
+
+		key += '\0';
+
+		// As spelled, since the TeX annotation and any error position
+		// are those of the spelling; other spellings render on their own
+		key += equation;
+
+		return key;
+	}
+
+	RenderProtocol::Item render(Latex& latex,
+								RenderProtocol::Operation operation,
+								const std::string& equation)
+	{
+		if (operation == RenderProtocol::Operation::HTML)
+		{
+			auto result = latex.try_to_html(equation);
+
+			return item(result);
+		}
+
+		auto format = Latex::ImageFormat::PNG;
+
+		if (operation == RenderProtocol::Operation::JPG)
+		{
+			format = Latex::ImageFormat::JPG;
+		}
+
+		else if (operation == RenderProtocol::Operation::SVG)
+		{
+			format = Latex::ImageFormat::SVG;
+		}
+
+		// The image's bytes go where a snippet would
+		Latex::Result result;
+
+		try
+		{
+			// Weeds out invalid LaTeX without an exception, and
+			// without rendering valid LaTeX twice
+			result.error = latex.try_to_image_data(equation, format, result.html);
+		}
+
+		catch (const std::exception& exception)
+		{
+			return failure(RenderProtocol::Status::ConversionError,
+						   exception.what());
+		}
+
+		return item(result);
+	}
+
+	/*! A request being rendered, possibly in several chunks. */
+	struct Job
+	{
+		RenderProtocol::Request request;
+
+		RenderProtocol::Response response;
+	};
+
+	/*! Renders up to count more equations of a job and
+	*   returns whether there are any left after that. */
+	bool advance(Latex& latex, Flights& flights, Job& job, std::size_t count)
+	{
+		const auto& request = job.request;
+
+		auto& items = job.response.items;
+
+		auto end = std::min(request.equations.size(), items.size() + count);
+
+		while (items.size() < end)
+		{
+			const auto& equation = request.equations[items.size()];
+
+			auto identity = key(latex, request.operation, equation);
+
+			items.push_back(flights.run(identity, [&] {
+				return render(latex, request.operation, equation);
+			}));
+		}
+
+		return items.size() < request.equations.size();
+	}
+
+	void serve(std::shared_ptr<Connection> connection,
+			   LatexPool& pool,
+			   Flights& flights,
+			   MicroBatcher* batcher,
+			   std::size_t pipelined)
+	{
+		std::string payload;
+
+		try
+		{
+			while (RenderProtocol::read_frame(connection->socket, payload))
+			{
+				RenderProtocol::Request request;
+
+				try
+				{
+					request = RenderProtocol::decode_request(payload);
+				}
+
+				catch (const RenderProtocol::Exception& exception)
+				{
+					// The framing is intact, so the connection can go on
+					RenderProtocol::Response response;
+
+					// Tells a pipelining client which request failed
+					RenderProtocol::request_id(payload, response.id);
+
+					response.items.push_back(
+						failure(RenderProtocol::Status::ProtocolError,
+								exception.what())
+					);
+
+					connection->send(response);
+
+					continue;
+				}
+
+				// Stops reading (and so the client from sending) while
+				// the client has too much work in flight
+				connection->admit(pipelined);
+
+				auto job = std::make_shared<Job>();
+
+				job->response.id = request.id;
+
+				job->request = std::move(request);
+
+				const auto& accepted = job->request;
+
+				// Renders many such requests as one pool task. These are not
+				// coalesced with identical renders of other requests (but
+				// within their batch), as they wait little for an engine
+				if (batcher &&
+					! accepted.bulk &&
+					accepted.operation == RenderProtocol::Operation::HTML &&
+					accepted.equations.size() == 1)
+				{
+					batcher->post(accepted.equations.front(),
+								  [connection, job] (Latex::Result& result) {
+						job->response.items.push_back(item(result));
+
+						connection->complete(job->response);
+					});
+
+					continue;
+				}
+
+				if (! job->request.bulk)
+				{
+					pool.post([connection, job, &flights] (Latex& latex) {
+						advance(latex, flights, *job, job->request.equations.size());
+
+						connection->complete(job->response);
+					});
+
+					continue;
+				}
+
+				// Lets interactive requests overtake it between chunks
+				pool.post_batch([connection, job, &flights] (Latex& latex) {
+					if (advance(latex, flights, *job, bulk_chunk)) return true;
+
+					connection->complete(job->response);
+
+					return false;
+				}, LatexPool::Priority::Bulk);
+			}
+		}
+
+		catch (const RenderProtocol::Exception& exception)
+		{
+			std::clog << "Dropping client: " << exception.what() << std::endl;
+		}
+
+		connection->finished = true;
+	}
+
+	int listen_on(const std::string& path)
+	{
+		sockaddr_un address{};
+
+		if (path.size() >= sizeof address.sun_path)
+		{
+			throw std::runtime_error("Socket path too long: " + path);
+		}
+
+		address.sun_family = AF_UNIX;
+
+		std::strcpy(address.sun_path, path.c_str());
+
+		auto socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+
+		if (socket < 0) throw std::runtime_error(std::strerror(errno));
+
+		// A stale socket file from a previous run would make bind() fail
+		::unlink(path.c_str());
+
+		if (::bind(socket, reinterpret_cast<sockaddr*>(&address), sizeof address) < 0 ||
+			::listen(socket, SOMAXCONN) < 0)
+		{
+			auto error = errno;
+
+			::close(socket);
+
+			throw std::runtime_error(path + ": " + std::strerror(error));
+		}
+
+		return socket;
+	}
+
+	struct Client
+	{
+		std::thread thread;
+
+		std::shared_ptr<Connection> connection;
+	};
+}
+
+int main(int argc, const char* argv[])
+{
+	Options options;
+
+	if (! parse_options(argc, argv, options))
+	{
+		usage(argv[0]);
+
+		return EXIT_FAILURE;
+	}
+
+	std::signal(SIGINT, stop);
+	std::signal(SIGTERM, stop);
+	std::signal(SIGPIPE, SIG_IGN);
+
+	// Declared before the pool, so that it outlives pending renders
+	Flights flights;
+
+	std::shared_ptr<TraceWriter> trace;
+
+	std::shared_ptr<SharedCache> cache;
+
+	if (! options.trace.empty() || ! options.cache.empty())
+	{
+		try
+		{
+			if (! options.trace.empty())
+			{
+				trace = std::make_shared<TraceWriter>(options.trace);
+			}
+
+			if (! options.cache.empty())
+			{
+				cache = std::make_shared<SharedCache>(options.cache);
+			}
+		}
+
+		catch (const Latex::FileException& exception)
+		{
+			std::cerr << exception.what() << std::endl;
+
+			return EXIT_FAILURE;
+		}
+	}
+
+	// Compiled once and shared by all engines
+	std::shared_ptr<Macros> macros;
+
+	if (! options.macros.empty())
+	{
+		std::ifstream file(options.macros);
+
+		if (! file)
+		{
+			std::cerr << "Could not open " << options.macros << std::endl;
+
+			return EXIT_FAILURE;
+		}
+
+		std::string preamble((std::istreambuf_iterator<char>(file)),
+							 std::istreambuf_iterator<char>());
+
+		try
+		{
+			macros = std::make_shared<Macros>();
+
+			macros->define(preamble);
+		}
+
+		catch (const Latex::ParseException& exception)
+		{
+			std::cerr << options.macros << ": " << exception.what() << std::endl;
+
+			return EXIT_FAILURE;
+		}
+	}
+
+	// Keeps the ArrayBuffers the engines free for reuse
+	auto allocator = std::make_shared<PooledAllocator>();
+
+	// Declared before the clients, so that it outlives their threads
+	LatexPool pool(options.engines, [trace, cache, macros, allocator] {
+		auto latex = std::make_unique<Latex>(Latex::WarningBehavior::Log,
+											 Latex::Loading::Blocking,
+											 allocator);
+
+		latex->capture(trace);
+
+		latex->cache(cache);
+
+		latex->macros(macros);
+
+		return latex;
+	});
+
+	if (options.bulk_engines > 0)
+	{
+		pool.limit(LatexPool::Priority::Bulk, options.bulk_engines);
+	}
+
+	// Declared after the pool, so that it hands its last batches to it
+	std::unique_ptr<MicroBatcher> batcher;
+
+	if (options.window > 0)
+	{
+		batcher = std::make_unique<MicroBatcher>(
+			pool,
+			std::chrono::microseconds(options.window),
+			options.batch_size
+		);
+	}
+
+	int listener;
+
+	try
+	{
+		listener = listen_on(options.socket);
+	}
+
+	catch (const std::runtime_error& exception)
+	{
+		std::cerr << exception.what() << std::endl;
+
+		return EXIT_FAILURE;
+	}
+
+	std::clog << "Serving on " << options.socket << " with "
+			  << pool.size() << " engines." << std::endl;
+
+	std::list<Client> clients;
+
+	while (running)
+	{
+		pollfd descriptor = { listener, POLLIN, 0 };
+
+		// Time out regularly to notice signals and reap finished clients
+		auto ready = ::poll(&descriptor, 1, 250);
+
+		for (auto i = clients.begin(); i != clients.end(); )
+		{
+			if (! i->connection->finished) ++i;
+
+			else
+			{
+				i->thread.join();
+
+				i = clients.erase(i);
+			}
+		}
+
+		if (ready <= 0) continue;
+
+		auto socket = ::accept(listener, nullptr, nullptr);
+
+		if (socket < 0) continue;
+
+		auto connection = std::make_shared<Connection>(socket);
+
+		std::thread thread(serve,
+						   connection,
+						   std::ref(pool),
+						   std::ref(flights),
+						   batcher.get(),
+						   options.pipelined);
+
+		clients.push_back({std::move(thread), std::move(connection)});
+	}
+
+	::close(listener);
+
+	::unlink(options.socket.c_str());
+
+	// Unblock the readers; pending renders still finish in the pool
+	for (auto& client : clients)
+	{
+		::shutdown(client.connection->socket, SHUT_RD);
+
+		client.thread.join();
+	}
+
+	clients.clear();
+
+	for (auto priority : {LatexPool::Priority::Interactive, LatexPool::Priority::Bulk})
+	{
+		auto lane = pool.statistics(priority);
+
+		auto mean = lane.started ? lane.total_wait.count() / lane.started : 0;
+
+		std::clog << (priority == LatexPool::Priority::Bulk ? "Bulk" : "Interactive")
+				  << ": " << lane.started << " tasks, mean wait " << mean
+				  << "us, max wait " << lane.max_wait.count() << "us." << std::endl;
+	}
+
+	if (batcher)
+	{
+		auto batching = batcher->statistics();
+
+		std::clog << "Batched " << batching.requests << " requests into "
+				  << batching.batches << " renders, at most "
+				  << batching.largest << " at a time." << std::endl;
+	}
+
+	auto statistics = flights.statistics();
+
+	std::clog << "Rendered " << statistics.executed << " equations, saved "
+			  << statistics.coalesced << " renders by coalescing." << std::endl;
+
+	if (cache)
+	{
+		auto shared = cache->statistics();
+
+		std::clog << "Cache (all processes): " << shared.hits << " hits, "
+				  << shared.misses << " misses, " << shared.evictions
+				  << " evictions, " << shared.skipped << " inserts skipped while busy, "
+				  << shared.oversized << " too large, " << shared.recovered
+				  << " locks recovered." << std::endl;
+	}
+}
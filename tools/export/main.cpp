@@ -0,0 +1,415 @@
+#include "../../archive.hpp"
+#include "../../latex_pool.hpp"
+#include "../../sprite_sheet.hpp"
+#include "../options.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace
+{
+	/*! The number of equations rendered together, onto one sprite sheet. */
+	const std::size_t batch_size = 32;
+
+	struct Options
+	{
+		std::string input = "-";
+
+		std::string archive = "equations.arc";
+
+		std::size_t engines = std::thread::hardware_concurrency();
+
+		std::vector<Archive::Format> formats = {
+			Archive::Format::HTML,
+			Archive::Format::SVG
+		};
+	};
+
+	void usage(const char* program)
+	{
+		std::cerr << "Usage: " << program
+				  << " [-i equations.txt] [-o archive] [-j engines] [-f formats]\n\n"
+				  << "Renders one equation per line (from stdin by default) into\n"
+				  << "an archive (see archive.hpp), from which pre-rendered math\n"
+				  << "can be served without an engine. Formats are a comma-\n"
+				  << "separated list of html, png, jpg and svg, by default\n"
+				  << "html,svg. Repeated equations are rendered once, and all\n"
+				  << "formats of an equation come from that one render. PNGs\n"
+				  << "are trimmed sprites cut from one sheet per batch (see\n"
+				  << "sprite_sheet.hpp). Equations that fail to render in any\n"
+				  << "format are reported on stderr and left out entirely."
+				  << std::endl;
+	}
+
+	bool parse_formats(const std::string& list, std::vector<Archive::Format>& formats)
+	{
+		formats.clear();
+
+		std::size_t begin = 0;
+
+		while (begin <= list.size())
+		{
+			auto end = std::min(list.find(',', begin), list.size());
+
+			auto name = list.substr(begin, end - begin);
+
+			if (name == "html") formats.push_back(Archive::Format::HTML);
+
+			else if (name == "png") formats.push_back(Archive::Format::PNG);
+
+			else if (name == "jpg") formats.push_back(Archive::Format::JPG);
+
+			else if (name == "svg") formats.push_back(Archive::Format::SVG);
+
+			else return false;
+
+			begin = end + 1;
+		}
+
+		return true;
+	}
+
+	bool parse_options(int argc, const char* argv[], Options& options)
+	{
+		for (int i = 1; i + 1 < argc; i += 2)
+		{
+			std::string argument = argv[i];
+
+			if (argument == "-i") options.input = argv[i + 1];
+
+			else if (argument == "-o") options.archive = argv[i + 1];
+
+			else if (argument == "-j")
+			{
+				if (! parse_count(argv[i + 1], options.engines)) return false;
+			}
+
+			else if (argument == "-f")
+			{
+				if (! parse_formats(argv[i + 1], options.formats)) return false;
+			}
+
+			else return false;
+		}
+
+		return argc % 2 == 1;
+	}
+
+	/*! Counts renders and bounds how many are outstanding. */
+	class Progress
+	{
+	public:
+
+		Progress()
+		: _completed(0)
+		, _errors(0)
+		{ }
+
+		void done(bool failed)
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+
+			if (failed) ++_errors;
+
+			++_completed;
+
+			_done.notify_all();
+		}
+
+		/*! Blocks until fewer than limit renders are outstanding. */
+		void wait(std::size_t submitted, std::size_t limit)
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+
+			_done.wait(lock, [&] { return submitted - _completed < limit; });
+		}
+
+		std::size_t errors()
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+
+			return _errors;
+		}
+
+	private:
+
+		std::size_t _completed;
+
+		std::size_t _errors;
+
+		std::mutex _mutex;
+
+		std::condition_variable _done;
+	};
+
+	/*! Renders an equation's formats from its render, into the archive.
+	    Its payloads are added only once every format succeeded, so the
+	    archive never holds part of an equation's formats. */
+	bool render(Latex& latex,
+				ArchiveWriter& archive,
+				const std::string& equation,
+				const Latex::Result& result,
+				const std::vector<Archive::Format>& formats,
+				const std::string& sprite)
+	{
+		if (! result)
+		{
+			std::clog << "Failed to render " << equation << ": "
+					  << result.error.message << std::endl;
+
+			return false;
+		}
+
+		// The formats rasterized from the equation's own page
+		std::vector<Latex::ImageFormat> pages;
+
+		for (auto format : formats)
+		{
+			if (format == Archive::Format::SVG) pages.push_back(Latex::ImageFormat::SVG);
+
+			else if (format == Archive::Format::JPG) pages.push_back(Latex::ImageFormat::JPG);
+
+			else if (format == Archive::Format::PNG && sprite.empty())
+			{
+				pages.push_back(Latex::ImageFormat::PNG);
+			}
+		}
+
+		std::vector<std::string> images;
+
+		try
+		{
+			if (! pages.empty()) images = latex.to_image_data(result, pages);
+		}
+
+		catch (const std::exception& exception)
+		{
+			std::clog << "Failed to render " << equation << ": "
+					  << exception.what() << std::endl;
+
+			return false;
+		}
+
+		auto key = Canonical::digest(equation);
+
+		auto image = images.begin();
+
+		for (auto format : formats)
+		{
+			if (format == Archive::Format::HTML) archive.add(key, format, result.html);
+
+			else if (format == Archive::Format::PNG && ! sprite.empty())
+			{
+				archive.add(key, format, sprite);
+			}
+
+			else archive.add(key, format, *image++);
+		}
+
+		return true;
+	}
+
+	/*! Renders a batch of equations in every format into the archive,
+	    each once, cutting their PNGs from one sprite sheet. */
+	void render(Latex& latex,
+				ArchiveWriter& archive,
+				const std::vector<std::string>& equations,
+				const std::vector<Archive::Format>& formats,
+				Progress& progress)
+	{
+		std::vector<Latex::Result> results;
+
+		try
+		{
+			results = latex.try_to_html(equations);
+		}
+
+		catch (const std::exception& exception)
+		{
+			for (const auto& equation : equations)
+			{
+				std::clog << "Failed to render " << equation << ": "
+						  << exception.what() << std::endl;
+
+				progress.done(true);
+			}
+
+			return;
+		}
+
+		std::vector<std::string> sprites(equations.size());
+
+		if (std::find(formats.begin(), formats.end(), Archive::Format::PNG) != formats.end())
+		{
+			std::vector<Latex::Result> valid;
+
+			std::vector<std::size_t> owners;
+
+			for (std::size_t i = 0; i < results.size(); ++i)
+			{
+				if (results[i])
+				{
+					valid.push_back(results[i]);
+
+					owners.push_back(i);
+				}
+			}
+
+			try
+			{
+				if (! valid.empty())
+				{
+					auto sheet = latex.to_sprite_sheet(valid);
+
+					for (std::size_t i = 0; i < sheet.size(); ++i)
+					{
+						sprites[owners[i]] = sheet.png(i);
+					}
+				}
+			}
+
+			// Any error spoils the whole sheet. Rasterized one by one,
+			// the faulty equation reports it and the others succeed.
+			catch (const std::exception&)
+			{
+				std::fill(sprites.begin(), sprites.end(), std::string());
+			}
+		}
+
+		for (std::size_t i = 0; i < equations.size(); ++i)
+		{
+			bool failed = true;
+
+			try
+			{
+				failed = ! render(latex, archive, equations[i], results[i], formats, sprites[i]);
+			}
+
+			catch (const std::exception& exception)
+			{
+				std::clog << "Failed to archive " << equations[i] << ": "
+						  << exception.what() << std::endl;
+			}
+
+			progress.done(failed);
+		}
+	}
+}
+
+int main(int argc, const char* argv[])
+{
+	Options options;
+
+	if (! parse_options(argc, argv, options))
+	{
+		usage(argv[0]);
+
+		return EXIT_FAILURE;
+	}
+
+	std::ifstream file;
+
+	if (options.input != "-")
+	{
+		file.open(options.input);
+
+		if (! file)
+		{
+			std::cerr << "Could not open " << options.input << std::endl;
+
+			return EXIT_FAILURE;
+		}
+	}
+
+	std::istream& input = (options.input == "-") ? std::cin : file;
+
+	std::ios::sync_with_stdio(false);
+
+	auto start = std::chrono::steady_clock::now();
+
+	Progress progress;
+
+	std::size_t submitted = 0;
+
+	std::size_t payloads = 0;
+
+	try
+	{
+		ArchiveWriter archive(options.archive);
+
+		{
+			LatexPool pool(options.engines);
+
+			options.engines = pool.size();
+
+			// Bounds the memory of queued equations for huge corpora
+			const auto limit = 4 * pool.size() * batch_size;
+
+			// The equations rendered so far
+			std::unordered_set<Archive::Key> seen;
+
+			auto& formats = options.formats;
+
+			std::vector<std::string> batch;
+
+			auto post = [&] {
+				progress.wait(submitted, limit);
+
+				submitted += batch.size();
+
+				pool.post([&archive, &progress, &formats, batch] (Latex& latex) {
+					render(latex, archive, batch, formats, progress);
+				});
+
+				batch.clear();
+			};
+
+			std::string equation;
+
+			while (std::getline(input, equation))
+			{
+				if (equation.empty()) continue;
+
+				if (! seen.insert(Canonical::digest(equation)).second) continue;
+
+				batch.push_back(equation);
+
+				if (batch.size() == batch_size) post();
+			}
+
+			if (! batch.empty()) post();
+
+			// The pool's destructor waits for all remaining renders
+		}
+
+		archive.finish();
+
+		payloads = archive.size();
+	}
+
+	catch (const Latex::FileException& exception)
+	{
+		std::cerr << exception.what() << std::endl;
+
+		return EXIT_FAILURE;
+	}
+
+	auto errors = progress.errors();
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	std::cerr << "Archived " << payloads << " payloads of " << submitted
+			  << " equations (" << errors << " errors) in " << elapsed.count()
+			  << " s with " << options.engines << " engines." << std::endl;
+
+	return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
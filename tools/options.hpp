@@ -0,0 +1,46 @@
+/********************************************************//*!
+*
+*	@file options.hpp
+*
+*	@author Peter Goldsborough.
+*
+************************************************************/
+
+#ifndef TOOLS_OPTIONS_HPP
+#define TOOLS_OPTIONS_HPP
+
+#include <cctype>
+#include <cstddef>
+#include <string>
+
+/***************************************************************************//*!
+*
+*	@brief Parses a non-negative count given on the command line.
+*
+*	@details The count must be all digits, and at most nine of them,
+*			 so that it can't overflow. Signs, spaces and trailing
+*			 characters are rejected rather than ignored.
+*
+*	@param text The argument.
+*
+*	@param count Set to the count if the argument is valid.
+*
+*	@return Whether the argument is a valid count.
+*
+*******************************************************************************/
+
+inline bool parse_count(const std::string& text, std::size_t& count)
+{
+	if (text.empty() || text.size() > 9) return false;
+
+	for (auto c : text)
+	{
+		if (! std::isdigit(static_cast<unsigned char>(c))) return false;
+	}
+
+	count = std::stoul(text);
+
+	return true;
+}
+
+#endif /* TOOLS_OPTIONS_HPP */
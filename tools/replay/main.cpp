@@ -0,0 +1,333 @@
+#include "../../latex_pool.hpp"
+#include "../../trace.hpp"
+#include "../options.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	using Clock = std::chrono::steady_clock;
+
+	struct Options
+	{
+		std::string trace;
+
+		std::size_t engines = std::thread::hardware_concurrency();
+
+		bool fast = false;
+	};
+
+	void usage(const char* program)
+	{
+		std::cerr << "Usage: " << program << " [-j engines] [--fast] trace\n\n"
+				  << "Replays a trace captured with Latex::capture() against\n"
+				  << "this build, at the recorded arrival times or, with --fast,\n"
+				  << "as fast as the engines allow, and reports throughput and\n"
+				  << "latency percentiles next to the recorded ones. Every\n"
+				  << "call is replayed with the CSS, stylesheet and output mode\n"
+				  << "it was recorded with. Equations were recorded with their\n"
+				  << "macros expanded, so they replay without them." << std::endl;
+	}
+
+	bool parse_options(int argc, const char* argv[], Options& options)
+	{
+		for (int i = 1; i < argc; ++i)
+		{
+			std::string argument = argv[i];
+
+			if (argument == "--fast") options.fast = true;
+
+			else if (argument == "-j" && i + 1 < argc)
+			{
+				if (! parse_count(argv[++i], options.engines)) return false;
+			}
+
+			else if (options.trace.empty() && argument[0] != '-')
+			{
+				options.trace = argument;
+			}
+
+			else return false;
+		}
+
+		return ! options.trace.empty();
+	}
+
+	/*! Collects the outcome of every replayed call. */
+	class Results
+	{
+	public:
+
+		void add(double latency, bool mismatch)
+		{
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+
+				_latencies.push_back(latency);
+
+				if (mismatch) ++_mismatches;
+			}
+
+			_done.notify_one();
+		}
+
+		/*! Blocks while too many calls are in flight. */
+		void wait(std::size_t submitted, std::size_t limit)
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+
+			_done.wait(lock, [&] { return submitted - _latencies.size() < limit; });
+		}
+
+		std::vector<double>& latencies()
+		{
+			return _latencies;
+		}
+
+		std::size_t mismatches() const
+		{
+			return _mismatches;
+		}
+
+	private:
+
+		std::mutex _mutex;
+
+		std::condition_variable _done;
+
+		std::vector<double> _latencies;
+
+		std::size_t _mismatches = 0;
+	};
+
+	TraceRecord::Status status(const Latex::Result& result)
+	{
+		if (result) return TraceRecord::Status::OK;
+
+		if (result.error.kind == Latex::ErrorKind::Parse)
+		{
+			return TraceRecord::Status::ParseError;
+		}
+
+		return TraceRecord::Status::Error;
+	}
+
+	TraceRecord::Status replay(Latex& latex, const TraceRecord& record)
+	{
+		if (latex.additional_css() != record.css)
+		{
+			latex.clear_additional_css();
+
+			latex.add_css(record.css);
+		}
+
+		if (latex.stylesheet() != record.stylesheet)
+		{
+			latex.stylesheet(record.stylesheet);
+		}
+
+		auto mode = static_cast<Latex::OutputMode>(record.output_mode);
+
+		if (latex.output_mode() != mode) latex.output_mode(mode);
+
+		if (record.method == TraceRecord::Method::HTML)
+		{
+			return status(latex.try_to_html(record.equation));
+		}
+
+		auto format = Latex::ImageFormat::PNG;
+
+		if (record.method == TraceRecord::Method::JPG)
+		{
+			format = Latex::ImageFormat::JPG;
+		}
+
+		else if (record.method == TraceRecord::Method::SVG)
+		{
+			format = Latex::ImageFormat::SVG;
+		}
+
+		try
+		{
+			latex.to_image_data(record.equation, format);
+		}
+
+		catch (const std::exception&)
+		{
+			return TraceRecord::Status::Error;
+		}
+
+		return TraceRecord::Status::OK;
+	}
+
+	/*! Prints percentiles of latencies in microseconds. */
+	void report(const std::string& title, std::vector<double>& latencies)
+	{
+		if (latencies.empty()) return;
+
+		std::sort(latencies.begin(), latencies.end());
+
+		auto percentile = [&] (double p) {
+			auto index = static_cast<std::size_t>(p * (latencies.size() - 1) + 0.5);
+
+			return latencies[index] / 1000;
+		};
+
+		std::cerr << std::setw(10) << std::left << title << std::right << std::fixed
+				  << std::setprecision(3)
+				  << "  p50 " << std::setw(9) << percentile(0.5)
+				  << "  p90 " << std::setw(9) << percentile(0.9)
+				  << "  p99 " << std::setw(9) << percentile(0.99)
+				  << "  p99.9 " << std::setw(9) << percentile(0.999)
+				  << "  max " << std::setw(9) << latencies.back() / 1000
+				  << "  (ms)" << std::endl;
+	}
+}
+
+int main(int argc, const char* argv[])
+{
+	Options options;
+
+	if (! parse_options(argc, argv, options))
+	{
+		usage(argv[0]);
+
+		return EXIT_FAILURE;
+	}
+
+	std::vector<TraceRecord> records;
+
+	try
+	{
+		TraceReader reader(options.trace);
+
+		TraceRecord record;
+
+		while (reader.next(record)) records.push_back(record);
+	}
+
+	catch (const std::exception& exception)
+	{
+		std::cerr << exception.what() << std::endl;
+
+		return EXIT_FAILURE;
+	}
+
+	if (records.empty())
+	{
+		std::cerr << "The trace is empty." << std::endl;
+
+		return EXIT_FAILURE;
+	}
+
+	// Calls are recorded as they end, but replayed as they arrived
+	std::stable_sort(records.begin(), records.end(), [] (const TraceRecord& first,
+														 const TraceRecord& second) {
+		return first.timestamp < second.timestamp;
+	});
+
+	Results results;
+
+	// Set once the engines are up, which shouldn't count
+	Clock::time_point start;
+
+	{
+		LatexPool pool(options.engines);
+
+		options.engines = pool.size();
+
+		const auto limit = 4 * pool.size();
+
+		start = Clock::now();
+
+		auto origin = records.front().timestamp;
+
+		std::size_t submitted = 0;
+
+		for (const auto& record : records)
+		{
+			auto arrival = Clock::now();
+
+			if (options.fast) results.wait(submitted, limit);
+
+			else
+			{
+				arrival = start + std::chrono::microseconds(record.timestamp - origin);
+
+				std::this_thread::sleep_until(arrival);
+			}
+
+			++submitted;
+
+			// Latency as the caller sees it, including any time spent queued
+			pool.post([&results, &record, arrival] (Latex& latex) {
+				auto outcome = TraceRecord::Status::Error;
+
+				try
+				{
+					outcome = replay(latex, record);
+				}
+
+				catch (const std::exception&) { }
+
+				std::chrono::duration<double, std::micro> latency = Clock::now() - arrival;
+
+				results.add(latency.count(), outcome != record.status);
+			});
+		}
+
+		// The pool's destructor waits for all remaining calls
+	}
+
+	std::chrono::duration<double> elapsed = Clock::now() - start;
+
+	std::vector<double> recorded;
+
+	recorded.reserve(records.size());
+
+	std::size_t expanded = 0;
+
+	std::set<std::uint64_t> tables;
+
+	for (const auto& record : records)
+	{
+		recorded.push_back(record.latency);
+
+		if (record.macros == 0) continue;
+
+		++expanded;
+
+		tables.insert(record.macros);
+	}
+
+	std::cerr << "Replayed " << records.size() << " calls in " << elapsed.count()
+			  << " s, " << (records.size() / elapsed.count()) << " calls/s with "
+			  << options.engines << " engines ("
+			  << (options.fast ? "as fast as possible" : "at recorded speed")
+			  << ").\n";
+
+	std::cerr << results.mismatches() << " calls ended differently than recorded."
+			  << std::endl;
+
+	if (expanded > 0)
+	{
+		std::cerr << expanded << " calls came from engines with macros (" << tables.size()
+				  << " different tables) and were replayed expanded, without"
+				  << " the cost of expanding them." << std::endl;
+	}
+
+	report("recorded", recorded);
+
+	report("replayed", results.latencies());
+}
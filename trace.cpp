@@ -0,0 +1,258 @@
+#include "trace.hpp"
+#include "latex.hpp"
+
+#include <algorithm>
+
+namespace
+{
+	const char magic[] = "LTXTRC2\n";
+
+	const std::size_t magic_size = sizeof magic - 1;
+
+	/*! Flush once this much is buffered. */
+	const std::size_t buffer_size = 64 * 1024;
+
+	enum Kind : char { String = 0, Call = 1 };
+
+	void put(std::string& buffer, std::uint64_t value)
+	{
+		while (value >= 0x80)
+		{
+			buffer += static_cast<char>((value & 0x7F) | 0x80);
+
+			value >>= 7;
+		}
+
+		buffer += static_cast<char>(value);
+	}
+
+	void put(std::string& buffer, const std::string& data)
+	{
+		put(buffer, static_cast<std::uint64_t>(data.size()));
+
+		buffer += data;
+	}
+
+	// Concurrent calls are recorded as they end, so timestamps may go back
+	std::uint64_t zigzag(std::int64_t value)
+	{
+		return (static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63);
+	}
+
+	std::int64_t unzigzag(std::uint64_t value)
+	{
+		return static_cast<std::int64_t>(value >> 1) ^ -static_cast<std::int64_t>(value & 1);
+	}
+}
+
+TraceWriter::TraceWriter(const std::string& path)
+: _file(path, std::ios::binary | std::ios::trunc)
+, _previous(0)
+, _start(std::chrono::steady_clock::now())
+{
+	if (! _file) throw Latex::FileException("Could not open trace " + path);
+
+	_buffer.reserve(buffer_size);
+
+	_buffer.append(magic, magic_size);
+}
+
+TraceWriter::~TraceWriter()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	_flush();
+}
+
+void TraceWriter::record(const TraceRecord& record)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	auto css = _intern(record.css);
+
+	auto stylesheet = _intern(record.stylesheet);
+
+	auto delta = static_cast<std::int64_t>(record.timestamp - _previous);
+
+	_previous = record.timestamp;
+
+	_buffer += static_cast<char>(Kind::Call);
+
+	put(_buffer, zigzag(delta));
+	put(_buffer, record.latency);
+
+	_buffer += static_cast<char>(record.method);
+	_buffer += static_cast<char>(record.status);
+	_buffer += static_cast<char>(record.output_mode);
+
+	put(_buffer, css);
+	put(_buffer, stylesheet);
+	put(_buffer, record.macros);
+	put(_buffer, record.equation);
+
+	if (_buffer.size() >= buffer_size) _flush();
+}
+
+void TraceWriter::flush()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	_flush();
+
+	_file.flush();
+}
+
+std::uint64_t TraceWriter::now() const
+{
+	auto elapsed = std::chrono::steady_clock::now() - _start;
+
+	return std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+}
+
+std::uint64_t TraceWriter::_intern(const std::string& string)
+{
+	if (string.empty()) return 0;
+
+	auto entry = _strings.find(string);
+
+	if (entry != _strings.end()) return entry->second;
+
+	auto id = _strings.size() + 1;
+
+	_strings.emplace(string, id);
+
+	_buffer += static_cast<char>(Kind::String);
+
+	put(_buffer, string);
+
+	return id;
+}
+
+void TraceWriter::_flush()
+{
+	// A failing disk shouldn't fail renders, so errors are not reported
+	_file.write(_buffer.data(), _buffer.size());
+
+	_buffer.clear();
+}
+
+TraceReader::TraceReader(const std::string& path)
+: _file(path, std::ios::binary)
+, _strings(1)
+, _previous(0)
+{
+	if (! _file) throw Latex::FileException("Could not open trace " + path);
+
+	char header[magic_size];
+
+	if (! _file.read(header, magic_size) ||
+		std::string(header, magic_size) != magic)
+	{
+		throw Latex::FileException(path + " is not a trace");
+	}
+}
+
+bool TraceReader::next(TraceRecord& record)
+{
+	while (true)
+	{
+		auto kind = _file.get();
+
+		if (kind == std::char_traits<char>::eof()) return false;
+
+		if (kind == Kind::String)
+		{
+			_strings.push_back(_string());
+
+			continue;
+		}
+
+		if (kind != Kind::Call) throw Latex::FileException("Malformed trace");
+
+		_previous += unzigzag(_varint());
+
+		record.timestamp = _previous;
+
+		record.latency = static_cast<std::uint32_t>(_varint());
+
+		auto method = _file.get();
+		auto status = _file.get();
+		auto mode = _file.get();
+
+		if (method > static_cast<int>(TraceRecord::Method::SVG) ||
+			status > static_cast<int>(TraceRecord::Status::Error) ||
+			mode > static_cast<int>(Latex::OutputMode::MathML) ||
+			method < 0 || status < 0 || mode < 0)
+		{
+			throw Latex::FileException("Malformed trace");
+		}
+
+		record.method = static_cast<TraceRecord::Method>(method);
+		record.status = static_cast<TraceRecord::Status>(status);
+		record.output_mode = static_cast<std::uint8_t>(mode);
+
+		record.css = _interned();
+
+		record.stylesheet = _interned();
+
+		record.macros = _varint();
+
+		record.equation = _string();
+
+		return true;
+	}
+}
+
+const std::string& TraceReader::_interned()
+{
+	auto id = _varint();
+
+	if (id >= _strings.size()) throw Latex::FileException("Malformed trace");
+
+	return _strings[id];
+}
+
+std::uint64_t TraceReader::_varint()
+{
+	std::uint64_t value = 0;
+
+	for (unsigned shift = 0; shift < 64; shift += 7)
+	{
+		auto byte = _file.get();
+
+		if (byte == std::char_traits<char>::eof())
+		{
+			throw Latex::FileException("Truncated trace");
+		}
+
+		value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+
+		if (! (byte & 0x80)) return value;
+	}
+
+	throw Latex::FileException("Malformed trace");
+}
+
+std::string TraceReader::_string()
+{
+	auto size = _varint();
+
+	std::string data;
+
+	// Grows as bytes actually arrive, so a corrupt size can't exhaust memory
+	while (data.size() < size)
+	{
+		char chunk[4096];
+
+		auto wanted = std::min<std::uint64_t>(sizeof chunk, size - data.size());
+
+		if (! _file.read(chunk, static_cast<std::streamsize>(wanted)))
+		{
+			throw Latex::FileException("Truncated trace");
+		}
+
+		data.append(chunk, wanted);
+	}
+
+	return data;
+}
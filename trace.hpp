@@ -0,0 +1,215 @@
+/********************************************************//*!
+*
+*	@file trace.hpp
+*
+*	@author Peter Goldsborough.
+*
+************************************************************/
+
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/***************************************************************************//*!
+*
+*	@brief A call of the Latex API, as captured in a trace.
+*
+*******************************************************************************/
+
+struct TraceRecord
+{
+	/*! What the call rendered to. */
+	enum class Method : std::uint8_t { HTML, PNG, JPG, SVG };
+
+	/*! How the call ended. */
+	enum class Status : std::uint8_t { OK, ParseError, Error };
+
+	/*! When the call started, in microseconds since the trace started. */
+	std::uint64_t timestamp = 0;
+
+	/*! How long the call took, in microseconds. */
+	std::uint32_t latency = 0;
+
+	Method method = Method::HTML;
+
+	Status status = Status::OK;
+
+	/*! The LaTeX snippet, with its macros expanded. */
+	std::string equation;
+
+	/*! The engine's additional CSS at the time of the call. */
+	std::string css;
+
+	/*! The path of the engine's base stylesheet. */
+	std::string stylesheet;
+
+	/*! The engine's output mode, as a Latex::OutputMode. */
+	std::uint8_t output_mode = 0;
+
+	/*! The fingerprint of the engine's macros (see Macros), or 0
+	    if it had none. The equation is recorded expanded, so this
+	    only tells which calls used which macros. */
+	std::uint64_t macros = 0;
+};
+
+/***************************************************************************//*!
+*
+*	@brief Appends calls to a compact binary trace file.
+*
+*	@details A trace starts with the magic bytes "LTXTRC2\n", followed by
+*			 entries. Every entry starts with a kind byte. A string entry
+*			 (0) holds a string (a varint length and the bytes) and gives
+*			 it the next string id, starting at 1; id 0 is the empty
+*			 string. CSS and stylesheet paths are written once as string
+*			 entries and referred to by id. A call entry (1) holds the
+*			 zigzag varint difference between its timestamp and the
+*			 previous call's, the varint latency, the method, status and
+*			 output mode bytes, the varint ids of the CSS and of the
+*			 stylesheet, the varint macro fingerprint and the equation
+*			 string.
+*
+*			 Entries are buffered in memory and written in large chunks.
+*			 A writer may be shared by engines on different threads.
+*
+*******************************************************************************/
+
+class TraceWriter
+{
+public:
+
+	/***********************************************************************//*!
+	*
+	*	@brief Creates (or truncates) a trace file.
+	*
+	*	@throws Latex::FileException If the file could not be opened.
+	*
+	***************************************************************************/
+
+	explicit TraceWriter(const std::string& path);
+
+	TraceWriter(const TraceWriter& other) = delete;
+
+	TraceWriter& operator=(const TraceWriter& other) = delete;
+
+	/***********************************************************************//*!
+	*
+	*	@brief Writes all buffered entries and closes the file.
+	*
+	***************************************************************************/
+
+	virtual ~TraceWriter();
+
+	/***********************************************************************//*!
+	*
+	*	@brief Appends a call to the trace. Thread-safe.
+	*
+	***************************************************************************/
+
+	virtual void record(const TraceRecord& record);
+
+	/***********************************************************************//*!
+	*
+	*	@brief Writes all buffered entries to the file. Thread-safe.
+	*
+	***************************************************************************/
+
+	virtual void flush();
+
+	/***********************************************************************//*!
+	*
+	*	@brief Returns the microseconds elapsed since the trace started.
+	*
+	***************************************************************************/
+
+	std::uint64_t now() const;
+
+protected:
+
+	/*! Writes the buffer out. Must be called with the mutex held. */
+	virtual void _flush();
+
+	std::ofstream _file;
+
+	/*! Entries not yet written to the file. */
+	std::string _buffer;
+
+	/*! Returns the id of a string, writing a string entry for it
+	    if it is new. Must be called with the mutex held. */
+	virtual std::uint64_t _intern(const std::string& string);
+
+	/*! The ids of the strings written so far. */
+	std::unordered_map<std::string, std::uint64_t> _strings;
+
+	/*! The timestamp of the previous call entry. */
+	std::uint64_t _previous;
+
+	/*! When the trace started. */
+	std::chrono::steady_clock::time_point _start;
+
+	/*! Guards all of the above. */
+	std::mutex _mutex;
+};
+
+/***************************************************************************//*!
+*
+*	@brief Reads the calls of a trace written by a TraceWriter.
+*
+*******************************************************************************/
+
+class TraceReader
+{
+public:
+
+	/***********************************************************************//*!
+	*
+	*	@brief Opens a trace file.
+	*
+	*	@throws Latex::FileException If the file could not be opened
+	*			or is not a trace.
+	*
+	***************************************************************************/
+
+	explicit TraceReader(const std::string& path);
+
+	/***********************************************************************//*!
+	*
+	*	@brief Reads the next call.
+	*
+	*	@param record Set to the call.
+	*
+	*	@return False at the end of the trace, else true.
+	*
+	*	@throws Latex::FileException If the trace is malformed.
+	*
+	***************************************************************************/
+
+	virtual bool next(TraceRecord& record);
+
+protected:
+
+	/*! Reads a varint. */
+	virtual std::uint64_t _varint();
+
+	/*! Reads a varint-length prefixed string. */
+	virtual std::string _string();
+
+	std::ifstream _file;
+
+	/*! Reads a string id and returns its string. */
+	virtual const std::string& _interned();
+
+	/*! The strings defined so far, by id. */
+	std::vector<std::string> _strings;
+
+	/*! The timestamp of the previous call. */
+	std::uint64_t _previous;
+};
+
+#endif /* TRACE_HPP */